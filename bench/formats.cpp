@@ -0,0 +1,80 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Throughput of repr for each OutputFormat.
+//
+// Build (debug info is required):
+//   g++ -std=c++17 -O2 -g -I.. formats.cpp -o formats
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <librepr.hpp>
+
+enum class Side { Buy, Sell };
+
+struct Order
+{
+    int64_t id = 1234567;
+    Side side = Side::Sell;
+    double price = 101.25;
+    uint32_t qty = 300;
+    bool active = true;
+    char venue[8] = "XNAS";
+    std::string client = "client-42";
+};
+
+struct Book
+{
+    std::vector<Order> orders = std::vector<Order>(100);
+};
+
+struct Series
+{
+    std::vector<double> samples = std::vector<double>(1000, 0.125);
+};
+
+template <typename T>
+void run(const char *name, const T &val)
+{
+    const char *formats[] = {"repr", "json", "msgpack"};
+    for (int f = 0; f < 3; ++f)
+    {
+        librepr::ReprOptions opts;
+        opts.format = static_cast<librepr::OutputFormat>(f);
+
+        size_t iters = 0;
+        size_t bytes = 0;
+        auto begin = std::chrono::steady_clock::now();
+        auto end = begin;
+        while (end - begin < std::chrono::milliseconds(500))
+        {
+            for (int i = 0; i < 100; ++i)
+            {
+                bytes += librepr::repr(val, opts).size();
+            }
+            iters += 100;
+            end = std::chrono::steady_clock::now();
+        }
+
+        double secs = std::chrono::duration<double>(end - begin).count();
+        std::cout << name << "\t" << formats[f]
+                  << "\t" << (size_t)(iters / secs) << " calls/s"
+                  << "\t" << (int)(bytes / secs / 1e6) << " MB/s"
+                  << "\t" << bytes / iters << " bytes/call\n";
+    }
+}
+
+int main()
+{
+    run("order", Order{});
+    run("book", Book{});
+    run("series", Series{});
+    return 0;
+}
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+#
+# Copyright 2021 Mustafa Serdar Sanli
+#
+# Distributed under the Boost Software License, Version 1.0.
+# See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+#
+
+# How librepr scales with the size of the debug data.
+#
+# Generates a synthetic program with the given number of compilation units, structs, enums, nesting depth and repr
+# callsites, builds it with each compiler and DWARF version, and runs it. Prints one JSON object per build:
+#
+#   init_us             first repr call, which loads the debug data
+#   per_call_ns         later calls, cycling through all callsites
+#   mt_calls_per_sec    total calls per second with --threads threads
+#   max_rss_kb          peak RSS of the whole run, VmHWM of the benchmark itself
+#   minor_faults        page faults of the whole run
+#   major_faults
+#   debug_info_bytes    size of .debug_info
+#
+# Usage:
+#   ./scaling.py --cus 50 --structs 2000 --enums 500 --depth 4 --callsites 1000 > results.jsonl
+#
+# Compilers which aren't installed are skipped.
+
+import argparse
+import json
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def generate(args, out_dir):
+    """Writes cu_<i>.cpp for each compilation unit and main.cpp, returns the list of sources."""
+
+    # Structs are in chains of `depth`, each one holding the previous one of its chain
+    def struct_def(i):
+        fields = [
+            '    int64_t id = %d;' % i,
+            '    double value = %d.5;' % i,
+            '    bool flag = true;',
+            '    std::string name = "s%d";' % i,
+            '    std::vector<int> items{1, 2, 3};',
+        ]
+        if args.enums:
+            fields.append('    E%d kind = E%d::V1;' % (i % args.enums, i % args.enums))
+        if i % args.depth and i > 0:
+            fields.append('    S%d inner;' % (i - 1))
+        return 'struct S%d\n{\n%s\n};\n' % (i, '\n'.join(fields))
+
+    # Types are declared in a single header, so that every unit sees the ones it nests
+    with open(os.path.join(out_dir, 'types.hpp'), 'w') as f:
+        f.write('#pragma once\n#include <cstdint>\n#include <string>\n#include <vector>\n\n')
+        for i in range(args.enums):
+            f.write('enum class E%d { %s };\n' % (i, ', '.join('V%d' % v for v in range(8))))
+        f.write('\n')
+        for i in range(args.structs):
+            f.write(struct_def(i) + '\n')
+
+    # Callsites are spread over units, each unit defines one function per callsite
+    callsites = [[] for _ in range(args.cus)]
+    for c in range(args.callsites):
+        callsites[c % args.cus].append(c)
+
+    types = ['S%d' % i for i in range(args.structs)] + ['E%d' % i for i in range(args.enums)]
+    sources = []
+    for u in range(args.cus):
+        path = os.path.join(out_dir, 'cu_%d.cpp' % u)
+        with open(path, 'w') as f:
+            f.write('#include <librepr.hpp>\n#include "types.hpp"\n\n')
+            for c in callsites[u]:
+                f.write('std::string call_%d() { return librepr::repr(%s{}); }\n' % (c, types[c % len(types)]))
+        sources.append(path)
+
+    with open(os.path.join(out_dir, 'main.cpp'), 'w') as f:
+        f.write('#include <atomic>\n#include <chrono>\n#include <cstdio>\n#include <cstdlib>\n#include <cstring>\n#include <string>\n#include <thread>\n#include <vector>\n\n')
+        for c in range(args.callsites):
+            f.write('std::string call_%d();\n' % c)
+        f.write('\nusing Call = std::string(*)();\nstatic const Call calls[] = {\n')
+        f.write(''.join('    call_%d,\n' % c for c in range(args.callsites)))
+        f.write('};\n')
+        f.write(MAIN % {'iterations': args.iterations, 'threads': args.threads})
+    sources.append(os.path.join(out_dir, 'main.cpp'))
+    return sources
+
+
+MAIN = r'''
+// Peak RSS of this process. Not getrusage: after fork and exec, ru_maxrss starts from the peak of the parent.
+static long max_rss_kb()
+{
+    long res = -1;
+    char line[256];
+    FILE *f = fopen("/proc/self/status", "r");
+    while (f && fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "VmHWM:", 6) == 0)
+        {
+            res = atol(line + 6);
+        }
+    }
+    if (f)
+    {
+        fclose(f);
+    }
+    return res;
+}
+
+int main()
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr size_t N = sizeof(calls) / sizeof(calls[0]);
+    size_t sink = 0;
+
+    auto t0 = Clock::now();
+    sink += calls[0]().size();
+    double init_us = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+
+    const size_t iterations = %(iterations)d;
+    auto t1 = Clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        sink += calls[i %% N]().size();
+    }
+    double per_call_ns = std::chrono::duration<double, std::nano>(Clock::now() - t1).count() / iterations;
+
+    const size_t threads = %(threads)d;
+    std::atomic<size_t> total{0};
+    auto t2 = Clock::now();
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        pool.emplace_back([&, t]()
+        {
+            size_t local = 0;
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                local += calls[(i + t) %% N]().size();
+            }
+            total += local;
+        });
+    }
+    for (auto &th : pool)
+    {
+        th.join();
+    }
+    double mt_seconds = std::chrono::duration<double>(Clock::now() - t2).count();
+
+    printf("{\"init_us\": %%.1f, \"per_call_ns\": %%.1f, \"mt_calls_per_sec\": %%.0f, \"max_rss_kb\": %%ld, \"sink\": %%zu}\n",
+           init_us, per_call_ns, threads * iterations / mt_seconds, max_rss_kb(), sink + total.load());
+    return 0;
+}
+'''
+
+
+def section_size(path, name):
+    """Size of a section of a 64-bit little endian ELF file, 0 if it's missing. Only the headers are read, so that
+    large executables don't add to the peak RSS of this script."""
+    with open(path, 'rb') as f:
+        ehdr = f.read(0x40)
+        shoff, = struct.unpack_from('<Q', ehdr, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', ehdr, 0x3a)
+        f.seek(shoff)
+        shdrs = f.read(shnum * shentsize)
+        strtab_off, strtab_size = struct.unpack_from('<QQ', shdrs, shstrndx * shentsize + 0x18)
+        f.seek(strtab_off)
+        strtab = f.read(strtab_size)
+    for i in range(shnum):
+        hdr = i * shentsize
+        name_off, = struct.unpack_from('<I', shdrs, hdr)
+        end = strtab.index(b'\0', name_off)
+        if strtab[name_off:end].decode() == name:
+            size, = struct.unpack_from('<Q', shdrs, hdr + 0x20)
+            return size
+    return 0
+
+
+def build(compiler, dwarf, sources, out_dir, jobs):
+    """Compiles units in parallel and links them, returns the executable and the build time."""
+    flags = ['-std=c++17', '-O2', '-gdwarf-%d' % dwarf, '-I' + REPO, '-I' + out_dir]
+    tag = '%s-dwarf%d' % (os.path.basename(compiler), dwarf)
+    start = time.monotonic()
+
+    objects, pending = [], []
+    for src in sources:
+        obj = src[:-4] + '.' + tag + '.o'
+        objects.append(obj)
+        pending.append(subprocess.Popen([compiler] + flags + ['-c', src, '-o', obj]))
+        if len(pending) >= jobs:
+            if pending.pop(0).wait() != 0:
+                raise RuntimeError('Compilation failed')
+    for p in pending:
+        if p.wait() != 0:
+            raise RuntimeError('Compilation failed')
+
+    exe = os.path.join(out_dir, 'bench-' + tag)
+    subprocess.check_call([compiler] + flags + objects + ['-o', exe, '-pthread'])
+    return exe, time.monotonic() - start
+
+
+def run(exe):
+    """Runs the benchmark, adds resource usage of the child process to its output."""
+    proc = subprocess.Popen([exe], stdout=subprocess.PIPE)
+    output = proc.stdout.read()
+    _, status, usage = os.wait4(proc.pid, 0)
+    if status != 0:
+        raise RuntimeError('%s failed' % exe)
+
+    res = json.loads(output)
+    del res['sink']
+    res['minor_faults'] = usage.ru_minflt
+    res['major_faults'] = usage.ru_majflt
+    return res
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--cus', type=int, default=10, help='number of compilation units')
+    parser.add_argument('--structs', type=int, default=200, help='number of distinct structs')
+    parser.add_argument('--enums', type=int, default=50, help='number of distinct enums')
+    parser.add_argument('--depth', type=int, default=3, help='nesting depth of structs')
+    parser.add_argument('--callsites', type=int, default=100, help='number of repr<T> instantiations')
+    parser.add_argument('--iterations', type=int, default=100000, help='calls per measurement')
+    parser.add_argument('--threads', type=int, default=4, help='threads of the throughput measurement')
+    parser.add_argument('--compilers', default='g++,clang++')
+    parser.add_argument('--dwarf', default='4,5', help='DWARF versions')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count())
+    parser.add_argument('--keep', help='directory to keep the generated sources and builds in')
+    args = parser.parse_args()
+    args.cus = max(args.cus, 1)
+    args.depth = max(args.depth, 1)
+    args.callsites = max(args.callsites, 1)
+
+    out_dir = args.keep or tempfile.mkdtemp(prefix='librepr-scaling-')
+    os.makedirs(out_dir, exist_ok=True)
+    try:
+        sources = generate(args, out_dir)
+        for compiler in args.compilers.split(','):
+            if not shutil.which(compiler):
+                print('Skipping %s, not found' % compiler, file=sys.stderr)
+                continue
+            for dwarf in (int(d) for d in args.dwarf.split(',')):
+                exe, build_seconds = build(compiler, dwarf, sources, out_dir, args.jobs)
+                res = {
+                    'compiler': compiler,
+                    'dwarf': dwarf,
+                    'cus': args.cus,
+                    'structs': args.structs,
+                    'enums': args.enums,
+                    'depth': args.depth,
+                    'callsites': args.callsites,
+                    'threads': args.threads,
+                    'build_seconds': round(build_seconds, 2),
+                    'debug_info_bytes': section_size(exe, '.debug_info'),
+                }
+                res.update(run(exe))
+                print(json.dumps(res), flush=True)
+    finally:
+        if not args.keep:
+            shutil.rmtree(out_dir)
+
+
+if __name__ == '__main__':
+    main()
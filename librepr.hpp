@@ -11,26 +11,48 @@
 #define LIBREPR_HPP_
 #include <string.h>
 #include <elf.h>
+#include <cxxabi.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stddef.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <mutex>
+#include <new>
 #include <vector>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <set>
+#include <shared_mutex>
 #include <sstream>
 #include <string_view>
 #include <unordered_map>
 #include <type_traits>
 #include <cstdint>
+#include <future>
 #include <optional>
+#include <thread>
+#include <tuple>
+#include <utility>
 
 
 namespace librepr::_internal_v3 {
@@ -717,6 +739,10 @@ struct RawDwarfData
     Buffer debug_info;
     Buffer debug_abbrev;
     Buffer debug_str;
+    Buffer build_id; // Contents of the GNU build-id note of the executable, empty if it has none
+    Buffer layouts; // Contents of the .librepr section written by librepr-embed, empty if it has none
+    Buffer symtab;  // .symtab and its string table, empty if stripped
+    Buffer strtab;
 
     RawDwarfData() = default;
 
@@ -724,6 +750,10 @@ struct RawDwarfData
         : debug_info(ot.debug_info)
         , debug_abbrev(ot.debug_abbrev)
         , debug_str(ot.debug_str)
+        , build_id(ot.build_id)
+        , layouts(ot.layouts)
+        , symtab(ot.symtab)
+        , strtab(ot.strtab)
     {
         // TODO steal destructor
     }
@@ -734,9 +764,29 @@ struct RawDwarfData
         debug_info = ot.debug_info;
         debug_abbrev = ot.debug_abbrev;
         debug_str = ot.debug_str;
+        build_id = ot.build_id;
+        layouts = ot.layouts;
+        symtab = ot.symtab;
+        strtab = ot.strtab;
         return *this;
     }
 
+    // FNV-1a of the build-id, 0 if there is none
+    uint64_t buildIdHash() const
+    {
+        if (build_id.empty())
+        {
+            return 0;
+        }
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (uint8_t c : build_id)
+        {
+            hash = (hash ^ c) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
     static RawDwarfData LoadELF(const char *path)
     {
         int fd __attribute__((__cleanup__(CleanupFD))) = open(path, O_RDONLY);
@@ -786,7 +836,7 @@ struct RawDwarfData
         Elf64_Shdr *sec_shstr = reinterpret_cast<Elf64_Shdr*>(file_begin + elf->e_shoff + elf->e_shentsize * elf->e_shstrndx);
         uint8_t *shstr = file_begin + sec_shstr->sh_offset;
 
-        Buffer debug_info, debug_abbrev, debug_str;
+        Buffer debug_info, debug_abbrev, debug_str, build_id, layouts, symtab, strtab;
         const char *debug_link = nullptr;
         for (int i = 0; i < elf->e_shnum; ++i)
         {
@@ -805,15 +855,48 @@ struct RawDwarfData
             {
                 debug_str = Buffer(file_begin + shdr->sh_offset, shdr->sh_size);
             }
+            else if (strcmp(sname, ".librepr") == 0)
+            {
+                layouts = Buffer(file_begin + shdr->sh_offset, shdr->sh_size);
+            }
+            else if (shdr->sh_type == SHT_SYMTAB && shdr->sh_link < elf->e_shnum)
+            {
+                Elf64_Shdr *link = reinterpret_cast<Elf64_Shdr*>(file_begin + elf->e_shoff + elf->e_shentsize * shdr->sh_link);
+                symtab = Buffer(file_begin + shdr->sh_offset, shdr->sh_size);
+                strtab = Buffer(file_begin + link->sh_offset, link->sh_size);
+            }
             else if (strcmp(sname, ".gnu_debuglink") == 0)
             {
                 debug_link = reinterpret_cast<const char*>(file_begin + shdr->sh_offset);
             }
+            else if (strcmp(sname, ".note.gnu.build-id") == 0 && shdr->sh_size >= sizeof(Elf64_Nhdr))
+            {
+                Elf64_Nhdr *note = reinterpret_cast<Elf64_Nhdr*>(file_begin + shdr->sh_offset);
+                uint8_t *desc = reinterpret_cast<uint8_t*>(note + 1) + ((note->n_namesz + 3) & ~3u);
+                if (note->n_type == NT_GNU_BUILD_ID && desc + note->n_descsz <= file_begin + shdr->sh_offset + shdr->sh_size)
+                {
+                    build_id = Buffer(desc, note->n_descsz);
+                }
+            }
         }
 
         if (!debug_info.empty() && !debug_abbrev.empty() && !debug_str.empty())
         {
-            return RawDwarfData(debug_info, debug_abbrev, debug_str);
+            RawDwarfData res(debug_info, debug_abbrev, debug_str);
+            res.build_id = build_id;
+            res.layouts = layouts;
+            res.symtab = symtab;
+            res.strtab = strtab;
+            return res;
+        }
+
+        // Stripped executables can still be printed from their layout table, without looking for the debug link
+        if (!layouts.empty())
+        {
+            RawDwarfData res;
+            res.build_id = build_id;
+            res.layouts = layouts;
+            return res;
         }
 
         if (debug_link)
@@ -843,12 +926,60 @@ struct RawDwarfData
             }
 
             strcat(buf, debug_link); // TODO unsafe
-            return RawDwarfData::LoadELF(buf); // TODO this doesn't work when debug_link file is not in the same dir
+            RawDwarfData res = RawDwarfData::LoadELF(buf); // TODO this doesn't work when debug_link file is not in the same dir
+            if (!build_id.empty())
+            {
+                res.build_id = build_id;
+            }
+            if (!symtab.empty())
+            {
+                res.symtab = symtab;
+                res.strtab = strtab;
+            }
+            return res;
         }
 
         throw std::runtime_error("No debug info found");
     }
 
+    // Whether LoadELF could find anything in the file: a .debug_info, .librepr or .gnu_debuglink section. Reads only
+    // the section headers and their names. Files which can't be read this way count as having debug data, so that
+    // LoadELF reports what's wrong with them.
+    static bool HasDebugData(const char *path)
+    {
+        int fd __attribute__((__cleanup__(CleanupFD))) = open(path, O_RDONLY);
+        Elf64_Ehdr elf;
+        if (fd == -1 || pread(fd, &elf, sizeof(elf), 0) != sizeof(elf) || *(uint32_t*)&elf != 0x464C457f ||
+            elf.e_ident[4] != ELFCLASS64 || elf.e_shentsize != sizeof(Elf64_Shdr) || elf.e_shstrndx >= elf.e_shnum)
+        {
+            return true;
+        }
+
+        std::vector<Elf64_Shdr> shdrs(elf.e_shnum);
+        ssize_t shdrsSize = shdrs.size() * sizeof(Elf64_Shdr);
+        if (pread(fd, shdrs.data(), shdrsSize, elf.e_shoff) != shdrsSize)
+        {
+            return true;
+        }
+
+        const Elf64_Shdr &sec_shstr = shdrs[elf.e_shstrndx];
+        std::string shstr(sec_shstr.sh_size, '\0');
+        if (pread(fd, shstr.data(), shstr.size(), sec_shstr.sh_offset) != (ssize_t)shstr.size())
+        {
+            return true;
+        }
+
+        for (const Elf64_Shdr &shdr : shdrs)
+        {
+            const char *sname = shdr.sh_name < shstr.size() ? shstr.c_str() + shdr.sh_name : "";
+            if (strcmp(sname, ".debug_info") == 0 || strcmp(sname, ".librepr") == 0 || strcmp(sname, ".gnu_debuglink") == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
 private:
 
     static void CleanupFD(int *fd)
@@ -896,6 +1027,11 @@ struct DIEAccessor
         return _abbrev->has_children;
     }
 
+    bool has(DwarfAttr attr)
+    {
+        return _abbrev->findAttrIdxByName(attr) != (size_t)-1;
+    }
+
 
     RawDwarfData& getRawDwarfData();
 
@@ -1003,7 +1139,9 @@ struct DIEAccessor
         case DwarfForm::Data2: return (uint64_t)*(const uint16_t*)(_attrData[idx]);
         case DwarfForm::Data4: return (uint64_t)*(const uint32_t*)(_attrData[idx]);
         case DwarfForm::Data8: return (uint64_t)*(const uint64_t*)(_attrData[idx]);
+        case DwarfForm::Udata: return Reader::DecodeLEB128Unsigned(_attrData[idx]);
         case DwarfForm::Sdata: return Reader::DecodeLEB128Signed(_attrData[idx]);
+        case DwarfForm::ImplicitConst: return _abbrev->attrs[idx].implicit_const;
         default: return std::nullopt;
         }
     }
@@ -1011,20 +1149,33 @@ struct DIEAccessor
 
 struct DebugDataLoader
 {
-    void loadFile(const char *path)
+    // With `layoutsOnly`, compilation units aren't parsed if the file has a .librepr section
+    void loadFile(const char *path, bool layoutsOnly = false)
     {
         try
         {
-            loadFileImpl(path);
+            loadFileImpl(path, layoutsOnly);
         }
         catch (const std::runtime_error &err)
         {
             std::cerr << err.what() << "\n";
             std::cerr << "librepr: Error loading file: " << path << ". Values will not be pretty printed.\n";
+            _error = err.what();
             _compilation_units.clear();
         }
     }
 
+    // Heap memory held for the loaded units, the file itself is mapped
+    size_t memoryUsage() const
+    {
+        size_t res = _compilation_units.capacity() * sizeof(DwarfCompilationUnit);
+        for (const auto &cu : _compilation_units)
+        {
+            res += cu._abbrev_data_unpacked.capacity() + cu._abbrev_offsets.capacity() * sizeof(uint32_t);
+        }
+        return res;
+    }
+
     size_t num_compilation_units()
     {
         return _compilation_units.size();
@@ -1045,6 +1196,8 @@ struct DebugDataLoader
             curDie._rangeEnd = rdd.debug_info.data() + cu->_offset + cu->_size;
             curDie._abbrev = &abbrev;
             curDie._nextDieBegin = it._it;
+            ++_dies_loaded;
+            _die_bytes_loaded += it._it - die;
             return curDie;
         }
 
@@ -1106,10 +1259,24 @@ struct DebugDataLoader
         }
 
         curDie._nextDieBegin = it._it;
+        ++_dies_loaded;
+        _die_bytes_loaded += it._it - die;
 
         return curDie;
     }
 
+    // Index of the compilation unit containing `debug_info_offset`, or -1
+    size_t findCompilationUnit(uint64_t debug_info_offset)
+    {
+        auto it = std::upper_bound(_compilation_units.begin(), _compilation_units.end(), debug_info_offset,
+                                   [](uint64_t offset, const DwarfCompilationUnit &cu) { return offset < cu._offset; });
+        if (it == _compilation_units.begin() || debug_info_offset >= std::prev(it)->_offset + std::prev(it)->_size)
+        {
+            return -1;
+        }
+        return std::prev(it) - _compilation_units.begin();
+    }
+
     DIEAccessor loadCompilationUnitRootDie(size_t cu_idx)
     {
         return loadCompilationUnitDie(cu_idx, _compilation_units[cu_idx]._root_die_offset);
@@ -1125,11 +1292,31 @@ struct DebugDataLoader
     RawDwarfData rdd;
     std::vector<DwarfCompilationUnit> _compilation_units;
 
+    // Collected for librepr::stats()
+    std::chrono::nanoseconds _load_elf_time{0};
+    std::chrono::nanoseconds _parse_abbrev_time{0}; // Unit headers and abbreviation tables
+    uint64_t _dies_loaded = 0;
+    uint64_t _die_bytes_loaded = 0;
+    std::string _error; // Why the file couldn't be loaded, empty if it could
+
 private:
-    void loadFileImpl(const char *path)
+    void loadFileImpl(const char *path, bool layoutsOnly)
     {
+        auto start = std::chrono::steady_clock::now();
         rdd = RawDwarfData::LoadELF(path);
+        _load_elf_time = std::chrono::steady_clock::now() - start;
+        if (layoutsOnly && !rdd.layouts.empty())
+        {
+            return;
+        }
+
+        start = std::chrono::steady_clock::now();
+        parseCompilationUnits();
+        _parse_abbrev_time = std::chrono::steady_clock::now() - start;
+    }
 
+    void parseCompilationUnits()
+    {
         Reader it(rdd.debug_info.data());
 
         for (int i = 0; ; ++i)
@@ -1216,460 +1403,6526 @@ inline RawDwarfData& DIEAccessor::getRawDwarfData()
 }
 
 
-using StringifyFunc = void(*)(std::ostream &out, void *type_info, const void *obj);
-struct StringifyFuncAndTypeInfo
+enum class OutputFormat
 {
-    StringifyFunc func;
-    void *type_info;
+    Repr,    // C++ designated initializer syntax, e.g. {.foo=5, .suit=Suit::Spades}
+    Json,    // Compact JSON, e.g. {"foo":5,"suit":"Spades"}
+    MsgPack, // MessagePack, with the same structure as Json
 };
 
-struct DwarfStringify2
+constexpr size_t kNumOutputFormats = 3;
+
+struct ReprOptions
 {
-    template <typename UnderlyingT>
-    struct EnumClassTypeInfo
-    {
-        const char *enum_name;
-        std::unordered_map<UnderlyingT, const char*> valueToNameMap;
-    };
+    OutputFormat format = OutputFormat::Repr;
 
-    struct StructTypeInfo
-    {
-        struct MemberInfo
-        {
-            const char *name;
-            size_t offset;
-            StringifyFuncAndTypeInfo stringifier;
-        };
-        std::vector<MemberInfo> members;
-    };
+    // Zero means unlimited for all of the limits below, except max_depth which defaults to kDefaultMaxDepth
+    size_t max_depth = 0;                 // Nesting depth of aggregates
+    size_t max_elements = 0;              // Number of elements printed per aggregate
+    size_t max_bytes = 0;                 // Size of the output, excluding the trailing "..." marker
+    std::chrono::nanoseconds timeout{0};  // Time budget starting from the beginning of the repr call
+};
 
-    template <typename UnderlyingT>
-    static void EnumClass(std::ostream &out, void *type_info_, const void *val_)
+// Objects can refer to themselves through smart pointers, nesting is always capped to avoid infinite recursion
+constexpr size_t kDefaultMaxDepth = 256;
+
+// Number of repr calls which had their output truncated due to ReprOptions limits
+inline std::atomic<uint64_t> gTruncatedReprCount{0};
+
+// RawDwarfData::buildIdHash of the running executable, set once debug data is loaded
+inline std::atomic<uint64_t> gBuildIdHash{0};
+
+// Why a stringifier prints "???"
+enum class FallbackReason
+{
+    NoDebugData,     // The debug data (or .librepr section) couldn't be loaded
+    NotInDebugData,  // The stringifier wasn't found in the debug data
+    UnsupportedType, // A type (possibly a member of the printed one) has no printer
+};
+
+constexpr size_t kNumFallbackReasons = 3;
+
+// What loading the debug data cost, see librepr::stats()
+struct ReprStats
+{
+    // Time spent in each phase of loading
+    std::chrono::nanoseconds load_elf{0};           // Mapping the file and finding its sections
+    std::chrono::nanoseconds parse_abbrev{0};       // Unit headers and abbreviation tables
+    std::chrono::nanoseconds find_global_offset{0};
+    std::chrono::nanoseconds bind{0};               // Binding all stringifiers, from the debug data or the .librepr section
+
+    uint64_t compilation_units = 0;
+    uint64_t dies_visited = 0;
+    uint64_t debug_info_bytes = 0;       // Of .debug_info read, DIEs read more than once are counted each time
+    uint64_t stringifiers_resolved = 0;  // Types loaded
+    uint64_t stringifier_cache_hits = 0; // Lookups of types which were already loaded
+    uint64_t loader_bytes = 0;           // Heap memory held by the debug data loader, not counting the mapped file
+    uint64_t registry_bytes = 0;         // Heap memory held by the stringifiers, approximately
+    uint64_t shared_layout_bytes = 0;    // Shared memory holding the layouts after prepare_fork
+
+    std::array<uint64_t, kNumFallbackReasons> fallbacks{}; // Stringifiers printing "???", by FallbackReason
+    uint64_t unknown_printed = 0;                          // Values printed as "???" so far
+    std::vector<std::string> errors;                       // Details of the fallbacks, also written to std::cerr
+};
+
+inline std::mutex gStatsMut;
+inline ReprStats gStats; // Guarded by gStatsMut, except unknown_printed
+inline std::atomic<uint64_t> gUnknownPrintCount{0};
+
+inline std::ostream& operator<<(std::ostream &out, const ReprStats &stats)
+{
+    auto us = [](std::chrono::nanoseconds t) { return std::chrono::duration_cast<std::chrono::microseconds>(t).count(); };
+
+    out << "librepr: load_elf=" << us(stats.load_elf) << "us parse_abbrev=" << us(stats.parse_abbrev)
+        << "us find_global_offset=" << us(stats.find_global_offset) << "us bind=" << us(stats.bind) << "us\n";
+    out << "librepr: compilation_units=" << stats.compilation_units << " dies_visited=" << stats.dies_visited
+        << " debug_info_bytes=" << stats.debug_info_bytes << "\n";
+    out << "librepr: stringifiers_resolved=" << stats.stringifiers_resolved << " stringifier_cache_hits=" << stats.stringifier_cache_hits
+        << " loader_bytes=" << stats.loader_bytes << " registry_bytes=" << stats.registry_bytes
+        << " shared_layout_bytes=" << stats.shared_layout_bytes << "\n";
+    out << "librepr: fallbacks no_debug_data=" << stats.fallbacks[static_cast<size_t>(FallbackReason::NoDebugData)]
+        << " not_in_debug_data=" << stats.fallbacks[static_cast<size_t>(FallbackReason::NotInDebugData)]
+        << " unsupported_type=" << stats.fallbacks[static_cast<size_t>(FallbackReason::UnsupportedType)]
+        << " unknown_printed=" << stats.unknown_printed << "\n";
+    for (const std::string &err : stats.errors)
     {
-        const EnumClassTypeInfo<UnderlyingT> *type_info = reinterpret_cast<const EnumClassTypeInfo<UnderlyingT>*>(type_info_);
+        out << "librepr: " << err << "\n";
+    }
+    return out;
+}
 
-        UnderlyingT val = *(const UnderlyingT*)val_;
+inline ReprStats CurrentStats()
+{
+    std::lock_guard<std::mutex> guard(gStatsMut);
+    ReprStats res = gStats;
+    res.unknown_printed = gUnknownPrintCount.load(std::memory_order_relaxed);
+    return res;
+}
 
-        constexpr bool IsSigned = std::is_signed_v<UnderlyingT>;
+// Options of librepr::preload()
+struct PreloadOptions
+{
+    // How long repr waits for a preload which is still running, before printing the raw bytes of the value instead.
+    // Zero never waits.
+    std::chrono::nanoseconds max_wait{0};
+};
 
-        auto it = type_info->valueToNameMap.find(static_cast<UnderlyingT>(val));
-        if (it != type_info->valueToNameMap.end())
-        {
-            out << type_info->enum_name << "::" << it->second;
-            return;
-        }
+// State of librepr::preload(). gPreloadFuture is set before gPreloading is first set, and only changes after in a
+// forked child.
+inline std::atomic<bool> gPreloading{false};
+inline std::atomic<int64_t> gPreloadMaxWait{0}; // Nanoseconds
+inline std::shared_future<void> gPreloadFuture;
 
-        if constexpr (IsSigned)
-        {
-            if (val == (-9223372036854775807-1))
-            {
-                out << "static_cast<" << type_info->enum_name << ">(-9223372036854775807-1)";
-            }
-            else
-            {
-                out << "static_cast<" << type_info->enum_name << ">(" << (int64_t)val << ")";
-            }
-        }
-        else
-        {
-            if (val > 9223372036854775807)
-            {
-                out << "static_cast<" << type_info->enum_name << ">(" << (uint64_t)val << "ull)";
-            }
-            else
-            {
-                out << "static_cast<" << type_info->enum_name << ">(" << (uint64_t)val << ")";
-            }
-        }
+// MessagePack encoding, all functions write to `buf` and return the end of what they wrote
+struct MsgPack
+{
+    static constexpr size_t kMaxHeaderLength = 9;
+
+    template <typename T>
+    static char* BigEndian(char *buf, T val)
+    {
+        if constexpr (sizeof(T) == 2) val = __builtin_bswap16(val);
+        if constexpr (sizeof(T) == 4) val = __builtin_bswap32(val);
+        if constexpr (sizeof(T) == 8) val = __builtin_bswap64(val);
+        memcpy(buf, &val, sizeof(T));
+        return buf + sizeof(T);
     }
 
-    static void Struct(std::ostream &out, void *type_info_, const void *val_)
+    static char* Tagged(char *buf, uint8_t tag)
     {
-        const StructTypeInfo *type_info = reinterpret_cast<const StructTypeInfo*>(type_info_);
+        *buf++ = (char)tag;
+        return buf;
+    }
 
-        (void)val_;
-        out << "{";
-        bool need_comma = false;
-        for (const auto &m : type_info->members)
-        {
-            if (need_comma) out << ", ";
-            out << "." << m.name << "=";
+    static char* UInt(char *buf, uint64_t val)
+    {
+        if (val < 0x80)        return Tagged(buf, (uint8_t)val);
+        if (val <= 0xff)       return Tagged(Tagged(buf, 0xcc), (uint8_t)val);
+        if (val <= 0xffff)     return BigEndian(Tagged(buf, 0xcd), (uint16_t)val);
+        if (val <= 0xffffffff) return BigEndian(Tagged(buf, 0xce), (uint32_t)val);
+        return BigEndian(Tagged(buf, 0xcf), val);
+    }
 
-            m.stringifier.func(out, m.stringifier.type_info, (const void*)((const char *)val_ + m.offset));
+    static char* Int(char *buf, int64_t val)
+    {
+        if (val >= 0)          return UInt(buf, (uint64_t)val);
+        if (val >= -32)        return Tagged(buf, (uint8_t)(int8_t)val);
+        if (val >= INT8_MIN)   return Tagged(Tagged(buf, 0xd0), (uint8_t)(int8_t)val);
+        if (val >= INT16_MIN)  return BigEndian(Tagged(buf, 0xd1), (uint16_t)(int16_t)val);
+        if (val >= INT32_MIN)  return BigEndian(Tagged(buf, 0xd2), (uint32_t)(int32_t)val);
+        return BigEndian(Tagged(buf, 0xd3), (uint64_t)val);
+    }
 
-            need_comma = true;
-        }
-        out << "}";
+    static char* Float(char *buf, float val)
+    {
+        uint32_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        return BigEndian(Tagged(buf, 0xca), bits);
     }
-};
 
-// Manages mapping of dwarf type refs to their relevant stringify functions and data
-struct LibReprGlobalCache
-{
-    using DwarfLocation = std::pair<uint32_t, uint32_t>; // cu_idx, cu_die_offset
+    static char* Double(char *buf, double val)
+    {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        return BigEndian(Tagged(buf, 0xcb), bits);
+    }
 
-    std::map<DwarfLocation, StringifyFuncAndTypeInfo> stringifiers;
+    static char* StrHeader(char *buf, size_t len)
+    {
+        if (len < 32)          return Tagged(buf, (uint8_t)(0xa0 | len));
+        if (len <= 0xff)       return Tagged(Tagged(buf, 0xd9), (uint8_t)len);
+        if (len <= 0xffff)     return BigEndian(Tagged(buf, 0xda), (uint16_t)len);
+        return BigEndian(Tagged(buf, 0xdb), (uint32_t)len);
+    }
 
-    template <typename UnderlyingT>
-    StringifyFuncAndTypeInfo loadEnumStringify(DIEAccessor die)
+    static char* ArrayHeader(char *buf, size_t count)
     {
-        constexpr bool IsSigned = std::is_signed_v<UnderlyingT>;
+        if (count < 16)        return Tagged(buf, (uint8_t)(0x90 | count));
+        if (count <= 0xffff)   return BigEndian(Tagged(buf, 0xdc), (uint16_t)count);
+        return BigEndian(Tagged(buf, 0xdd), (uint32_t)count);
+    }
 
-        auto type_info = std::make_unique<DwarfStringify2::EnumClassTypeInfo<UnderlyingT>>();
+    static char* MapHeader(char *buf, size_t count)
+    {
+        if (count < 16)        return Tagged(buf, (uint8_t)(0x80 | count));
+        if (count <= 0xffff)   return BigEndian(Tagged(buf, 0xde), (uint16_t)count);
+        return BigEndian(Tagged(buf, 0xdf), (uint32_t)count);
+    }
+};
 
-        type_info->enum_name = die.getCStringView(DwarfAttr::Name).value().data();
-        if (die.has_children())
-        {
-            ++die;
-            for (; die.tag() != DwarfTag::None; ++die)
-            {
-                if (die.tag() != DwarfTag::Enumerator) throw std::runtime_error("Invalid dwarf");
+// Memory of another process (e.g. in a core file) which printers read instead of their own, see PrintContext
+struct MemoryView
+{
+    void *user = nullptr;
+    // Local copy of [addr, addr + len), nullptr if it isn't available
+    const char* (*read)(void *user, uint64_t addr, size_t len) = nullptr;
+    // Address in the other process of a local pointer returned by `read`, 0 if it isn't one
+    uint64_t (*address_of)(void *user, const char *local) = nullptr;
+};
 
-                UnderlyingT value;
-                if constexpr (IsSigned)
-                {
-                    value = die.getSigned(DwarfAttr::ConstValue).value();
-                }
-                else
-                {
-                    value = die.getUnsigned(DwarfAttr::ConstValue).value();
-                }
+// State of a single repr call, passed through all stringify functions
+struct PrintContext
+{
+    explicit PrintContext(std::ostream &out_)
+        : out(out_)
+    {
+    }
 
-                type_info->valueToNameMap[value] = die.getCStringView(DwarfAttr::Name).value().data();
-            }
+    PrintContext(std::ostream &out_, const ReprOptions &opts)
+        : out(out_)
+    {
+        _format = opts.format;
+        _max_depth = opts.max_depth ? opts.max_depth : kDefaultMaxDepth;
+        _max_elements = opts.max_elements ? opts.max_elements : SIZE_MAX;
+        _max_bytes = opts.max_bytes ? opts.max_bytes : SIZE_MAX;
+        if (opts.max_bytes)
+        {
+            _begin = out.tellp();
         }
-
-        StringifyFuncAndTypeInfo res;
-        res.func = DwarfStringify2::EnumClass<UnderlyingT>;
-        res.type_info = static_cast<void*>(type_info.release());
-        return res;
+        if (opts.timeout.count() > 0)
+        {
+            _has_deadline = true;
+            _deadline = std::chrono::steady_clock::now() + opts.timeout;
+        }
+        _limited = opts.max_depth || opts.max_elements || opts.max_bytes || _has_deadline;
     }
 
-    void loadStructStringifyAppendMembers(DwarfStringify2::StructTypeInfo &type_info, DebugDataLoader &loader, size_t cu_idx, DIEAccessor die, size_t offset_base)
+    // Returns false if the aggregate is nested too deeply and must be printed as a marker instead.
+    bool enterAggregate()
     {
-        int depth = 0;
-        if (die.has_children())
+        if (_depth >= _max_depth)
         {
-            ++depth;
-            ++die;
-            for (; ; ++die)
-            {
-                if (depth == 1 && die.tag() == DwarfTag::Inheritance)
-                {
-                    DIEAccessor baseClassDie = loader.loadCompilationUnitDie(cu_idx, die.getOffset(DwarfAttr::Type).value());
-                    loadStructStringifyAppendMembers(type_info, loader, cu_idx, baseClassDie, offset_base + die.getUnsigned(DwarfAttr::DataMemberLocation).value());
-                }
-                else if (depth == 1 && die.tag() == DwarfTag::Member)
-                {
-                    auto &member = type_info.members.emplace_back();
-                    member.name = die.getCStringView(DwarfAttr::Name)->data();
-                    member.offset = offset_base + die.getUnsigned(DwarfAttr::DataMemberLocation).value();
-                    member.stringifier = loadStringify(loader, cu_idx, die.getOffset(DwarfAttr::Type).value());
-                }
-
-                if (die.has_children())
-                {
-                    ++depth;
-                }
-                else if (die.tag() == DwarfTag::None)
-                {
-                    --depth;
-                    if (depth == 0)
-                    {
-                        break;
-                    }
-                }
-            }
+            truncated = true;
+            return false;
         }
+        ++_depth;
+        return true;
     }
 
-    StringifyFuncAndTypeInfo loadStructStringify(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die)
+    void leaveAggregate()
     {
-        auto type_info = std::make_unique<DwarfStringify2::StructTypeInfo>();
-        loadStructStringifyAppendMembers(*type_info, loader, cu_idx, die, 0);
-
-        StringifyFuncAndTypeInfo res;
-        res.func = DwarfStringify2::Struct;
-        res.type_info = static_cast<void*>(type_info.release());
-        return res;
+        --_depth;
     }
 
-    StringifyFuncAndTypeInfo loadBaseStringify(DIEAccessor die)
+    // Must be called before printing the element at `idx` of an aggregate. Returns false if the
+    // aggregate must stop printing, in which case the "..." marker is already written.
+    bool beginElement(size_t idx)
     {
-        StringifyFuncAndTypeInfo res = {};
+        if (!_limited)
+        {
+            return true;
+        }
+        if (_stopped)
+        {
+            return false;
+        }
 
-        uint64_t encoding = die.getUnsigned(DwarfAttr::Encoding).value();
-        uint64_t byteSize = die.getUnsigned(DwarfAttr::ByteSize).value();
+        if (idx >= _max_elements)
+        {
+            truncated = true;
+            writeMarker(idx);
+            return false;
+        }
 
-        switch (encoding)
+        if (outOfBytes() || outOfTime())
         {
-        case 4: // float
-            if (byteSize == 4)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const float*)val;       }; return res; }
-            if (byteSize == 8)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const double*)val;      }; return res; }
-            if (byteSize == 16) { res.func = [](std::ostream &out, void *, const void *val) { out << *(const long double*)val; }; return res; }
-            break;
-        case 5: // signed
-        case 6: // signed char
-            if (byteSize == 1)  { res.func = [](std::ostream &out, void *, const void *val) { out << static_cast<int32_t>(*(const int8_t*)val); }; return res; }
-            if (byteSize == 2)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const int16_t*)val;      }; return res; }
-            if (byteSize == 4)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const int32_t*)val;      }; return res; }
-            if (byteSize == 8)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const int64_t*)val;      }; return res; }
-            break;
-        case 7: // unsigned
-        case 8: // unsigned char
-            if (byteSize == 1)  { res.func = [](std::ostream &out, void *, const void *val) { out << static_cast<uint32_t>(*(const uint8_t*)val); }; return res; }
-            if (byteSize == 2)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const uint16_t*)val;      }; return res; }
-            if (byteSize == 4)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const uint32_t*)val;      }; return res; }
-            if (byteSize == 8)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const uint64_t*)val;      }; return res; }
-            break;
-        case 16: // DW_ATE_UTF
-            if (byteSize == 1)  { res.func = [](std::ostream &out, void *, const void *val) { out << static_cast<uint32_t>(*(const uint8_t*)val); }; return res; }
-            if (byteSize == 2)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const uint16_t*)val;      }; return res; }
-            if (byteSize == 4)  { res.func = [](std::ostream &out, void *, const void *val) { out << *(const uint32_t*)val;      }; return res; }
-            break;
+            truncated = true;
+            _stopped = true;
+            writeMarker(idx);
+            return false;
         }
+        return true;
+    }
 
-        std::cerr << "encoding=" << encoding << ", byteSize=" << byteSize << " type=" << die.getCStringView(DwarfAttr::Name).value() << "\n";
+    OutputFormat format() const
+    {
+        return _format;
+    }
 
-        res.func = [](std::ostream &out, void *, const void *)
+    // Writes the opening of an aggregate of `count` elements, `keyed` aggregates (structs) have named members. Must be
+    // followed by closeAggregate with the number of elements printed, MessagePack needs the count upfront so elements
+    // which weren't printed due to a limit are filled with nil.
+    void openAggregate(size_t count, bool keyed)
+    {
+        if (_format == OutputFormat::Repr)
         {
-            out << "???";
-        };
-        res.type_info = nullptr;
-        return res;
+            out << '{';
+            return;
+        }
+
+        size_t expected = count > _max_elements ? _max_elements + 1 : count;
+        _frames.push_back({expected, keyed, false});
+        if (_format == OutputFormat::Json)
+        {
+            out << (keyed ? '{' : '[');
+            return;
+        }
+
+        char buf[MsgPack::kMaxHeaderLength];
+        out.write(buf, (keyed ? MsgPack::MapHeader(buf, expected) : MsgPack::ArrayHeader(buf, expected)) - buf);
     }
 
-    StringifyFuncAndTypeInfo loadStringify(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    void closeAggregate(size_t printed)
     {
-        DwarfLocation loc(cu_idx, typeDieOffset);
-        if (auto it = stringifiers.find(loc); it != stringifiers.end()) {
-            return it->second;
+        if (_format == OutputFormat::Repr)
+        {
+            out << '}';
+            return;
         }
 
-        DIEAccessor acc = loader.loadCompilationUnitDie(cu_idx, typeDieOffset);
-        std::optional<StringifyFuncAndTypeInfo> res;
-        switch (acc.tag())
+        Frame frame = _frames.back();
+        _frames.pop_back();
+        if (_format == OutputFormat::Json)
         {
-        case DwarfTag::EnumerationType:
-        {
-            // GCC has encoding/byteSize in enum type, but clang only has them on linked primitive
-            DIEAccessor primitiveDie = loader.loadCompilationUnitDie(cu_idx, acc.getOffset(DwarfAttr::Type).value());
-
-            // TODO extract this typedef following logic to a function
-            while (primitiveDie.tag() == DwarfTag::Typedef)
-            {
-                primitiveDie = loader.loadCompilationUnitDie(cu_idx, primitiveDie.getOffset(DwarfAttr::Type).value());
-            }
+            out << (frame.keyed ? '}' : ']');
+            return;
+        }
 
-            uint64_t encoding = primitiveDie.getUnsigned(DwarfAttr::Encoding).value();
-            uint64_t byteSize = primitiveDie.getUnsigned(DwarfAttr::ByteSize).value();
+        for (size_t i = printed + frame.marker; i < frame.expected; ++i)
+        {
+            out.write("\xc0\xc0", frame.keyed ? 2 : 1);
+        }
+    }
 
-            // GCC uses encoding=5,7, clang uses 6,8
-            bool signed_ = (encoding == 5 || encoding == 6);
-            bool unsigned_ = (encoding == 7 || encoding == 8);
-            if (signed_   && byteSize == 1) { res = loadEnumStringify<int8_t  >(acc); break; }
-            if (signed_   && byteSize == 2) { res = loadEnumStringify<int16_t >(acc); break; }
-            if (signed_   && byteSize == 4) { res = loadEnumStringify<int32_t >(acc); break; }
-            if (signed_   && byteSize == 8) { res = loadEnumStringify<int64_t >(acc); break; }
-            if (unsigned_ && byteSize == 1) { res = loadEnumStringify<uint8_t >(acc); break; }
-            if (unsigned_ && byteSize == 2) { res = loadEnumStringify<uint16_t>(acc); break; }
-            if (unsigned_ && byteSize == 4) { res = loadEnumStringify<uint32_t>(acc); break; }
-            if (unsigned_ && byteSize == 8) { res = loadEnumStringify<uint64_t>(acc); break; }
-            break;
+    // Written before the element at `idx` of an aggregate
+    void separator(size_t idx)
+    {
+        if (idx == 0 || _format == OutputFormat::MsgPack)
+        {
+            return;
         }
-        case DwarfTag::StructureType:
-        case DwarfTag::ClassType:
+        if (_format == OutputFormat::Repr)
         {
-            res = loadStructStringify(loader, cu_idx, acc);
-            break;
+            out.write(", ", 2);
         }
-        case DwarfTag::BaseType:
+        else
         {
-            res = loadBaseStringify(acc);
-            break;
+            out.put(',');
         }
-        case DwarfTag::Typedef:
+    }
+
+    // Written in place of an aggregate nested deeper than max_depth
+    void writeDepthMarker(const char *repr_text)
+    {
+        switch (_format)
         {
-            res = loadStringify(loader, cu_idx, acc.getOffset(DwarfAttr::Type).value());
-            break;
+        case OutputFormat::Repr:    out << repr_text; break;
+        case OutputFormat::Json:    out << "\"...\""; break;
+        case OutputFormat::MsgPack: out.write("\xa3...", 4); break;
         }
-        case DwarfTag::PointerType:
+    }
+
+    // Values without a representation in Json and MessagePack (e.g. nullptr, std::nullopt, ???) are written as null
+    void writeNull(const char *repr_text)
+    {
+        switch (_format)
         {
-            // TODO function ptrs?
-            // TODO maybe make char* etc to print the string etc
-            res.emplace();
-            res->func = [](std::ostream &out, void *, const void *val)
-            {
-                uint64_t addr = *(const uint64_t*)val;
-                if (addr == 0)
-                {
-                    out << "nullptr";
-                }
-                else
-                {
-                    std::stringstream ss;
-                    ss << "0x" << std::hex << std::setw(16) << std::setfill('0') << addr;
-                    out << ss.str();
-                }
-            };
-            res->type_info = nullptr;
-            break;
+        case OutputFormat::Repr:    out << repr_text; break;
+        case OutputFormat::Json:    out << "null"; break;
+        case OutputFormat::MsgPack: out.put('\xc0'); break;
         }
-        default:
-            break;
+    }
+
+    void writeBool(bool val)
+    {
+        if (_format == OutputFormat::MsgPack)
+        {
+            out.put(val ? '\xc3' : '\xc2');
+        }
+        else
+        {
+            out << (val ? "true" : "false");
         }
+    }
 
-        if (!res) {
-            std::cerr << "Can't stringify type at 0x" << std::hex << typeDieOffset << std::dec << " " << acc.tag() << "\n";
-            res.emplace();
-            res->func = [](std::ostream &out, void *, const void *)
-            {
-                out << "???";
-            };
-            res->type_info = nullptr;
+    size_t maxElements() const
+    {
+        return _max_elements;
+    }
+
+    // Bytes which may still be written before max_bytes is reached, SIZE_MAX without the limit
+    size_t remainingBytes()
+    {
+        if (_max_bytes == SIZE_MAX)
+        {
+            return SIZE_MAX;
         }
+        size_t written = static_cast<size_t>(out.tellp() - _begin);
+        return written < _max_bytes ? _max_bytes - written : 0;
+    }
 
-        stringifiers[loc] = *res;
-        return *res;
+    // Characters a string may print: max_elements, and no more than the bytes left, so that a long string is cut while
+    // it's printed instead of printed whole and cut afterwards
+    size_t stringLimit()
+    {
+        return std::min(_max_elements, remainingBytes());
     }
 
-    uint64_t findGlobalOffset(DebugDataLoader &loader)
+    // Used when printing a copy of an object away from the process it belongs to (e.g. a decoded capture). Only the
+    // object's own bytes are available then, pointers to anywhere else can't be followed.
+    void setDetachedObject(const void *copy, uint64_t original_address, size_t size)
     {
-        // Find a position of a well known global variable and compare it to its debug data
-        // Use that offset for any global variables later, to make this work with PIE.
-        static volatile bool librepr_global_offset_marker__;
-        uint64_t dwarfLocation = -1;
-        uint64_t realLocation = reinterpret_cast<uint64_t>(&librepr_global_offset_marker__);
+        _detached = true;
+        _copy = (const char*)copy;
+        _original = original_address;
+        _size = size;
+    }
 
-        for (size_t i = 0; i < loader.num_compilation_units(); ++i)
+    // Used when printing objects of another process whose memory is available through `view`, e.g. in a core file.
+    // Printed objects must be local pointers returned by the view.
+    void setMemoryView(const MemoryView &view)
+    {
+        _view = view;
+    }
+
+    // Printers read through all pointers found in objects with this. Returns nullptr if [ptr, ptr + len) can't be read.
+    const char* deref(const void *ptr, size_t len) const
+    {
+        if (_view.read)
         {
-            for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
-            {
-                if (acc.tag() == DwarfTag::Variable)
-                {
-                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_global_offset_marker__")
-                    {
-                        dwarfLocation = acc.getOffset(DwarfAttr::Location).value();
-                        return realLocation - dwarfLocation;
-                    }
-                }
-            }
+            return _view.read(_view.user, reinterpret_cast<uint64_t>(ptr), len);
+        }
+        if (!_detached)
+        {
+            return (const char*)ptr;
         }
 
-        // TODO fallback, not fail
-        throw std::runtime_error("Unable to find librepr_global_offset_marker__, did you enable debug data?");
+        uint64_t addr = reinterpret_cast<uint64_t>(ptr);
+        if (addr >= _original && addr - _original <= _size && len <= _size - (addr - _original))
+        {
+            return _copy + (addr - _original);
+        }
+        return nullptr;
     }
 
-    void run(DebugDataLoader &loader)
+    // Address the object at `ptr` had in its own process, which is what the pointers in it are relative to
+    const char* addressOf(const void *ptr) const
     {
-        uint64_t globalOffset = findGlobalOffset(loader);
-
-        for (size_t i = 0; i < loader.num_compilation_units(); ++i)
+        const char *p = (const char*)ptr;
+        if (_view.address_of)
         {
-            std::optional<DIEAccessor> ttypeDie, fnVarDie;
-            auto check = [&]()
-            {
-                if (ttypeDie && fnVarDie)
-                {
-                    uint64_t typeDieOffset = ttypeDie->getOffset(DwarfAttr::Type).value();
+            uint64_t addr = _view.address_of(_view.user, p);
+            return addr ? reinterpret_cast<const char*>(addr) : p;
+        }
+        if (_detached && p >= _copy && p <= _copy + _size)
+        {
+            return reinterpret_cast<const char*>(_original + (p - _copy));
+        }
+        return p;
+    }
 
-                    uint64_t dwarfOffset = fnVarDie->getOffset(DwarfAttr::Location).value();
-                    StringifyFuncAndTypeInfo *fnti = (StringifyFuncAndTypeInfo*)(globalOffset + dwarfOffset);
-                    *fnti = loadStringify(loader, i, typeDieOffset);
+    std::ostream &out;
+    bool truncated = false;
 
-                    ttypeDie.reset();
-                    fnVarDie.reset();
-                }
-            };
+private:
+    struct Frame
+    {
+        size_t expected;
+        bool keyed;
+        bool marker;
+    };
 
-            for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
-            {
-                switch (acc.tag())
-                {
-                case DwarfTag::Subprogram:
-                    ttypeDie.reset();
-                    fnVarDie.reset();
-                    break;
-                case DwarfTag::TemplateTypeParameter:
-                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_T__")
-                    {
-                        ttypeDie = acc;
-                        check();
-                    }
-                    break;
-                case DwarfTag::Variable:
-                {
-                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_stringify_fnti__")
-                    {
-                        fnVarDie = acc;
-                        check();
-                    }
-                    break;
-                }
-                default:
-                    break;
-                }
-            }
+    // Marker for the elements of the current aggregate which are left out
+    void writeMarker(size_t idx)
+    {
+        switch (_format)
+        {
+        case OutputFormat::Repr:
+            out << (idx ? ", ..." : "...");
+            break;
+        case OutputFormat::Json:
+            separator(idx);
+            out << (_frames.back().keyed ? "\"...\":null" : "\"...\"");
+            break;
+        case OutputFormat::MsgPack:
+            out.write("\xa3...\xc0", _frames.back().keyed ? 5 : 4);
+            _frames.back().marker = true;
+            break;
         }
     }
 
-    static
-    void InitializeAll(std::ostream &out, void *type_info, const void *obj)
+    bool outOfBytes()
     {
-        StringifyFuncAndTypeInfo *fnti = reinterpret_cast<StringifyFuncAndTypeInfo*>(type_info);
+        return _max_bytes != SIZE_MAX && static_cast<size_t>(out.tellp() - _begin) >= _max_bytes;
+    }
+
+    bool outOfTime()
+    {
+        // Reading the clock costs more than printing a typical element, so only sample it
+        return _has_deadline && (_deadline_checks++ % 16) == 0 && std::chrono::steady_clock::now() >= _deadline;
+    }
 
-        static std::mutex gMut;
-        static std::shared_ptr<DebugDataLoader> gLoader;
-        static std::shared_ptr<LibReprGlobalCache> gCache;
+    OutputFormat _format = OutputFormat::Repr;
+    std::vector<Frame> _frames; // Open aggregates, except in OutputFormat::Repr
+
+    size_t _depth = 0;
+    size_t _max_depth = kDefaultMaxDepth;
+    size_t _max_elements = SIZE_MAX;
+    size_t _max_bytes = SIZE_MAX;
+    std::streampos _begin = 0;
+    std::chrono::steady_clock::time_point _deadline;
+    uint32_t _deadline_checks = 0;
+    bool _has_deadline = false;
+    bool _limited = false;
+    bool _stopped = false;
+
+    bool _detached = false;
+    const char *_copy = nullptr;
+    uint64_t _original = 0;
+    size_t _size = 0;
+
+    MemoryView _view;
+};
 
-        std::lock_guard<std::mutex> guard(gMut);
-        if (!gLoader)
+using StringifyFunc = void(*)(PrintContext &ctx, void *type_info, const void *obj);
+struct StringifyFuncAndTypeInfo
+{
+    StringifyFunc func;
+    void *type_info;
+    uint64_t type_die = 0; // Offset of the type in .debug_info, identifies the type outside of this process
+};
+
+// Stringifiers of repr callsites are bound while other threads may already print with them (see librepr::preload).
+// `func` is written last with release ordering and read with acquire, so a bound func comes with its type_info.
+inline StringifyFunc LoadBoundFunc(const StringifyFuncAndTypeInfo &fnti)
+{
+    return __atomic_load_n(&fnti.func, __ATOMIC_ACQUIRE);
+}
+
+inline void PublishStringifier(StringifyFuncAndTypeInfo *fnti, const StringifyFuncAndTypeInfo &value)
+{
+    fnti->type_info = value.type_info;
+    fnti->type_die = value.type_die;
+    __atomic_store_n(&fnti->func, value.func, __ATOMIC_RELEASE);
+}
+
+struct DwarfStringify2
+{
+    // Precomputed text per OutputFormat. Type infos allocate from a memory resource, so that LayoutTable::Bind can
+    // place them in shared memory.
+    using Texts = std::array<std::pmr::string, kNumOutputFormats>;
+
+    template <typename UnderlyingT>
+    struct EnumClassTypeInfo
+    {
+        EnumClassTypeInfo() = default;
+        explicit EnumClassTypeInfo(std::pmr::memory_resource *mem)
+            : valueToText(mem)
         {
-            gLoader = std::make_shared<DebugDataLoader>();
-            gLoader->loadFile("/proc/self/exe");
-            gCache = std::make_shared<LibReprGlobalCache>();
-            gCache->run(*gLoader);
         }
 
-        if (fnti->func == InitializeAll)
+        const char *enum_name;
+        std::pmr::unordered_map<UnderlyingT, Texts> valueToText;
+    };
+
+    struct StructTypeInfo
+    {
+        StructTypeInfo() = default;
+        explicit StructTypeInfo(std::pmr::memory_resource *mem)
+            : members(mem)
+            , bases(mem)
+            , runs(mem)
         {
-            // TODO implement fallback printers?
-            fnti->func = [](std::ostream &out, void *, const void *)
-            {
-                out << "???";
-            };
-            fnti->type_info = nullptr;
         }
 
-        fnti->func(out, fnti->type_info, obj);
-    }
-};
+        struct MemberInfo
+        {
+            const char *name;
+            size_t offset;
+            StringifyFuncAndTypeInfo stringifier;
+            Texts keys; // e.g. `.name=` or `"name":`
+            size_t size; // 0 if unknown
+        };
+        std::pmr::vector<MemberInfo> members;
 
+        // Base classes, direct and indirect, in declaration order. Their members are part of `members`, in
+        // [first_member, first_member + member_count).
+        struct BaseInfo
+        {
+            const char *name;
+            size_t offset;
+            size_t first_member;
+            size_t member_count;
+        };
+        std::pmr::vector<BaseInfo> bases;
 
+        // Bytes of all members with padding left out, including members of nested structs. Adjacent members are
+        // merged into a single run. Empty if a member has unknown size.
+        struct DataRun
+        {
+            size_t offset;
+            size_t size;
+        };
+        std::pmr::vector<DataRun> runs;
 
-} // namespace librepr::_internal_v3
+        bool plain = false; // Output depends only on the bytes of the members, see IsPlainValue
+    };
 
+    // Standard library types. Offsets are relative to the printed object, resolved from dwarf member names.
 
+    // Fixed size array, multi-dimensional arrays are arrays of arrays
+    struct ArrayTypeInfo
+    {
+        StringifyFuncAndTypeInfo elem;
+        size_t elem_size;
+        size_t count;
+    };
 
+    // std::vector, elements are stored contiguously in [begin, end)
+    struct VectorTypeInfo
+    {
+        StringifyFuncAndTypeInfo elem;
+        size_t elem_size;
+        size_t begin_offset;
+        size_t end_offset;
+    };
 
-namespace librepr {
+    // std::vector<bool>, bits are packed in 64-bit words
+    struct BitVectorTypeInfo
+    {
+        size_t begin_offset;
+        size_t end_offset;
+        size_t end_bit_offset;
+    };
 
+    // std::basic_string<char> and std::basic_string_view<char>
+    struct StringTypeInfo
+    {
+        size_t data_offset;
+        size_t size_offset;
+    };
 
+    // Node based containers (std::list, std::map, std::set, std::unordered_map, std::unordered_set and their multi variants)
+    struct NodeContainerTypeInfo
+    {
+        StringifyFuncAndTypeInfo elem;
+        size_t elem_size;
+        size_t head_offset;       // List header node, tree header node or hashtable "before begin" node
+        size_t count_offset;      // Element count, SIZE_MAX if the container doesn't store it
+        size_t node_value_offset; // Offset of the element within a node
+    };
 
-template <typename librepr_T__>
-inline
-std::string repr(const librepr_T__ &val)
-{
-    using namespace _internal_v3;
+    // std::optional
+    struct OptionalTypeInfo
+    {
+        StringifyFuncAndTypeInfo value;
+        size_t value_offset;
+        size_t engaged_offset;
+    };
 
-    static StringifyFuncAndTypeInfo librepr_stringify_fnti__ = {
-        LibReprGlobalCache::InitializeAll,
-        reinterpret_cast<void*>(&librepr_stringify_fnti__)
+    // std::unique_ptr and std::shared_ptr
+    struct SmartPtrTypeInfo
+    {
+        StringifyFuncAndTypeInfo pointee;
+        size_t pointee_size;
+        size_t ptr_offset;
     };
 
-    std::stringstream ss;
-    librepr_stringify_fnti__.func(ss, librepr_stringify_fnti__.type_info, reinterpret_cast<const void*>(&val));
-    return ss.str();
+    // std::pair
+    struct PairTypeInfo
+    {
+        StringifyFuncAndTypeInfo first;
+        size_t first_offset;
+        StringifyFuncAndTypeInfo second;
+        size_t second_offset;
+    };
+
+    template <typename UnderlyingT>
+    static void EnumClass(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        std::ostream &out = ctx.out;
+        const EnumClassTypeInfo<UnderlyingT> *type_info = reinterpret_cast<const EnumClassTypeInfo<UnderlyingT>*>(type_info_);
+
+        UnderlyingT val = *(const UnderlyingT*)val_;
+
+        auto it = type_info->valueToText.find(static_cast<UnderlyingT>(val));
+        if (it != type_info->valueToText.end())
+        {
+            const auto &text = it->second[static_cast<size_t>(ctx.format())];
+            out.write(text.data(), text.size());
+            return;
+        }
+
+        UnknownEnumerator(ctx, type_info->enum_name, val);
+    }
+
+    // Value of an enum which doesn't match any of its enumerators
+    template <typename UnderlyingT>
+    static void UnknownEnumerator(PrintContext &ctx, const char *enum_name, UnderlyingT val)
+    {
+        std::ostream &out = ctx.out;
+
+        constexpr bool IsSigned = std::is_signed_v<UnderlyingT>;
+
+        if (ctx.format() != OutputFormat::Repr)
+        {
+            Number<UnderlyingT>(ctx, nullptr, &val);
+            return;
+        }
+
+        if constexpr (IsSigned)
+        {
+            if (val == (-9223372036854775807-1))
+            {
+                out << "static_cast<" << enum_name << ">(-9223372036854775807-1)";
+            }
+            else
+            {
+                out << "static_cast<" << enum_name << ">(" << (int64_t)val << ")";
+            }
+        }
+        else
+        {
+            if (val > 9223372036854775807)
+            {
+                out << "static_cast<" << enum_name << ">(" << (uint64_t)val << "ull)";
+            }
+            else
+            {
+                out << "static_cast<" << enum_name << ">(" << (uint64_t)val << ")";
+            }
+        }
+    }
+
+    // Writes the text for the current output format, e.g. a member key or an enumerator
+    static void Text(PrintContext &ctx, std::string_view repr, std::string_view json, std::string_view msgpack)
+    {
+        std::string_view text = ctx.format() == OutputFormat::Repr ? repr : ctx.format() == OutputFormat::Json ? json : msgpack;
+        ctx.out.write(text.data(), text.size());
+    }
+
+    // Types which can't be printed
+    static void Unknown(PrintContext &ctx, void *, const void *)
+    {
+        gUnknownPrintCount.fetch_add(1, std::memory_order_relaxed);
+        ctx.writeNull("???");
+    }
+
+    // Bytes of a value whose stringifier isn't bound yet, e.g. "<raw 0100000002000000>"
+    static void RawBytes(PrintContext &ctx, const void *val, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string text = "<raw ";
+        for (size_t i = 0; i < size; ++i)
+        {
+            uint8_t b = static_cast<const uint8_t*>(val)[i];
+            text += digits[b >> 4];
+            text += digits[b & 0xf];
+        }
+        text += '>';
+
+        if (ctx.format() == OutputFormat::Repr)
+        {
+            ctx.out << text;
+        }
+        else
+        {
+            EscapedString(ctx, text.data(), text.size(), false);
+        }
+    }
+
+    // Pointers other than `char*` print their address
+    static void Pointer(PrintContext &ctx, void *, const void *val)
+    {
+        uint64_t addr = Load<uint64_t>(val, 0);
+        if (addr == 0)
+        {
+            ctx.writeNull("nullptr");
+            return;
+        }
+
+        std::stringstream ss;
+        ss << "0x" << std::hex << std::setw(16) << std::setfill('0') << addr;
+        std::string text = ss.str();
+        if (ctx.format() == OutputFormat::Repr)
+        {
+            ctx.out << text;
+        }
+        else
+        {
+            EscapedString(ctx, text.data(), text.size(), false);
+        }
+    }
+
+    static void Struct(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        std::ostream &out = ctx.out;
+        const StructTypeInfo *type_info = reinterpret_cast<const StructTypeInfo*>(type_info_);
+
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(type_info->members.size(), true);
+        size_t i = 0;
+        for (; i < type_info->members.size(); ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+
+            const auto &m = type_info->members[i];
+            ctx.separator(i);
+            const auto &key = m.keys[static_cast<size_t>(ctx.format())];
+            out.write(key.data(), key.size());
+
+            m.stringifier.func(ctx, m.stringifier.type_info, (const void*)((const char *)val_ + m.offset));
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    // Precomputed text written before a member's value
+    static std::string MemberKey(OutputFormat format, std::string_view name)
+    {
+        switch (format)
+        {
+        case OutputFormat::Repr:
+            return "." + std::string(name) + "=";
+        case OutputFormat::Json:
+            return "\"" + std::string(name) + "\":"; // Identifiers don't need escaping
+        case OutputFormat::MsgPack:
+        {
+            char buf[MsgPack::kMaxHeaderLength];
+            return std::string(buf, MsgPack::StrHeader(buf, name.size())) + std::string(name);
+        }
+        }
+        return {};
+    }
+
+    // MemberKey of each OutputFormat
+    static Texts MemberKeys(std::string_view name, std::pmr::memory_resource *mem = std::pmr::get_default_resource())
+    {
+        Texts keys = EmptyTexts(mem, std::make_index_sequence<kNumOutputFormats>());
+        for (size_t f = 0; f < kNumOutputFormats; ++f)
+        {
+            keys[f].assign(MemberKey(static_cast<OutputFormat>(f), name));
+        }
+        return keys;
+    }
+
+    // Precomputed text of an enumerator, per OutputFormat
+    static Texts EnumeratorText(std::string_view enum_name, std::string_view name, std::pmr::memory_resource *mem = std::pmr::get_default_resource())
+    {
+        Texts text = EmptyTexts(mem, std::make_index_sequence<kNumOutputFormats>());
+        text[static_cast<size_t>(OutputFormat::Repr)].assign(std::string(enum_name) + "::" + std::string(name));
+        text[static_cast<size_t>(OutputFormat::Json)].assign("\"" + std::string(name) + "\"");
+        text[static_cast<size_t>(OutputFormat::MsgPack)].assign(MemberKey(OutputFormat::MsgPack, name));
+        return text;
+    }
+
+    template <size_t... I>
+    static Texts EmptyTexts(std::pmr::memory_resource *mem, std::index_sequence<I...>)
+    {
+        return {((void)I, std::pmr::string(mem))...};
+    }
+
+    template <typename T>
+    static T Load(const void *obj, size_t offset)
+    {
+        T res;
+        memcpy(&res, (const char*)obj + offset, sizeof(T));
+        return res;
+    }
+
+    static constexpr size_t kMaxNumberLength = 32;
+
+    // Same output as the default ostream formatting, without going through the locale machinery.
+    // `buf` must have room for kMaxNumberLength chars.
+    template <typename T>
+    static char* FormatNumber(char *buf, T val)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return std::to_chars(buf, buf + kMaxNumberLength, val, std::chars_format::general, 6).ptr;
+        }
+        else
+        {
+            return std::to_chars(buf, buf + kMaxNumberLength, val).ptr;
+        }
+    }
+
+    // FormatNumber for the given output format, Json has no representation for nan and infinities so they are null
+    template <typename T>
+    static char* EncodeNumber(OutputFormat format, char *buf, T val)
+    {
+        if (format == OutputFormat::MsgPack)
+        {
+            if constexpr (std::is_same_v<T, float>)   return MsgPack::Float(buf, val);
+            if constexpr (std::is_floating_point_v<T>) return MsgPack::Double(buf, (double)val);
+            if constexpr (std::is_signed_v<T>)         return MsgPack::Int(buf, val);
+            else                                       return MsgPack::UInt(buf, val);
+        }
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (format == OutputFormat::Json && !std::isfinite(val))
+            {
+                memcpy(buf, "null", 4);
+                return buf + 4;
+            }
+        }
+        return FormatNumber(buf, val);
+    }
+
+    static void Bool(PrintContext &ctx, void *, const void *val)
+    {
+        ctx.writeBool(*(const bool*)val);
+    }
+
+    template <typename T>
+    static void Number(PrintContext &ctx, void *, const void *val)
+    {
+        char buf[kMaxNumberLength];
+        ctx.out.write(buf, EncodeNumber(ctx.format(), buf, Load<T>(val, 0)) - buf);
+    }
+
+    // Formats numbers into a local buffer and writes it out in batches, limits are checked once per batch
+    template <typename T>
+    static void Numbers(PrintContext &ctx, const char *data, size_t count)
+    {
+        std::ostream &out = ctx.out;
+
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        const OutputFormat format = ctx.format();
+        const char *separator = format == OutputFormat::Repr ? ", " : ",";
+        const size_t separatorLength = format == OutputFormat::Repr ? 2 : (format == OutputFormat::Json ? 1 : 0);
+
+        ctx.openAggregate(count, false);
+        size_t n = std::min(count, ctx.maxElements());
+        char buf[4096];
+        char *it = buf;
+        size_t budget = ctx.remainingBytes(); // The buffer is written early once it holds more than this
+        size_t i = 0;
+        for (; i < n; ++i)
+        {
+            if (it + kMaxNumberLength + 2 > buf + sizeof(buf) || static_cast<size_t>(it - buf) > budget)
+            {
+                out.write(buf, it - buf);
+                it = buf;
+                if (!ctx.beginElement(i)) break;
+                budget = ctx.remainingBytes();
+            }
+            if (i)
+            {
+                memcpy(it, separator, separatorLength);
+                it += separatorLength;
+            }
+            it = EncodeNumber(format, it, Load<T>(data, i * sizeof(T)));
+        }
+        out.write(buf, it - buf);
+        if (i == n && n < count)
+        {
+            ctx.beginElement(n); // Writes the marker for the element limit
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    template <typename... Ts>
+    static bool NumbersIfNumeric(PrintContext &ctx, StringifyFunc elem, const char *data, size_t count)
+    {
+        return ((elem == Number<Ts> ? (Numbers<Ts>(ctx, data, count), true) : false) || ...);
+    }
+
+    static bool NeedsEscape(unsigned char c)
+    {
+        return c < 0x20 || c == 0x7f || c == '"' || c == '\\';
+    }
+
+    // Returns the first char in [it, end) which can't be printed as is in a string literal
+    static const char* FindEscape(const char *it, const char *end)
+    {
+#if defined(__SSE2__)
+        const __m128i control = _mm_set1_epi8(0x1f);
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        for (; end - it >= 16; it += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk), _mm_cmpeq_epi8(chunk, del)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+            if (int mask = _mm_movemask_epi8(special))
+            {
+                return it + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; it != end; ++it)
+        {
+            if (NeedsEscape(*it))
+            {
+                return it;
+            }
+        }
+        return end;
+    }
+
+    // Prints [data, data + len) as a string literal, `truncated` appends the "..." marker (inside the string for Json
+    // and MessagePack)
+    static void EscapedString(PrintContext &ctx, const char *data, size_t len, bool truncated)
+    {
+        std::ostream &out = ctx.out;
+
+        if (truncated)
+        {
+            ctx.truncated = true;
+        }
+
+        if (ctx.format() == OutputFormat::MsgPack)
+        {
+            char buf[MsgPack::kMaxHeaderLength];
+            out.write(buf, MsgPack::StrHeader(buf, len + (truncated ? 3 : 0)) - buf);
+            out.write(data, len);
+            if (truncated)
+            {
+                out.write("...", 3);
+            }
+            return;
+        }
+
+        const bool json = ctx.format() == OutputFormat::Json;
+        out << '"';
+        const char *end = data + len;
+        for (const char *it = data; ; ++it)
+        {
+            const char *run = it;
+            it = FindEscape(it, end);
+            out.write(run, it - run);
+            if (it == end)
+            {
+                break;
+            }
+
+            unsigned char c = *it;
+            switch (c)
+            {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (json)
+                {
+                    const char *hex = "0123456789abcdef";
+                    const char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    out.write(esc, 6);
+                }
+                else
+                {
+                    const char esc[4] = {'\\', char('0' + (c >> 6)), char('0' + ((c >> 3) & 7)), char('0' + (c & 7))};
+                    out.write(esc, 4);
+                }
+                break;
+            }
+        }
+        out << (!truncated ? "\"" : json ? "...\"" : "\"...");
+    }
+
+    // Longest string printed through a `char*`, the pointer may not be NUL terminated
+    static constexpr size_t kMaxCStringLength = 4096;
+
+    static void CString(PrintContext &ctx, void *, const void *val_)
+    {
+        const char *str = Load<const char*>(val_, 0);
+        if (!str)
+        {
+            ctx.writeNull("nullptr");
+            return;
+        }
+
+        // Searched for the NUL a page at a time through deref, so that no more than the pages of the string are read,
+        // and strings close to the end of a detached copy or core file segment are found too. Pointers into memory
+        // of the own process are still read as is, they must point to a NUL terminated string.
+        size_t limit = std::min(ctx.stringLimit(), kMaxCStringLength);
+        size_t len = 0;
+        while (len <= limit)
+        {
+            uintptr_t addr = reinterpret_cast<uintptr_t>(str) + len;
+            size_t chunk = std::min<size_t>(4096 - addr % 4096, limit + 1 - len);
+            const char *data = ctx.deref(reinterpret_cast<const void*>(addr), chunk);
+            if (!data)
+            {
+                ctx.writeNull("???");
+                return;
+            }
+            if (const char *nul = (const char*)memchr(data, 0, chunk))
+            {
+                len += nul - data;
+                break;
+            }
+            len += chunk;
+        }
+
+        const char *data = ctx.deref(str, std::min(len, limit));
+        if (!data)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+        EscapedString(ctx, data, std::min(len, limit), len > limit);
+    }
+
+    // char arrays are printed up to the first NUL
+    static void CharArray(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const ArrayTypeInfo *type_info = reinterpret_cast<const ArrayTypeInfo*>(type_info_);
+
+        const char *str = (const char*)val_;
+        const char *nul = (const char*)memchr(str, 0, type_info->count);
+        size_t len = nul ? nul - str : type_info->count;
+        size_t limit = ctx.stringLimit();
+        EscapedString(ctx, str, std::min(len, limit), len > limit);
+    }
+
+    static void Array(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const ArrayTypeInfo *type_info = reinterpret_cast<const ArrayTypeInfo*>(type_info_);
+
+        Elements(ctx, type_info->elem, type_info->elem_size, (const char*)val_, type_info->count);
+    }
+
+    // Prints `count` elements stored contiguously
+    static void Elements(PrintContext &ctx, const StringifyFuncAndTypeInfo &elem, size_t elem_size, const char *data, size_t count)
+    {
+        if (NumbersIfNumeric<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t, float, double, long double>(ctx, elem.func, data, count))
+        {
+            return;
+        }
+
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(count, false);
+        size_t i = 0;
+        for (; i < count; ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+            ctx.separator(i);
+            elem.func(ctx, elem.type_info, data + i * elem_size);
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    // Reads a pointer stored at `addr`, nullptr if it isn't readable
+    static const char* LoadPointer(const PrintContext &ctx, const char *addr)
+    {
+        const char *p = ctx.deref(addr, sizeof(void*));
+        return p ? Load<const char*>(p, 0) : nullptr;
+    }
+
+    static void StdVector(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const VectorTypeInfo *type_info = reinterpret_cast<const VectorTypeInfo*>(type_info_);
+
+        const char *begin = Load<const char*>(val_, type_info->begin_offset);
+        const char *end = Load<const char*>(val_, type_info->end_offset);
+        if (end < begin || (end - begin) % type_info->elem_size != 0)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+
+        const char *data = ctx.deref(begin, end - begin);
+        if (!data && begin)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+
+        Elements(ctx, type_info->elem, type_info->elem_size, data, (end - begin) / type_info->elem_size);
+    }
+
+    static void StdBitVector(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const BitVectorTypeInfo *type_info = reinterpret_cast<const BitVectorTypeInfo*>(type_info_);
+
+        const uint64_t *begin = Load<const uint64_t*>(val_, type_info->begin_offset);
+        const uint64_t *end = Load<const uint64_t*>(val_, type_info->end_offset);
+        unsigned int endBit = Load<unsigned int>(val_, type_info->end_bit_offset);
+        if (end < begin)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+
+        const uint64_t *words = reinterpret_cast<const uint64_t*>(ctx.deref(begin, (end - begin + (endBit ? 1 : 0)) * 8));
+        if (!words && begin)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+        size_t count = (end - begin) * 64 + endBit;
+
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(count, false);
+        size_t i = 0;
+        for (; i < count; ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+            ctx.separator(i);
+            ctx.writeBool((words[i / 64] >> (i % 64)) & 1);
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    static void StdString(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const StringTypeInfo *type_info = reinterpret_cast<const StringTypeInfo*>(type_info_);
+
+        size_t len = Load<size_t>(val_, type_info->size_offset);
+        size_t limit = ctx.stringLimit();
+        const char *data = ctx.deref(Load<const char*>(val_, type_info->data_offset), std::min(len, limit));
+        if (!data)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+        EscapedString(ctx, data, std::min(len, limit), len > limit);
+    }
+
+    // Nodes are followed iteratively, so that long lists don't consume any stack. Node pointers are addresses in the
+    // object's own process, `head` is the address of the header node embedded in the container.
+    template <typename NextFn>
+    static void NodeElements(PrintContext &ctx, const NodeContainerTypeInfo &type_info, const char *head, const char *first, NextFn &&next, size_t count)
+    {
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(count, false);
+        const char *node = first;
+        size_t i = 0;
+        for (; i < count && node != nullptr && node != head; ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+            ctx.separator(i);
+
+            const char *value = ctx.deref(node + type_info.node_value_offset, type_info.elem_size);
+            if (!value)
+            {
+                ctx.writeNull("???");
+                ++i;
+                break;
+            }
+            type_info.elem.func(ctx, type_info.elem.type_info, value);
+            node = next(node);
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    static void StdList(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const NodeContainerTypeInfo *type_info = reinterpret_cast<const NodeContainerTypeInfo*>(type_info_);
+
+        // _List_node_base is {_M_next, _M_prev}, the header node is embedded in the list object
+        const char *head = ctx.addressOf((const char*)val_ + type_info->head_offset);
+        auto next = [&](const char *node) { return LoadPointer(ctx, node); };
+        NodeElements(ctx, *type_info, head, next(head), next, Load<size_t>(val_, type_info->count_offset));
+    }
+
+    static void StdRbTree(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const NodeContainerTypeInfo *type_info = reinterpret_cast<const NodeContainerTypeInfo*>(type_info_);
+
+        // _Rb_tree_node_base is {_M_color, _M_parent, _M_left, _M_right}, header's _M_left is the leftmost node
+        auto parent = [&](const char *node) { return LoadPointer(ctx, node + 8); };
+        auto left = [&](const char *node) { return LoadPointer(ctx, node + 16); };
+        auto right = [&](const char *node) { return LoadPointer(ctx, node + 24); };
+        auto next = [&](const char *node)
+        {
+            if (right(node))
+            {
+                node = right(node);
+                while (left(node)) node = left(node);
+                return node;
+            }
+            const char *p = parent(node);
+            while (p && node == right(p))
+            {
+                node = p;
+                p = parent(p);
+            }
+            return p;
+        };
+
+        const char *head = ctx.addressOf((const char*)val_ + type_info->head_offset);
+        NodeElements(ctx, *type_info, head, left(head), next, Load<size_t>(val_, type_info->count_offset));
+    }
+
+    static void StdHashtable(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const NodeContainerTypeInfo *type_info = reinterpret_cast<const NodeContainerTypeInfo*>(type_info_);
+
+        // All elements are in a singly linked list starting from _M_before_begin
+        const char *head = ctx.addressOf((const char*)val_ + type_info->head_offset);
+        auto next = [&](const char *node) { return LoadPointer(ctx, node); };
+        NodeElements(ctx, *type_info, head, next(head), next, Load<size_t>(val_, type_info->count_offset));
+    }
+
+    static void StdOptional(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const OptionalTypeInfo *type_info = reinterpret_cast<const OptionalTypeInfo*>(type_info_);
+
+        if (!Load<bool>(val_, type_info->engaged_offset))
+        {
+            ctx.writeNull("std::nullopt");
+            return;
+        }
+        type_info->value.func(ctx, type_info->value.type_info, (const char*)val_ + type_info->value_offset);
+    }
+
+    static void StdSmartPtr(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const SmartPtrTypeInfo *type_info = reinterpret_cast<const SmartPtrTypeInfo*>(type_info_);
+
+        const void *ptr = Load<const void*>(val_, type_info->ptr_offset);
+        if (!ptr)
+        {
+            ctx.writeNull("nullptr");
+            return;
+        }
+
+        ptr = ctx.deref(ptr, type_info->pointee_size);
+        if (!ptr)
+        {
+            ctx.writeNull("???");
+            return;
+        }
+
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("...");
+            return;
+        }
+        type_info->pointee.func(ctx, type_info->pointee.type_info, ptr);
+        ctx.leaveAggregate();
+    }
+
+    static void StdPair(PrintContext &ctx, void *type_info_, const void *val_)
+    {
+        const PairTypeInfo *type_info = reinterpret_cast<const PairTypeInfo*>(type_info_);
+
+        ctx.openAggregate(2, false);
+        type_info->first.func(ctx, type_info->first.type_info, (const char*)val_ + type_info->first_offset);
+        ctx.separator(1);
+        type_info->second.func(ctx, type_info->second.type_info, (const char*)val_ + type_info->second_offset);
+        ctx.closeAggregate(2);
+    }
+
+    // Whether two objects of the struct are the same, comparing only the bytes of their members
+    static bool SameMembers(const StructTypeInfo &type_info, const char *a, const char *b)
+    {
+        if (type_info.runs.empty())
+        {
+            return type_info.members.empty();
+        }
+        for (const auto &run : type_info.runs)
+        {
+            if (memcmp(a + run.offset, b + run.offset, run.size) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the output of the stringifier depends only on the bytes of the value
+    template <typename... Ts>
+    static bool IsPlain(StringifyFunc func)
+    {
+        return ((func == Number<Ts> || func == EnumClass<Ts>) || ...);
+    }
+
+    // Whether two values of a type with `size` bytes are known to print the same. False negatives are fine, the values
+    // are printed and compared then.
+    static bool SameValue(const StringifyFuncAndTypeInfo &stringifier, const char *a, const char *b, size_t size)
+    {
+        if (stringifier.func == Struct)
+        {
+            return SameMembers(*reinterpret_cast<const StructTypeInfo*>(stringifier.type_info), a, b);
+        }
+        if (size && memcmp(a, b, size) == 0)
+        {
+            return true;
+        }
+
+        // Pointers differ between objects even if what they point to is the same
+        if (stringifier.func == StdString)
+        {
+            const StringTypeInfo *type_info = reinterpret_cast<const StringTypeInfo*>(stringifier.type_info);
+            size_t len = Load<size_t>(a, type_info->size_offset);
+            return len == Load<size_t>(b, type_info->size_offset)
+                && memcmp(Load<const char*>(a, type_info->data_offset), Load<const char*>(b, type_info->data_offset), len) == 0;
+        }
+        if (stringifier.func == StdVector)
+        {
+            const VectorTypeInfo *type_info = reinterpret_cast<const VectorTypeInfo*>(stringifier.type_info);
+            const char *beginA = Load<const char*>(a, type_info->begin_offset);
+            const char *beginB = Load<const char*>(b, type_info->begin_offset);
+            size_t len = Load<const char*>(a, type_info->end_offset) - beginA;
+            if (len != (size_t)(Load<const char*>(b, type_info->end_offset) - beginB))
+            {
+                return false;
+            }
+            if (IsPlain<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(type_info->elem.func))
+            {
+                return memcmp(beginA, beginB, len) == 0;
+            }
+            for (size_t off = 0; off < len; off += type_info->elem_size)
+            {
+                if (!SameValue(type_info->elem, beginA + off, beginB + off, type_info->elem_size))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Member path of a value being compared, only turned into a string once a change is found
+    struct DiffPath
+    {
+        const DiffPath *parent;
+        const char *name;
+
+        void append(std::string &out) const
+        {
+            if (parent)
+            {
+                parent->append(out);
+            }
+            if (name)
+            {
+                out += '.';
+                out += name;
+            }
+        }
+    };
+
+    // Writes `path: old -> new` if the values print differently
+    static void DiffValue(std::string &out, const StringifyFuncAndTypeInfo &stringifier, const char *a, const char *b, const DiffPath &path, size_t &changes)
+    {
+        auto print = [&](const char *val)
+        {
+            std::stringstream ss;
+            PrintContext ctx(ss);
+            stringifier.func(ctx, stringifier.type_info, val);
+            return ss.str();
+        };
+
+        std::string before = print(a);
+        std::string after = print(b);
+        if (before == after)
+        {
+            return;
+        }
+
+        if (changes++)
+        {
+            out += ", ";
+        }
+        if (path.name)
+        {
+            path.append(out);
+            out += ": ";
+        }
+        out += before;
+        out += " -> ";
+        out += after;
+    }
+
+    // Walks the members of two objects of the same struct, nested structs are descended into and only the changed
+    // leaves are printed, with their full path
+    static void DiffStruct(std::string &out, const StructTypeInfo &type_info, const char *a, const char *b, const DiffPath &parent, size_t &changes)
+    {
+        for (const auto &m : type_info.members)
+        {
+            const char *ma = a + m.offset;
+            const char *mb = b + m.offset;
+
+            DiffPath path{&parent, m.name};
+            if (SameValue(m.stringifier, ma, mb, m.size))
+            {
+                // Nothing changed
+            }
+            else if (m.stringifier.func == Struct)
+            {
+                DiffStruct(out, *reinterpret_cast<const StructTypeInfo*>(m.stringifier.type_info), ma, mb, path, changes);
+            }
+            else
+            {
+                DiffValue(out, m.stringifier, ma, mb, path, changes);
+            }
+        }
+    }
+
+    static void Diff(std::string &out, const StringifyFuncAndTypeInfo &stringifier, const char *a, const char *b, size_t size)
+    {
+        DiffPath path{nullptr, nullptr};
+        size_t changes = 0;
+        if (SameValue(stringifier, a, b, size))
+        {
+            return;
+        }
+        if (stringifier.func == Struct)
+        {
+            DiffStruct(out, *reinterpret_cast<const StructTypeInfo*>(stringifier.type_info), a, b, path, changes);
+        }
+        else
+        {
+            DiffValue(out, stringifier, a, b, path, changes);
+        }
+    }
+
+    // Whether the output of a stringifier depends on nothing but the bytes of the value, i.e. it doesn't follow any
+    // pointers. Such values print the same as long as their bytes are the same.
+    static bool IsPlainValue(const StringifyFuncAndTypeInfo &stringifier)
+    {
+        StringifyFunc func = stringifier.func;
+        if (func == Bool || func == CharArray || IsPlain<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(func)
+            || func == Number<float> || func == Number<double> || func == Number<long double>)
+        {
+            return true;
+        }
+        if (func == Struct)
+        {
+            return reinterpret_cast<const StructTypeInfo*>(stringifier.type_info)->plain;
+        }
+        if (func == Array)
+        {
+            return IsPlainValue(reinterpret_cast<const ArrayTypeInfo*>(stringifier.type_info)->elem);
+        }
+        if (func == StdOptional)
+        {
+            return IsPlainValue(reinterpret_cast<const OptionalTypeInfo*>(stringifier.type_info)->value);
+        }
+        if (func == StdPair)
+        {
+            const PairTypeInfo *type_info = reinterpret_cast<const PairTypeInfo*>(stringifier.type_info);
+            return IsPlainValue(type_info->first) && IsPlainValue(type_info->second);
+        }
+        return false;
+    }
+
+    // Appends the bytes which a plain value of `size` bytes at `offset` prints, leaving out the padding of structs
+    // (also of their arrays, optionals and pairs) and of long double. Adjacent runs are merged. Fails if a member has
+    // unknown size.
+    static bool AppendDataRuns(std::vector<StructTypeInfo::DataRun> &runs, const StringifyFuncAndTypeInfo &stringifier, size_t offset, size_t size)
+    {
+        auto append = [&](size_t runOffset, size_t runSize)
+        {
+            if (!runs.empty() && runs.back().offset + runs.back().size == runOffset)
+            {
+                runs.back().size += runSize;
+            }
+            else if (runSize)
+            {
+                runs.push_back({runOffset, runSize});
+            }
+        };
+
+        StringifyFunc func = stringifier.func;
+        if (func == Struct)
+        {
+            const StructTypeInfo &type_info = *reinterpret_cast<const StructTypeInfo*>(stringifier.type_info);
+            if (type_info.runs.empty() && !type_info.members.empty())
+            {
+                return false;
+            }
+            for (const auto &run : type_info.runs)
+            {
+                append(offset + run.offset, run.size);
+            }
+            return true;
+        }
+        if (func == Array)
+        {
+            const ArrayTypeInfo &type_info = *reinterpret_cast<const ArrayTypeInfo*>(stringifier.type_info);
+            std::vector<StructTypeInfo::DataRun> elem;
+            if (!AppendDataRuns(elem, type_info.elem, 0, type_info.elem_size))
+            {
+                return false;
+            }
+            if (elem.size() == 1 && elem[0].offset == 0 && elem[0].size == type_info.elem_size)
+            {
+                append(offset, type_info.elem_size * type_info.count); // Elements without padding
+                return true;
+            }
+            for (size_t i = 0; i < type_info.count; ++i)
+            {
+                for (const auto &run : elem)
+                {
+                    append(offset + i * type_info.elem_size + run.offset, run.size);
+                }
+            }
+            return true;
+        }
+        if (func == StdOptional)
+        {
+            // The value's bytes of an empty optional are part of it too, they only cause misses
+            const OptionalTypeInfo &type_info = *reinterpret_cast<const OptionalTypeInfo*>(stringifier.type_info);
+            size_t valueSize = type_info.engaged_offset > type_info.value_offset ? type_info.engaged_offset - type_info.value_offset : 0;
+            if (!AppendDataRuns(runs, type_info.value, offset + type_info.value_offset, valueSize))
+            {
+                return false;
+            }
+            append(offset + type_info.engaged_offset, 1);
+            return true;
+        }
+        if (func == StdPair)
+        {
+            const PairTypeInfo &type_info = *reinterpret_cast<const PairTypeInfo*>(stringifier.type_info);
+            return AppendDataRuns(runs, type_info.first, offset + type_info.first_offset, type_info.second_offset - type_info.first_offset)
+                && AppendDataRuns(runs, type_info.second, offset + type_info.second_offset, size - type_info.second_offset);
+        }
+
+        // Sizes of numbers are known from their printer, `size` may include the tail padding of a pair
+        if (size_t known = PlainSize<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(func))
+        {
+            size = std::min(size, known);
+        }
+        else if (func == Bool || func == Number<float> || func == Number<double>)
+        {
+            size = std::min(size, func == Bool ? sizeof(bool) : func == Number<float> ? sizeof(float) : sizeof(double));
+        }
+        else if (func == Number<long double> && std::numeric_limits<long double>::digits == 64)
+        {
+            size = std::min<size_t>(size, 10); // x87 extended precision, the rest is padding
+        }
+        else if (func == CharArray)
+        {
+            size = std::min(size, reinterpret_cast<const ArrayTypeInfo*>(stringifier.type_info)->count);
+        }
+
+        if (size == 0)
+        {
+            return false;
+        }
+        append(offset, size);
+        return true;
+    }
+
+    // Size of the integers and enums printed by `func`, 0 for other printers
+    template <typename... Ts>
+    static size_t PlainSize(StringifyFunc func)
+    {
+        size_t res = 0;
+        ((res = (func == Number<Ts> || func == EnumClass<Ts>) ? sizeof(Ts) : res), ...);
+        return res;
+    }
+};
+
+// Bump allocator over MAP_SHARED mappings, which processes forked afterwards share instead of getting copies of the
+// pages. Nothing is freed, protect() makes everything allocated so far read-only.
+class SharedArena : public std::pmr::memory_resource
+{
+public:
+    void protect()
+    {
+        for (const auto &[data, size] : _chunks)
+        {
+            mprotect(data, size, PROT_READ);
+        }
+        _pos = _end;
+    }
+
+    // Bytes mapped so far
+    size_t size() const
+    {
+        size_t res = 0;
+        for (const auto &chunk : _chunks)
+        {
+            res += chunk.second;
+        }
+        return res;
+    }
+
+private:
+    static constexpr size_t kChunkSize = 1 << 20;
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        uintptr_t pos = (_pos + alignment - 1) & ~(alignment - 1);
+        if (_chunks.empty() || pos + bytes > _end)
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t size = std::max(kChunkSize, (bytes + page - 1) / page * page);
+            void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            _chunks.emplace_back(data, size);
+            pos = reinterpret_cast<uintptr_t>(data);
+            _end = pos + size;
+        }
+        _pos = pos + bytes;
+        return reinterpret_cast<void*>(pos);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override
+    {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::vector<std::pair<void*, size_t>> _chunks;
+    uintptr_t _pos = 0;
+    uintptr_t _end = 0;
+};
+
+// Layouts of all bound stringifiers of an executable, written into its .librepr section by librepr-embed so that it
+// prints without any debug data, and by prepare_fork to move them into shared memory. The table is a sequence of
+// little-endian 64-bit words:
+//
+//   header:   kMagic, kVersion, build-id hash, marker address, node count, binding count, string table size
+//   nodes:    kind, type_die, fields of the kind (see Bind)
+//   bindings: stringifier address, node index
+//   strings:  NUL terminated, referred to by their offset in the string table
+//
+// Addresses are link time addresses as in the debug data, relocated through librepr_global_offset_marker__.
+struct LayoutTable
+{
+    static constexpr uint64_t kMagic = 0x314c524c; // "LRL1"
+    static constexpr uint64_t kVersion = 2;
+
+    // Node kinds are indices into this table, new stringifiers must be appended
+    static const std::vector<StringifyFunc>& Kinds()
+    {
+        using S = DwarfStringify2;
+        static const std::vector<StringifyFunc> kinds = {
+            S::Unknown, S::Bool, S::CString, S::Pointer,
+            S::Number<int8_t>, S::Number<int16_t>, S::Number<int32_t>, S::Number<int64_t>,
+            S::Number<uint8_t>, S::Number<uint16_t>, S::Number<uint32_t>, S::Number<uint64_t>,
+            S::Number<float>, S::Number<double>, S::Number<long double>,
+            S::EnumClass<int8_t>, S::EnumClass<int16_t>, S::EnumClass<int32_t>, S::EnumClass<int64_t>,
+            S::EnumClass<uint8_t>, S::EnumClass<uint16_t>, S::EnumClass<uint32_t>, S::EnumClass<uint64_t>,
+            S::Struct, S::Array, S::CharArray, S::StdVector, S::StdBitVector, S::StdString,
+            S::StdList, S::StdRbTree, S::StdHashtable, S::StdOptional, S::StdSmartPtr, S::StdPair,
+        };
+        return kinds;
+    }
+
+    // Kind of a stringifier, 0 (Unknown) if it can't be stored
+    static uint64_t KindOf(StringifyFunc func)
+    {
+        const auto &kinds = Kinds();
+        auto it = std::find(kinds.begin(), kinds.end(), func);
+        return it == kinds.end() ? 0 : it - kinds.begin();
+    }
+
+    // Binds the stringifiers of the running executable. `markerAddress` is the address of
+    // librepr_global_offset_marker__ in this process, `buildIdHash` that of the executable (0 skips the check).
+    // Type infos are allocated from `mem` if given, they refer to the strings of `table` which must outlive them.
+    // Returns the number of stringifiers in the table.
+    static size_t Bind(Buffer table, uint64_t buildIdHash, uint64_t markerAddress, std::pmr::memory_resource *mem = nullptr)
+    {
+        using S = DwarfStringify2;
+
+        Cursor c(table);
+        if (c.word() != kMagic || c.word() != kVersion)
+        {
+            throw std::runtime_error("Unsupported .librepr section");
+        }
+        uint64_t tableBuildIdHash = c.word();
+        if (buildIdHash && tableBuildIdHash && buildIdHash != tableBuildIdHash)
+        {
+            throw std::runtime_error("The .librepr section was written for a different build");
+        }
+        uint64_t globalOffset = markerAddress - c.word();
+        uint64_t numNodes = c.count(2);
+        uint64_t numBindings = c.count(2);
+        c.setStrings(c.word());
+
+        // References between nodes are filled in once all nodes are read. Type infos on the heap are owned by `owned`
+        // until the whole table is bound, so that nothing leaks if it turns out to be invalid.
+        std::vector<StringifyFuncAndTypeInfo> nodes(numNodes);
+        Owned owned;
+        owned.reserve(numNodes);
+        std::vector<std::pair<StringifyFuncAndTypeInfo*, uint64_t>> refs;
+        auto ref = [&](StringifyFuncAndTypeInfo &fnti)
+        {
+            refs.emplace_back(&fnti, c.word());
+        };
+
+        const auto &kinds = Kinds();
+        for (auto &node : nodes)
+        {
+            uint64_t kind = c.word();
+            if (kind >= kinds.size())
+            {
+                throw std::runtime_error("Unsupported .librepr section");
+            }
+            node.func = kinds[kind];
+            node.type_info = nullptr;
+            node.type_die = c.word();
+
+            StringifyFunc func = node.func;
+            if (func == S::Struct)
+            {
+                auto *ti = New<S::StructTypeInfo>(owned, mem);
+                // Members are built whole, so that their keys keep the memory resource. References point into
+                // `members`, which isn't reallocated.
+                uint64_t numMembers = c.count(4);
+                ti->members.reserve(numMembers);
+                for (uint64_t i = 0; i < numMembers; ++i)
+                {
+                    const char *name = c.str();
+                    size_t offset = c.word();
+                    size_t size = c.word();
+                    auto &m = ti->members.emplace_back(S::StructTypeInfo::MemberInfo{name, offset, {}, S::MemberKeys(name, Resource(mem)), size});
+                    ref(m.stringifier);
+                }
+                ti->bases.resize(c.count(4));
+                for (auto &base : ti->bases)
+                {
+                    base.name = c.str();
+                    base.offset = c.word();
+                    base.first_member = c.word();
+                    base.member_count = c.word();
+                    if (base.first_member > numMembers || base.member_count > numMembers - base.first_member)
+                    {
+                        throw std::runtime_error("Invalid .librepr section");
+                    }
+                }
+                ti->runs.resize(c.count(2));
+                for (auto &run : ti->runs)
+                {
+                    run.offset = c.word();
+                    run.size = c.word();
+                }
+                ti->plain = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::Array || func == S::CharArray)
+            {
+                auto *ti = New<S::ArrayTypeInfo>(owned, mem);
+                ref(ti->elem);
+                ti->elem_size = c.word();
+                ti->count = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdVector)
+            {
+                auto *ti = New<S::VectorTypeInfo>(owned, mem);
+                ref(ti->elem);
+                ti->elem_size = c.word();
+                ti->begin_offset = c.word();
+                ti->end_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdBitVector)
+            {
+                auto *ti = New<S::BitVectorTypeInfo>(owned, mem);
+                ti->begin_offset = c.word();
+                ti->end_offset = c.word();
+                ti->end_bit_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdString)
+            {
+                auto *ti = New<S::StringTypeInfo>(owned, mem);
+                ti->data_offset = c.word();
+                ti->size_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdList || func == S::StdRbTree || func == S::StdHashtable)
+            {
+                auto *ti = New<S::NodeContainerTypeInfo>(owned, mem);
+                ref(ti->elem);
+                ti->elem_size = c.word();
+                ti->head_offset = c.word();
+                ti->count_offset = c.word();
+                ti->node_value_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdOptional)
+            {
+                auto *ti = New<S::OptionalTypeInfo>(owned, mem);
+                ref(ti->value);
+                ti->value_offset = c.word();
+                ti->engaged_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdSmartPtr)
+            {
+                auto *ti = New<S::SmartPtrTypeInfo>(owned, mem);
+                ref(ti->pointee);
+                ti->pointee_size = c.word();
+                ti->ptr_offset = c.word();
+                node.type_info = ti;
+            }
+            else if (func == S::StdPair)
+            {
+                auto *ti = New<S::PairTypeInfo>(owned, mem);
+                ref(ti->first);
+                ti->first_offset = c.word();
+                ref(ti->second);
+                ti->second_offset = c.word();
+                node.type_info = ti;
+            }
+            else
+            {
+                node.type_info = ReadEnum<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(func, c, owned, mem);
+            }
+        }
+
+        for (auto &[fnti, idx] : refs)
+        {
+            if (idx >= numNodes)
+            {
+                throw std::runtime_error("Invalid .librepr section");
+            }
+            *fnti = nodes[idx];
+        }
+
+        // Everything is validated before the first stringifier is written
+        std::vector<std::pair<uint64_t, uint64_t>> bindings(numBindings);
+        for (auto &[location, idx] : bindings)
+        {
+            location = c.word();
+            idx = c.word();
+            if (idx >= numNodes)
+            {
+                throw std::runtime_error("Invalid .librepr section");
+            }
+        }
+        for (const auto &[location, idx] : bindings)
+        {
+            PublishStringifier(reinterpret_cast<StringifyFuncAndTypeInfo*>(globalOffset + location), nodes[idx]);
+        }
+        for (auto &ti : owned)
+        {
+            ti.release();
+        }
+        return numNodes;
+    }
+
+    // Builds a table from bound stringifiers
+    class Writer
+    {
+    public:
+        // Adds the layout of `fnti` and everything it refers to, returns its node
+        uint64_t add(const StringifyFuncAndTypeInfo &fnti)
+        {
+            if (fnti.type_info)
+            {
+                if (auto it = _added.find(fnti.type_info); it != _added.end())
+                {
+                    return it->second;
+                }
+            }
+
+            // Registered before it's written, for types which refer to themselves. Nodes it refers to are added while
+            // writing it, so it's written into its own buffer.
+            uint64_t idx = _nodes.size();
+            if (fnti.type_info)
+            {
+                _added[fnti.type_info] = idx;
+            }
+            _nodes.emplace_back();
+
+            std::vector<uint64_t> words;
+            writeNode(fnti, words);
+            _nodes[idx] = std::move(words);
+            return idx;
+        }
+
+        // Binds the stringifier at link time address `location` to `node`
+        void bind(uint64_t location, uint64_t node)
+        {
+            _bindings.push_back({location, node});
+        }
+
+        std::string write(uint64_t buildIdHash, uint64_t markerLocation) const
+        {
+            std::vector<uint64_t> header = {
+                kMagic, kVersion, buildIdHash, markerLocation, _nodes.size(), _bindings.size(), _strings.size(),
+            };
+
+            std::string res;
+            append(res, header);
+            for (const auto &node : _nodes)
+            {
+                append(res, node);
+            }
+            for (const auto &[location, node] : _bindings)
+            {
+                append(res, {location, node});
+            }
+            res += _strings;
+            return res;
+        }
+
+    private:
+        static void append(std::string &out, const std::vector<uint64_t> &words)
+        {
+            for (uint64_t word : words)
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    out += char(word >> (8 * i));
+                }
+            }
+        }
+
+        uint64_t str(std::string_view text)
+        {
+            auto it = _string_offsets.find(std::string(text));
+            if (it != _string_offsets.end())
+            {
+                return it->second;
+            }
+            uint64_t offset = _strings.size();
+            _strings.append(text);
+            _strings += '\0';
+            _string_offsets.emplace(text, offset);
+            return offset;
+        }
+
+        void writeNode(const StringifyFuncAndTypeInfo &fnti, std::vector<uint64_t> &out)
+        {
+            using S = DwarfStringify2;
+            StringifyFunc func = fnti.func;
+            uint64_t kind = KindOf(func);
+            out.push_back(kind);
+            out.push_back(fnti.type_die);
+            if (kind == 0)
+            {
+                return;
+            }
+
+            if (func == S::Struct)
+            {
+                const auto *ti = reinterpret_cast<const S::StructTypeInfo*>(fnti.type_info);
+                out.push_back(ti->members.size());
+                for (const auto &m : ti->members)
+                {
+                    out.push_back(str(m.name));
+                    out.push_back(m.offset);
+                    out.push_back(m.size);
+                    out.push_back(add(m.stringifier));
+                }
+                out.push_back(ti->bases.size());
+                for (const auto &base : ti->bases)
+                {
+                    out.insert(out.end(), {str(base.name), base.offset, base.first_member, base.member_count});
+                }
+                out.push_back(ti->runs.size());
+                for (const auto &run : ti->runs)
+                {
+                    out.push_back(run.offset);
+                    out.push_back(run.size);
+                }
+                out.push_back(ti->plain);
+            }
+            else if (func == S::Array || func == S::CharArray)
+            {
+                const auto *ti = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {add(ti->elem), ti->elem_size, ti->count});
+            }
+            else if (func == S::StdVector)
+            {
+                const auto *ti = reinterpret_cast<const S::VectorTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {add(ti->elem), ti->elem_size, ti->begin_offset, ti->end_offset});
+            }
+            else if (func == S::StdBitVector)
+            {
+                const auto *ti = reinterpret_cast<const S::BitVectorTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {ti->begin_offset, ti->end_offset, ti->end_bit_offset});
+            }
+            else if (func == S::StdString)
+            {
+                const auto *ti = reinterpret_cast<const S::StringTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {ti->data_offset, ti->size_offset});
+            }
+            else if (func == S::StdList || func == S::StdRbTree || func == S::StdHashtable)
+            {
+                const auto *ti = reinterpret_cast<const S::NodeContainerTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {add(ti->elem), ti->elem_size, ti->head_offset, ti->count_offset, ti->node_value_offset});
+            }
+            else if (func == S::StdOptional)
+            {
+                const auto *ti = reinterpret_cast<const S::OptionalTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {add(ti->value), ti->value_offset, ti->engaged_offset});
+            }
+            else if (func == S::StdSmartPtr)
+            {
+                const auto *ti = reinterpret_cast<const S::SmartPtrTypeInfo*>(fnti.type_info);
+                out.insert(out.end(), {add(ti->pointee), ti->pointee_size, ti->ptr_offset});
+            }
+            else if (func == S::StdPair)
+            {
+                const auto *ti = reinterpret_cast<const S::PairTypeInfo*>(fnti.type_info);
+                uint64_t first = add(ti->first);
+                uint64_t second = add(ti->second);
+                out.insert(out.end(), {first, ti->first_offset, second, ti->second_offset});
+            }
+            else
+            {
+                writeEnum<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(fnti, out);
+            }
+        }
+
+        template <typename... Ts>
+        void writeEnum(const StringifyFuncAndTypeInfo &fnti, std::vector<uint64_t> &out)
+        {
+            ((fnti.func == DwarfStringify2::EnumClass<Ts> ? (writeEnumOf<Ts>(fnti, out), true) : false) || ...);
+        }
+
+        template <typename T>
+        void writeEnumOf(const StringifyFuncAndTypeInfo &fnti, std::vector<uint64_t> &out)
+        {
+            const auto *ti = reinterpret_cast<const DwarfStringify2::EnumClassTypeInfo<T>*>(fnti.type_info);
+            std::string_view enum_name = ti->enum_name;
+            out.push_back(str(enum_name));
+            out.push_back(ti->valueToText.size());
+            for (const auto &[value, text] : ti->valueToText)
+            {
+                // The text of the other formats is derived from the enumerator name
+                std::string_view name = text[static_cast<size_t>(OutputFormat::Repr)];
+                name.remove_prefix(enum_name.size() + 2);
+                out.push_back(static_cast<uint64_t>(value));
+                out.push_back(str(name));
+            }
+        }
+
+        std::map<const void*, uint64_t> _added; // Node of each type info
+        std::vector<std::pair<uint64_t, uint64_t>> _bindings; // Stringifier location, node
+        std::vector<std::vector<uint64_t>> _nodes; // Words of each node
+        std::string _strings;
+        std::map<std::string, uint64_t> _string_offsets;
+    };
+
+private:
+    using Owned = std::vector<std::unique_ptr<void, void(*)(void*)>>;
+
+    static std::pmr::memory_resource* Resource(std::pmr::memory_resource *mem)
+    {
+        return mem ? mem : std::pmr::get_default_resource();
+    }
+
+    // A type info allocated from `mem`, or on the heap and owned by `owned`. Those in `mem` are never freed.
+    template <typename T>
+    static T* New(Owned &owned, std::pmr::memory_resource *mem)
+    {
+        constexpr bool kUsesResource = std::is_constructible_v<T, std::pmr::memory_resource*>;
+        if (mem)
+        {
+            void *p = mem->allocate(sizeof(T), alignof(T));
+            if constexpr (kUsesResource) return new (p) T(mem);
+            else return new (p) T;
+        }
+        T *ti = new T;
+        owned.emplace_back(ti, [](void *p) { delete static_cast<T*>(p); });
+        return ti;
+    }
+
+    // Bounds checked reads from the table
+    struct Cursor
+    {
+        explicit Cursor(Buffer table_)
+            : table(table_)
+        {
+        }
+
+        Buffer table;
+        size_t pos = 0;
+        Buffer strings;
+
+        uint64_t word()
+        {
+            if (table.size() - pos < 8)
+            {
+                throw std::runtime_error("Truncated .librepr section");
+            }
+            uint64_t res;
+            memcpy(&res, table.data() + pos, 8);
+            pos += 8;
+            return res;
+        }
+
+        // An element count, checked against the remaining words with `words` per element
+        uint64_t count(size_t words)
+        {
+            uint64_t res = word();
+            if (res > (table.size() - pos) / 8 / words)
+            {
+                throw std::runtime_error("Invalid .librepr section");
+            }
+            return res;
+        }
+
+        // The string table is at the end of the table
+        void setStrings(uint64_t size)
+        {
+            if (size == 0 || size > table.size() - pos || table[table.size() - 1] != 0)
+            {
+                throw std::runtime_error("Invalid .librepr section");
+            }
+            strings = table.substr(table.size() - size);
+            table = table.substr(0, table.size() - size);
+        }
+
+        const char* str()
+        {
+            uint64_t offset = word();
+            if (offset >= strings.size())
+            {
+                throw std::runtime_error("Invalid .librepr section");
+            }
+            return reinterpret_cast<const char*>(strings.data() + offset);
+        }
+    };
+
+    template <typename... Ts>
+    static void* ReadEnum(StringifyFunc func, Cursor &c, Owned &owned, std::pmr::memory_resource *mem)
+    {
+        void *res = nullptr;
+        ((func == DwarfStringify2::EnumClass<Ts> ? (res = ReadEnumOf<Ts>(c, owned, mem), true) : false) || ...);
+        return res;
+    }
+
+    template <typename T>
+    static void* ReadEnumOf(Cursor &c, Owned &owned, std::pmr::memory_resource *mem)
+    {
+        auto *ti = New<DwarfStringify2::EnumClassTypeInfo<T>>(owned, mem);
+        ti->enum_name = c.str();
+        for (uint64_t n = c.count(2); n > 0; --n)
+        {
+            T value = static_cast<T>(c.word());
+            ti->valueToText.insert_or_assign(value, DwarfStringify2::EnumeratorText(ti->enum_name, c.str(), Resource(mem)));
+        }
+        return ti;
+    }
+};
+
+// Stringifier of the dynamic type of a polymorphic object, with the size of that type
+struct DynamicType
+{
+    StringifyFuncAndTypeInfo fnti;
+    size_t size;
+};
+
+// Manages mapping of dwarf type refs to their relevant stringify functions and data
+struct LibReprGlobalCache
+{
+    using DwarfLocation = std::pair<uint32_t, uint32_t>; // cu_idx, cu_die_offset
+
+    std::map<DwarfLocation, StringifyFuncAndTypeInfo> stringifiers;
+
+    // Collected for librepr::stats()
+    uint64_t _resolved = 0;
+    uint64_t _cache_hits = 0;
+    uint64_t _unsupported = 0;
+    std::chrono::nanoseconds _find_global_offset_time{0};
+    std::vector<std::string> _errors;
+    bool _quiet = false; // Errors are only collected in _errors, not written to std::cerr
+
+    uint64_t _global_offset = 0; // Set by run()
+    std::vector<uint64_t> _callsites; // Locations of the stringifiers bound by run()
+
+    // Vtables in the symbol table, for printing polymorphic objects as their dynamic type. Loaded on first use.
+    struct VtableSymbol
+    {
+        uint64_t begin; // Link time addresses
+        uint64_t end;
+        std::string type_name; // Demangled, e.g. "shapes::Circle"
+    };
+    std::vector<VtableSymbol> _vtables;
+    std::unordered_map<std::string, DwarfLocation> _class_dies; // Definitions of the types in _vtables, by name
+    bool _vtables_loaded = false;
+
+    template <typename UnderlyingT>
+    StringifyFuncAndTypeInfo loadEnumStringify(DIEAccessor die)
+    {
+        constexpr bool IsSigned = std::is_signed_v<UnderlyingT>;
+
+        auto type_info = std::make_unique<DwarfStringify2::EnumClassTypeInfo<UnderlyingT>>();
+
+        type_info->enum_name = die.getCStringView(DwarfAttr::Name).value().data();
+        if (die.has_children())
+        {
+            ++die;
+            for (; die.tag() != DwarfTag::None; ++die)
+            {
+                if (die.tag() != DwarfTag::Enumerator) throw std::runtime_error("Invalid dwarf");
+
+                UnderlyingT value;
+                if constexpr (IsSigned)
+                {
+                    value = die.getSigned(DwarfAttr::ConstValue).value();
+                }
+                else
+                {
+                    value = die.getUnsigned(DwarfAttr::ConstValue).value();
+                }
+
+                std::string_view name = die.getCStringView(DwarfAttr::Name).value();
+                type_info->valueToText[value] = DwarfStringify2::EnumeratorText(type_info->enum_name, name);
+            }
+        }
+
+        StringifyFuncAndTypeInfo res;
+        res.func = DwarfStringify2::EnumClass<UnderlyingT>;
+        res.type_info = static_cast<void*>(type_info.release());
+        return res;
+    }
+
+    // Calls `fn` for each direct child of `die`
+    template <typename Fn>
+    static void forEachChild(DIEAccessor die, Fn &&fn)
+    {
+        if (!die.has_children())
+        {
+            return;
+        }
+
+        int depth = 1;
+        ++die;
+        for (; ; ++die)
+        {
+            if (depth == 1 && die.tag() != DwarfTag::None)
+            {
+                fn(die);
+            }
+
+            if (die.has_children())
+            {
+                ++depth;
+            }
+            else if (die.tag() == DwarfTag::None)
+            {
+                --depth;
+                if (depth == 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    // Skips typedefs and cv-qualifiers
+    DIEAccessor resolveTypeDie(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        DIEAccessor die = loader.loadCompilationUnitDie(cu_idx, typeDieOffset);
+        // Qualifiers of void (e.g. `const void`) have no type, they are returned as is
+        while ((die.tag() == DwarfTag::Typedef || die.tag() == DwarfTag::ConstType || die.tag() == DwarfTag::VolatileType)
+               && die.has(DwarfAttr::Type))
+        {
+            die = loader.loadCompilationUnitDie(cu_idx, *die.getOffset(DwarfAttr::Type));
+        }
+        return die;
+    }
+
+    std::optional<uint64_t> getTypeByteSize(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        DIEAccessor die = resolveTypeDie(loader, cu_idx, typeDieOffset);
+        if (die.tag() == DwarfTag::ArrayType)
+        {
+            std::optional<std::vector<size_t>> dims = getArrayDims(die);
+            std::optional<uint64_t> elemSize = getTypeByteSize(loader, cu_idx, die.getOffset(DwarfAttr::Type).value());
+            if (!dims || !elemSize)
+            {
+                return std::nullopt;
+            }
+            uint64_t size = *elemSize;
+            for (size_t dim : *dims)
+            {
+                size *= dim;
+            }
+            return size;
+        }
+        return die.getUnsigned(DwarfAttr::ByteSize);
+    }
+
+    static uint64_t AlignUp(uint64_t offset, uint64_t align)
+    {
+        return (offset + align - 1) / align * align;
+    }
+
+    // Alignment of a type, from DW_AT_alignment (alignas) or else from its members. Elements of node based containers
+    // are stored at offsets aligned for them.
+    uint64_t getTypeAlignment(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        DIEAccessor die = resolveTypeDie(loader, cu_idx, typeDieOffset);
+        if (std::optional<uint64_t> align = die.getUnsigned(DwarfAttr::Alignment))
+        {
+            return *align;
+        }
+
+        uint64_t res = 1;
+        switch (die.tag())
+        {
+        case DwarfTag::StructureType:
+        case DwarfTag::ClassType:
+        case DwarfTag::UnionType:
+            forEachChild(die, [&](DIEAccessor child)
+            {
+                if ((child.tag() == DwarfTag::Member || child.tag() == DwarfTag::Inheritance) && !child.has(DwarfAttr::Declaration))
+                {
+                    res = std::max(res, getTypeAlignment(loader, cu_idx, child.getOffset(DwarfAttr::Type).value()));
+                }
+            });
+            return res;
+        case DwarfTag::ArrayType:
+            return getTypeAlignment(loader, cu_idx, die.getOffset(DwarfAttr::Type).value());
+        case DwarfTag::EnumerationType:
+            if (die.has(DwarfAttr::Type))
+            {
+                return getTypeAlignment(loader, cu_idx, *die.getOffset(DwarfAttr::Type));
+            }
+            break;
+        default:
+            break;
+        }
+        // Base types, pointers and enums are aligned to their size
+        return std::clamp<uint64_t>(die.getUnsigned(DwarfAttr::ByteSize).value_or(1), 1, 16);
+    }
+
+    // Number of elements in each dimension, outermost first. Fails for arrays of unknown bound.
+    std::optional<std::vector<size_t>> getArrayDims(DIEAccessor die)
+    {
+        std::vector<size_t> dims;
+        bool bounded = true;
+        forEachChild(die, [&](DIEAccessor child)
+        {
+            if (child.tag() != DwarfTag::SubrangeType)
+            {
+                return;
+            }
+
+            if (std::optional<uint64_t> count = child.getUnsigned(DwarfAttr::Count))
+            {
+                dims.push_back(*count);
+            }
+            else if (std::optional<uint64_t> upperBound = child.getUnsigned(DwarfAttr::UpperBound))
+            {
+                dims.push_back(*upperBound + 1 - child.getUnsigned(DwarfAttr::LowerBound).value_or(0));
+            }
+            else
+            {
+                bounded = false;
+            }
+        });
+
+        if (!bounded || dims.empty())
+        {
+            return std::nullopt;
+        }
+        return dims;
+    }
+
+    bool isCharType(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        // Only plain `char` is treated as text, `signed char` and `unsigned char` (int8_t, uint8_t) are numbers
+        DIEAccessor die = resolveTypeDie(loader, cu_idx, typeDieOffset);
+        return die.tag() == DwarfTag::BaseType
+            && die.getUnsigned(DwarfAttr::ByteSize) == 1
+            && die.getCStringView(DwarfAttr::Name) == "char";
+    }
+
+    // Type of the `idx`th template type parameter
+    std::optional<uint64_t> getTemplateTypeParam(DIEAccessor die, size_t idx)
+    {
+        std::optional<uint64_t> res;
+        size_t i = 0;
+        forEachChild(die, [&](DIEAccessor child)
+        {
+            if (child.tag() == DwarfTag::TemplateTypeParameter && i++ == idx)
+            {
+                res = child.getOffset(DwarfAttr::Type);
+            }
+        });
+        return res;
+    }
+
+    // Type of a nested typedef, like `value_type`
+    std::optional<uint64_t> getMemberTypedef(DIEAccessor die, std::string_view name)
+    {
+        std::optional<uint64_t> res;
+        forEachChild(die, [&](DIEAccessor child)
+        {
+            if (!res && child.tag() == DwarfTag::Typedef && child.getCStringView(DwarfAttr::Name) == name)
+            {
+                res = child.getOffset(DwarfAttr::Type);
+            }
+        });
+        return res;
+    }
+
+    struct MemberLocation
+    {
+        size_t offset;
+        uint64_t typeDieOffset;
+    };
+
+    // Looks up a non-static data member by name, searching base classes and anonymous members too
+    std::optional<MemberLocation> findMember(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die, std::string_view name)
+    {
+        std::optional<MemberLocation> res;
+        forEachChild(die, [&](DIEAccessor child)
+        {
+            if (res || (child.tag() != DwarfTag::Member && child.tag() != DwarfTag::Inheritance))
+            {
+                return;
+            }
+
+            std::optional<uint64_t> location = child.getUnsigned(DwarfAttr::DataMemberLocation);
+            if (!location)
+            {
+                return; // static member
+            }
+
+            std::optional<std::string_view> childName = child.getCStringView(DwarfAttr::Name);
+            uint64_t typeDieOffset = child.getOffset(DwarfAttr::Type).value();
+            if (child.tag() == DwarfTag::Member && childName == name)
+            {
+                res = MemberLocation{*location, typeDieOffset};
+            }
+            else if (child.tag() == DwarfTag::Inheritance || !childName)
+            {
+                if (auto inner = findMember(loader, cu_idx, resolveTypeDie(loader, cu_idx, typeDieOffset), name))
+                {
+                    res = MemberLocation{*location + inner->offset, inner->typeDieOffset};
+                }
+            }
+        });
+        return res;
+    }
+
+    std::optional<MemberLocation> findMemberPath(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die, std::initializer_list<std::string_view> path)
+    {
+        MemberLocation res = {0, 0};
+        for (std::string_view name : path)
+        {
+            std::optional<MemberLocation> member = findMember(loader, cu_idx, die, name);
+            if (!member)
+            {
+                return std::nullopt;
+            }
+            res.offset += member->offset;
+            res.typeDieOffset = member->typeDieOffset;
+            die = resolveTypeDie(loader, cu_idx, member->typeDieOffset);
+        }
+        return res;
+    }
+
+    template <typename TypeInfo>
+    static StringifyFuncAndTypeInfo makeStringify(StringifyFunc func, std::unique_ptr<TypeInfo> type_info)
+    {
+        StringifyFuncAndTypeInfo res;
+        res.func = func;
+        res.type_info = static_cast<void*>(type_info.release());
+        return res;
+    }
+
+    void loadStructStringifyAppendMembers(DwarfStringify2::StructTypeInfo &type_info, DebugDataLoader &loader, size_t cu_idx, DIEAccessor die, size_t offset_base)
+    {
+        forEachChild(die, [&](DIEAccessor child)
+        {
+            if (child.tag() != DwarfTag::Inheritance && child.tag() != DwarfTag::Member)
+            {
+                return;
+            }
+
+            std::optional<uint64_t> location = child.getUnsigned(DwarfAttr::DataMemberLocation);
+            if (!location)
+            {
+                return; // static member
+            }
+
+            if (child.tag() == DwarfTag::Inheritance)
+            {
+                DIEAccessor baseClassDie = resolveTypeDie(loader, cu_idx, child.getOffset(DwarfAttr::Type).value());
+                size_t baseIdx = type_info.bases.size();
+                type_info.bases.push_back({baseClassDie.getCStringView(DwarfAttr::Name).value_or("").data(), offset_base + *location, type_info.members.size(), 0});
+                loadStructStringifyAppendMembers(type_info, loader, cu_idx, baseClassDie, offset_base + *location);
+                type_info.bases[baseIdx].member_count = type_info.members.size() - type_info.bases[baseIdx].first_member;
+            }
+            else
+            {
+                auto &member = type_info.members.emplace_back();
+                member.name = child.getCStringView(DwarfAttr::Name).value_or("").data();
+                member.offset = offset_base + *location;
+                member.stringifier = loadStringify(loader, cu_idx, child.getOffset(DwarfAttr::Type).value());
+                member.size = getTypeByteSize(loader, cu_idx, child.getOffset(DwarfAttr::Type).value()).value_or(0);
+                member.keys = DwarfStringify2::MemberKeys(member.name);
+            }
+        });
+    }
+
+    static std::vector<DwarfStringify2::StructTypeInfo::DataRun> getDataRuns(const DwarfStringify2::StructTypeInfo &type_info)
+    {
+        std::vector<DwarfStringify2::StructTypeInfo::DataRun> runs;
+        for (const auto &m : type_info.members)
+        {
+            if (!DwarfStringify2::AppendDataRuns(runs, m.stringifier, m.offset, m.size))
+            {
+                return {};
+            }
+        }
+        return runs;
+    }
+
+    StringifyFuncAndTypeInfo loadStructStringify(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die, DwarfLocation loc)
+    {
+        auto type_info = std::make_unique<DwarfStringify2::StructTypeInfo>();
+
+        // Register before loading members, so that types referring to themselves (e.g. through a std::unique_ptr) terminate
+        StringifyFuncAndTypeInfo res;
+        res.func = DwarfStringify2::Struct;
+        res.type_info = static_cast<void*>(type_info.get());
+        stringifiers[loc] = res;
+
+        loadStructStringifyAppendMembers(*type_info, loader, cu_idx, die, 0);
+        std::vector<DwarfStringify2::StructTypeInfo::DataRun> runs = getDataRuns(*type_info);
+        type_info->runs.assign(runs.begin(), runs.end());
+        type_info->plain = std::all_of(type_info->members.begin(), type_info->members.end(), [](const auto &m)
+        {
+            return DwarfStringify2::IsPlainValue(m.stringifier);
+        });
+
+        type_info.release();
+        return res;
+    }
+
+    // Standard library types are recognized by their template name, their layout is then resolved by member names
+    // (libstdc++ or libc++). Types which don't have the expected members are printed as plain structs.
+    std::optional<StringifyFuncAndTypeInfo> loadStdStringify(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die)
+    {
+        std::optional<std::string_view> name = die.getCStringView(DwarfAttr::Name);
+        if (!name)
+        {
+            return std::nullopt;
+        }
+        std::string_view templateName = name->substr(0, name->find('<'));
+        if (templateName.size() == name->size())
+        {
+            return std::nullopt;
+        }
+
+        auto member = [&](std::initializer_list<std::string_view> path, std::initializer_list<std::string_view> libcxxPath = {})
+        {
+            std::optional<MemberLocation> res = findMemberPath(loader, cu_idx, die, path);
+            if (!res && libcxxPath.size())
+            {
+                res = findMemberPath(loader, cu_idx, die, libcxxPath);
+            }
+            return res;
+        };
+        auto isBaseType = [&](uint64_t typeDieOffset, uint64_t encoding, uint64_t byteSize)
+        {
+            DIEAccessor typeDie = resolveTypeDie(loader, cu_idx, typeDieOffset);
+            return typeDie.tag() == DwarfTag::BaseType
+                && typeDie.getUnsigned(DwarfAttr::Encoding) == encoding
+                && typeDie.getUnsigned(DwarfAttr::ByteSize) == byteSize;
+        };
+
+        std::optional<uint64_t> param0 = getTemplateTypeParam(die, 0);
+
+        if (templateName == "vector" && param0 && isBaseType(*param0, 2, 1))
+        {
+            auto begin = member({"_M_impl", "_M_start", "_M_p"});
+            auto end = member({"_M_impl", "_M_finish", "_M_p"});
+            auto endBit = member({"_M_impl", "_M_finish", "_M_offset"});
+            if (!begin || !end || !endBit) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::BitVectorTypeInfo>();
+            type_info->begin_offset = begin->offset;
+            type_info->end_offset = end->offset;
+            type_info->end_bit_offset = endBit->offset;
+            return makeStringify(DwarfStringify2::StdBitVector, std::move(type_info));
+        }
+
+        if (templateName == "vector" && param0)
+        {
+            auto begin = member({"_M_impl", "_M_start"}, {"__begin_"});
+            auto end = member({"_M_impl", "_M_finish"}, {"__end_"});
+            std::optional<uint64_t> elemSize = getTypeByteSize(loader, cu_idx, *param0);
+            if (!begin || !end || !elemSize || *elemSize == 0) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::VectorTypeInfo>();
+            type_info->elem = loadStringify(loader, cu_idx, *param0);
+            type_info->elem_size = *elemSize;
+            type_info->begin_offset = begin->offset;
+            type_info->end_offset = end->offset;
+            return makeStringify(DwarfStringify2::StdVector, std::move(type_info));
+        }
+
+        if ((templateName == "basic_string" || templateName == "basic_string_view") && param0 && isCharType(loader, cu_idx, *param0))
+        {
+            auto data = member({"_M_dataplus", "_M_p"});
+            auto size = member({"_M_string_length"});
+            if (templateName == "basic_string_view")
+            {
+                data = member({"_M_str"}, {"__data_"});
+                size = member({"_M_len"}, {"__size_"});
+            }
+            if (!data || !size) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::StringTypeInfo>();
+            type_info->data_offset = data->offset;
+            type_info->size_offset = size->offset;
+            return makeStringify(DwarfStringify2::StdString, std::move(type_info));
+        }
+
+        if (templateName == "list" && param0)
+        {
+            auto head = member({"_M_impl", "_M_node"});
+            auto count = member({"_M_impl", "_M_node", "_M_size"});
+            auto prev = member({"_M_impl", "_M_node", "_M_prev"});
+            std::optional<uint64_t> elemSize = getTypeByteSize(loader, cu_idx, *param0);
+            if (!head || !count || !elemSize) return std::nullopt;
+            if (!prev || prev->offset != head->offset + 8) return std::nullopt; // StdList follows _M_next at 0
+
+            auto type_info = std::make_unique<DwarfStringify2::NodeContainerTypeInfo>();
+            type_info->elem = loadStringify(loader, cu_idx, *param0);
+            type_info->elem_size = *elemSize;
+            type_info->head_offset = head->offset;
+            type_info->count_offset = count->offset;
+            type_info->node_value_offset = AlignUp(16, getTypeAlignment(loader, cu_idx, *param0)); // after {_M_next, _M_prev}
+            return makeStringify(DwarfStringify2::StdList, std::move(type_info));
+        }
+
+        bool isMap = (templateName == "map" || templateName == "multimap");
+        bool isSet = (templateName == "set" || templateName == "multiset");
+        bool isUnorderedMap = (templateName == "unordered_map" || templateName == "unordered_multimap");
+        bool isUnorderedSet = (templateName == "unordered_set" || templateName == "unordered_multiset");
+        if (isMap || isSet || isUnorderedMap || isUnorderedSet)
+        {
+            std::optional<uint64_t> elemType = (isMap || isUnorderedMap) ? getMemberTypedef(die, "value_type") : param0;
+            std::optional<MemberLocation> head, count;
+            if (isMap || isSet)
+            {
+                head = member({"_M_t", "_M_impl", "_M_header"});
+                count = member({"_M_t", "_M_impl", "_M_node_count"});
+
+                // StdRbTree follows the links of _Rb_tree_node_base at fixed offsets
+                auto parent = member({"_M_t", "_M_impl", "_M_header", "_M_parent"});
+                auto left = member({"_M_t", "_M_impl", "_M_header", "_M_left"});
+                auto right = member({"_M_t", "_M_impl", "_M_header", "_M_right"});
+                if (!head || !parent || !left || !right || parent->offset != head->offset + 8
+                    || left->offset != head->offset + 16 || right->offset != head->offset + 24) return std::nullopt;
+            }
+            else
+            {
+                head = member({"_M_h", "_M_before_begin"});
+                count = member({"_M_h", "_M_element_count"});
+            }
+            if (!elemType || !head || !count) return std::nullopt;
+            std::optional<uint64_t> elemSize = getTypeByteSize(loader, cu_idx, *elemType);
+            if (!elemSize) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::NodeContainerTypeInfo>();
+            type_info->elem = loadStringify(loader, cu_idx, *elemType);
+            type_info->elem_size = *elemSize;
+            type_info->head_offset = head->offset;
+            type_info->count_offset = count->offset;
+            // Tree nodes start with {_M_color, _M_parent, _M_left, _M_right}, hash nodes with {_M_nxt}
+            type_info->node_value_offset = AlignUp((isMap || isSet) ? 32 : 8, getTypeAlignment(loader, cu_idx, *elemType));
+            return makeStringify((isMap || isSet) ? DwarfStringify2::StdRbTree : DwarfStringify2::StdHashtable, std::move(type_info));
+        }
+
+        if (templateName == "optional" && param0)
+        {
+            auto value = member({"_M_payload", "_M_payload"}, {"__val_"});
+            auto engaged = member({"_M_payload", "_M_engaged"}, {"__engaged_"});
+            if (!value || !engaged) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::OptionalTypeInfo>();
+            type_info->value = loadStringify(loader, cu_idx, *param0);
+            type_info->value_offset = value->offset;
+            type_info->engaged_offset = engaged->offset;
+            return makeStringify(DwarfStringify2::StdOptional, std::move(type_info));
+        }
+
+        if ((templateName == "unique_ptr" || templateName == "shared_ptr") && param0)
+        {
+            if (resolveTypeDie(loader, cu_idx, *param0).tag() == DwarfTag::ArrayType)
+            {
+                return std::nullopt; // Number of elements is not known
+            }
+
+            std::optional<MemberLocation> ptr;
+            if (templateName == "shared_ptr")
+            {
+                ptr = member({"_M_ptr"}, {"__ptr_"});
+            }
+            else if (die.getUnsigned(DwarfAttr::ByteSize) == 8)
+            {
+                ptr = MemberLocation{0, 0}; // Stateless deleter, only the pointer is stored
+            }
+            if (!ptr) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::SmartPtrTypeInfo>();
+            type_info->pointee = loadStringify(loader, cu_idx, *param0);
+            type_info->pointee_size = getTypeByteSize(loader, cu_idx, *param0).value_or(0);
+            type_info->ptr_offset = ptr->offset;
+            return makeStringify(DwarfStringify2::StdSmartPtr, std::move(type_info));
+        }
+
+        if (templateName == "array")
+        {
+            // Print the elements directly instead of a struct with an `_M_elems` member
+            auto elems = member({"_M_elems"}, {"__elems_"});
+            if (!elems || elems->offset != 0 || resolveTypeDie(loader, cu_idx, elems->typeDieOffset).tag() != DwarfTag::ArrayType) return std::nullopt;
+
+            return loadStringify(loader, cu_idx, elems->typeDieOffset);
+        }
+
+        if (templateName == "pair")
+        {
+            auto first = member({"first"});
+            auto second = member({"second"});
+            if (!first || !second) return std::nullopt;
+
+            auto type_info = std::make_unique<DwarfStringify2::PairTypeInfo>();
+            type_info->first = loadStringify(loader, cu_idx, first->typeDieOffset);
+            type_info->first_offset = first->offset;
+            type_info->second = loadStringify(loader, cu_idx, second->typeDieOffset);
+            type_info->second_offset = second->offset;
+            return makeStringify(DwarfStringify2::StdPair, std::move(type_info));
+        }
+
+        return std::nullopt;
+    }
+
+    std::optional<StringifyFuncAndTypeInfo> loadArrayStringify(DebugDataLoader &loader, size_t cu_idx, DIEAccessor die)
+    {
+        uint64_t elemTypeDieOffset = die.getOffset(DwarfAttr::Type).value();
+        std::optional<std::vector<size_t>> dims = getArrayDims(die);
+        std::optional<uint64_t> elemSize = getTypeByteSize(loader, cu_idx, elemTypeDieOffset);
+        if (!dims || !elemSize)
+        {
+            return std::nullopt;
+        }
+
+        // Build from the innermost dimension outwards, each level is an array of the previous one
+        StringifyFuncAndTypeInfo res = loadStringify(loader, cu_idx, elemTypeDieOffset);
+        size_t size = *elemSize;
+        bool isText = isCharType(loader, cu_idx, elemTypeDieOffset);
+        for (auto dim = dims->rbegin(); dim != dims->rend(); ++dim)
+        {
+            auto type_info = std::make_unique<DwarfStringify2::ArrayTypeInfo>();
+            type_info->elem = res;
+            type_info->elem_size = size;
+            type_info->count = *dim;
+            res = makeStringify(isText ? DwarfStringify2::CharArray : DwarfStringify2::Array, std::move(type_info));
+
+            size *= *dim;
+            isText = false;
+        }
+        return res;
+    }
+
+    StringifyFuncAndTypeInfo loadBaseStringify(DIEAccessor die)
+    {
+        StringifyFuncAndTypeInfo res = {};
+
+        uint64_t encoding = die.getUnsigned(DwarfAttr::Encoding).value();
+        uint64_t byteSize = die.getUnsigned(DwarfAttr::ByteSize).value();
+
+        switch (encoding)
+        {
+        case 2: // boolean
+            if (byteSize == 1)  { res.func = DwarfStringify2::Bool;                return res; }
+            break;
+        case 4: // float
+            if (byteSize == 4)  { res.func = DwarfStringify2::Number<float>;       return res; }
+            if (byteSize == 8)  { res.func = DwarfStringify2::Number<double>;      return res; }
+            if (byteSize == 16) { res.func = DwarfStringify2::Number<long double>; return res; }
+            break;
+        case 5: // signed
+        case 6: // signed char
+            if (byteSize == 1)  { res.func = DwarfStringify2::Number<int8_t>;      return res; }
+            if (byteSize == 2)  { res.func = DwarfStringify2::Number<int16_t>;     return res; }
+            if (byteSize == 4)  { res.func = DwarfStringify2::Number<int32_t>;     return res; }
+            if (byteSize == 8)  { res.func = DwarfStringify2::Number<int64_t>;     return res; }
+            break;
+        case 7: // unsigned
+        case 8: // unsigned char
+            if (byteSize == 1)  { res.func = DwarfStringify2::Number<uint8_t>;     return res; }
+            if (byteSize == 2)  { res.func = DwarfStringify2::Number<uint16_t>;    return res; }
+            if (byteSize == 4)  { res.func = DwarfStringify2::Number<uint32_t>;    return res; }
+            if (byteSize == 8)  { res.func = DwarfStringify2::Number<uint64_t>;    return res; }
+            break;
+        case 16: // DW_ATE_UTF
+            if (byteSize == 1)  { res.func = DwarfStringify2::Number<uint8_t>;     return res; }
+            if (byteSize == 2)  { res.func = DwarfStringify2::Number<uint16_t>;    return res; }
+            if (byteSize == 4)  { res.func = DwarfStringify2::Number<uint32_t>;    return res; }
+            break;
+        }
+
+        std::stringstream ss;
+        ss << "encoding=" << encoding << ", byteSize=" << byteSize << " type=" << die.getCStringView(DwarfAttr::Name).value();
+        if (!_quiet)
+        {
+            std::cerr << ss.str() << "\n";
+        }
+        _errors.push_back(ss.str());
+        ++_unsupported;
+
+        res.func = DwarfStringify2::Unknown;
+        res.type_info = nullptr;
+        return res;
+    }
+
+    StringifyFuncAndTypeInfo loadStringify(DebugDataLoader &loader, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        DwarfLocation loc(cu_idx, typeDieOffset);
+        if (auto it = stringifiers.find(loc); it != stringifiers.end()) {
+            ++_cache_hits;
+            return it->second;
+        }
+        ++_resolved;
+
+        DIEAccessor acc = loader.loadCompilationUnitDie(cu_idx, typeDieOffset);
+        std::optional<StringifyFuncAndTypeInfo> res;
+        switch (acc.tag())
+        {
+        case DwarfTag::EnumerationType:
+        {
+            // GCC has encoding/byteSize in enum type, but clang only has them on linked primitive
+            DIEAccessor primitiveDie = loader.loadCompilationUnitDie(cu_idx, acc.getOffset(DwarfAttr::Type).value());
+
+            // TODO extract this typedef following logic to a function
+            while (primitiveDie.tag() == DwarfTag::Typedef)
+            {
+                primitiveDie = loader.loadCompilationUnitDie(cu_idx, primitiveDie.getOffset(DwarfAttr::Type).value());
+            }
+
+            uint64_t encoding = primitiveDie.getUnsigned(DwarfAttr::Encoding).value();
+            uint64_t byteSize = primitiveDie.getUnsigned(DwarfAttr::ByteSize).value();
+
+            // GCC uses encoding=5,7, clang uses 6,8
+            bool signed_ = (encoding == 5 || encoding == 6);
+            bool unsigned_ = (encoding == 7 || encoding == 8);
+            if (signed_   && byteSize == 1) { res = loadEnumStringify<int8_t  >(acc); break; }
+            if (signed_   && byteSize == 2) { res = loadEnumStringify<int16_t >(acc); break; }
+            if (signed_   && byteSize == 4) { res = loadEnumStringify<int32_t >(acc); break; }
+            if (signed_   && byteSize == 8) { res = loadEnumStringify<int64_t >(acc); break; }
+            if (unsigned_ && byteSize == 1) { res = loadEnumStringify<uint8_t >(acc); break; }
+            if (unsigned_ && byteSize == 2) { res = loadEnumStringify<uint16_t>(acc); break; }
+            if (unsigned_ && byteSize == 4) { res = loadEnumStringify<uint32_t>(acc); break; }
+            if (unsigned_ && byteSize == 8) { res = loadEnumStringify<uint64_t>(acc); break; }
+            break;
+        }
+        case DwarfTag::StructureType:
+        case DwarfTag::ClassType:
+        {
+            res = loadStdStringify(loader, cu_idx, acc);
+            if (!res)
+            {
+                res = loadStructStringify(loader, cu_idx, acc, loc);
+            }
+            break;
+        }
+        case DwarfTag::BaseType:
+        {
+            res = loadBaseStringify(acc);
+            break;
+        }
+        case DwarfTag::Typedef:
+        case DwarfTag::ConstType:
+        case DwarfTag::VolatileType:
+        {
+            res = loadStringify(loader, cu_idx, acc.getOffset(DwarfAttr::Type).value());
+            break;
+        }
+        case DwarfTag::ArrayType:
+        {
+            res = loadArrayStringify(loader, cu_idx, acc);
+            break;
+        }
+        case DwarfTag::PointerType:
+        {
+            // TODO function ptrs?
+            if (std::optional<uint64_t> pointeeOffset = acc.getOffset(DwarfAttr::Type); pointeeOffset && isCharType(loader, cu_idx, *pointeeOffset))
+            {
+                res = StringifyFuncAndTypeInfo{DwarfStringify2::CString, nullptr};
+                break;
+            }
+
+            res = StringifyFuncAndTypeInfo{DwarfStringify2::Pointer, nullptr};
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (!res) {
+            std::stringstream ss;
+            ss << "Can't stringify type at 0x" << std::hex << typeDieOffset << std::dec << " " << acc.tag();
+            if (!_quiet)
+            {
+                std::cerr << ss.str() << "\n";
+            }
+            _errors.push_back(ss.str());
+            ++_unsupported;
+            res = StringifyFuncAndTypeInfo{DwarfStringify2::Unknown, nullptr};
+        }
+
+        res->type_die = loader._compilation_units[cu_idx]._offset + typeDieOffset;
+        stringifiers[loc] = *res;
+        return *res;
+    }
+
+    // Address of a well known global variable, compared to its location in the debug data to find the offset of
+    // all global variables. This makes it work with PIE.
+    static uint64_t markerAddress()
+    {
+        static volatile bool librepr_global_offset_marker__;
+        return reinterpret_cast<uint64_t>(&librepr_global_offset_marker__);
+    }
+
+    // Location of the marker in the debug data
+    static uint64_t findMarkerLocation(DebugDataLoader &loader)
+    {
+        for (size_t i = 0; i < loader.num_compilation_units(); ++i)
+        {
+            for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
+            {
+                if (acc.tag() == DwarfTag::Variable)
+                {
+                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_global_offset_marker__")
+                    {
+                        return acc.getOffset(DwarfAttr::Location).value();
+                    }
+                }
+            }
+        }
+
+        // TODO fallback, not fail
+        throw std::runtime_error("Unable to find librepr_global_offset_marker__, did you enable debug data?");
+    }
+
+    uint64_t findGlobalOffset(DebugDataLoader &loader)
+    {
+        return markerAddress() - findMarkerLocation(loader);
+    }
+
+    // Calls `fn(cu_idx, typeDieOffset, typeHash, fntiLocation)` for each instantiation of GetBoundStringifier, with
+    // the type it's instantiated with, its TypeHash and the address of its stringifier in the debug data
+    template <typename Fn>
+    static void forEachCallsite(DebugDataLoader &loader, Fn &&fn)
+    {
+        for (size_t i = 0; i < loader.num_compilation_units(); ++i)
+        {
+            std::optional<DIEAccessor> ttypeDie, fnVarDie;
+            uint64_t typeHash = 0;
+            auto check = [&]()
+            {
+                if (ttypeDie && fnVarDie)
+                {
+                    fn(i, ttypeDie->getOffset(DwarfAttr::Type).value(), typeHash, fnVarDie->getOffset(DwarfAttr::Location).value());
+
+                    ttypeDie.reset();
+                    fnVarDie.reset();
+                }
+            };
+
+            for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
+            {
+                switch (acc.tag())
+                {
+                case DwarfTag::Subprogram:
+                    ttypeDie.reset();
+                    fnVarDie.reset();
+                    typeHash = 0;
+                    break;
+                case DwarfTag::TemplateTypeParameter:
+                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_T__")
+                    {
+                        ttypeDie = acc;
+                        check();
+                    }
+                    break;
+                case DwarfTag::TemplateValueParameter:
+                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_H__")
+                    {
+                        typeHash = acc.getUnsigned(DwarfAttr::ConstValue).value_or(0);
+                    }
+                    break;
+                case DwarfTag::Variable:
+                {
+                    if (acc.getCStringView(DwarfAttr::Name) == "librepr_stringify_fnti__")
+                    {
+                        fnVarDie = acc;
+                        check();
+                    }
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    // Reads the vtables from the symbol table, and finds the definition of each one's type by its qualified name
+    void loadVtables(DebugDataLoader &loader)
+    {
+        _vtables_loaded = true;
+
+        const RawDwarfData &rdd = loader.rdd;
+        const Elf64_Sym *syms = reinterpret_cast<const Elf64_Sym*>(rdd.symtab.data());
+        for (size_t i = 0; i < rdd.symtab.size() / sizeof(Elf64_Sym); ++i)
+        {
+            const Elf64_Sym &sym = syms[i];
+            if (sym.st_name >= rdd.strtab.size() || sym.st_shndx == SHN_UNDEF || sym.st_size == 0)
+            {
+                continue;
+            }
+
+            const char *name = reinterpret_cast<const char*>(rdd.strtab.data()) + sym.st_name;
+            if (strncmp(name, "_ZTV", 4) != 0)
+            {
+                continue;
+            }
+
+            // The rest of the name is the mangled type
+            int status;
+            char *demangled = abi::__cxa_demangle(name + 4, nullptr, nullptr, &status);
+            if (status == 0)
+            {
+                _vtables.push_back({sym.st_value, sym.st_value + sym.st_size, demangled});
+            }
+            free(demangled);
+        }
+        std::sort(_vtables.begin(), _vtables.end(), [](const VtableSymbol &a, const VtableSymbol &b) { return a.begin < b.begin; });
+
+        std::set<std::string_view> wanted;
+        for (const VtableSymbol &vtable : _vtables)
+        {
+            wanted.insert(vtable.type_name);
+        }
+        if (wanted.empty())
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < loader.num_compilation_units(); ++i)
+        {
+            // Qualified name of each enclosing DIE. DIEs which aren't scopes (e.g. functions) get a name no type
+            // matches, local classes aren't looked up.
+            std::vector<std::string> scopes;
+            for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
+            {
+                DwarfTag tag = acc.tag();
+                if (tag == DwarfTag::None)
+                {
+                    if (!scopes.empty())
+                    {
+                        scopes.pop_back();
+                    }
+                    continue;
+                }
+
+                std::string name = "?";
+                if (tag == DwarfTag::CompileUnit)
+                {
+                    name.clear();
+                }
+                else if (tag == DwarfTag::Namespace || tag == DwarfTag::StructureType || tag == DwarfTag::ClassType || tag == DwarfTag::UnionType)
+                {
+                    name = scopes.empty() || scopes.back().empty() ? "" : scopes.back() + "::";
+                    name += acc.getCStringView(DwarfAttr::Name).value_or("(anonymous namespace)");
+
+                    if (tag != DwarfTag::Namespace && !acc.has(DwarfAttr::Declaration) && wanted.count(name))
+                    {
+                        _class_dies.emplace(name, DwarfLocation(i, acc._offset - acc._cu->_offset));
+                    }
+                }
+
+                if (acc.has_children())
+                {
+                    scopes.push_back(std::move(name));
+                }
+            }
+        }
+    }
+
+    // Stringifier of the dynamic type whose vtable contains the link time address `vptr`, if it's in the debug data
+    // Types of unknown size are left out, objects of them couldn't be copied
+    std::optional<DynamicType> loadDynamicStringify(DebugDataLoader &loader, uint64_t vptr)
+    {
+        if (!_vtables_loaded)
+        {
+            loadVtables(loader);
+        }
+
+        auto it = std::upper_bound(_vtables.begin(), _vtables.end(), vptr, [](uint64_t addr, const VtableSymbol &vtable) { return addr < vtable.begin; });
+        if (it == _vtables.begin() || vptr >= (--it)->end)
+        {
+            return std::nullopt;
+        }
+
+        auto die = _class_dies.find(it->type_name);
+        if (die == _class_dies.end())
+        {
+            return std::nullopt;
+        }
+        std::optional<uint64_t> size = getTypeByteSize(loader, die->second.first, die->second.second);
+        if (!size)
+        {
+            return std::nullopt;
+        }
+        return DynamicType{loadStringify(loader, die->second.first, die->second.second), *size};
+    }
+
+    void run(DebugDataLoader &loader)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t globalOffset = findGlobalOffset(loader);
+        _find_global_offset_time = std::chrono::steady_clock::now() - start;
+        _global_offset = globalOffset;
+
+        forEachCallsite(loader, [&](size_t cu_idx, uint64_t typeDieOffset, uint64_t, uint64_t fntiLocation)
+        {
+            StringifyFuncAndTypeInfo *fnti = (StringifyFuncAndTypeInfo*)(globalOffset + fntiLocation);
+            PublishStringifier(fnti, loadStringify(loader, cu_idx, typeDieOffset));
+            _callsites.push_back(fntiLocation);
+        });
+    }
+
+    // Heap memory held by the stringifiers, approximately
+    size_t memoryUsage() const
+    {
+        using S = DwarfStringify2;
+        auto str = [](const std::pmr::string &text) { return text.capacity() > 15 ? text.capacity() + 1 : 0; };
+
+        // Typedefs share the type info of the type they name
+        std::set<const void*> seen;
+        size_t res = stringifiers.size() * (sizeof(decltype(stringifiers)::value_type) + 4 * sizeof(void*));
+        for (const auto &[loc, fnti] : stringifiers)
+        {
+            if (!fnti.type_info || !seen.insert(fnti.type_info).second)
+            {
+                continue;
+            }
+
+            StringifyFunc func = fnti.func;
+            if (func == S::Struct)
+            {
+                const auto *ti = reinterpret_cast<const S::StructTypeInfo*>(fnti.type_info);
+                res += sizeof(*ti) + ti->members.capacity() * sizeof(ti->members[0]) + ti->runs.capacity() * sizeof(S::StructTypeInfo::DataRun)
+                    + ti->bases.capacity() * sizeof(S::StructTypeInfo::BaseInfo);
+                for (const auto &m : ti->members)
+                {
+                    for (const auto &key : m.keys)
+                    {
+                        res += str(key);
+                    }
+                }
+            }
+            else if (func == S::Array || func == S::CharArray) res += sizeof(S::ArrayTypeInfo);
+            else if (func == S::StdVector) res += sizeof(S::VectorTypeInfo);
+            else if (func == S::StdBitVector) res += sizeof(S::BitVectorTypeInfo);
+            else if (func == S::StdString) res += sizeof(S::StringTypeInfo);
+            else if (func == S::StdList || func == S::StdRbTree || func == S::StdHashtable) res += sizeof(S::NodeContainerTypeInfo);
+            else if (func == S::StdOptional) res += sizeof(S::OptionalTypeInfo);
+            else if (func == S::StdSmartPtr) res += sizeof(S::SmartPtrTypeInfo);
+            else if (func == S::StdPair) res += sizeof(S::PairTypeInfo);
+            else res += enumMemoryUsage<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(fnti);
+        }
+        return res;
+    }
+
+    template <typename... Ts>
+    static size_t enumMemoryUsage(const StringifyFuncAndTypeInfo &fnti)
+    {
+        size_t res = 0;
+        ((fnti.func == DwarfStringify2::EnumClass<Ts> ? (res = enumMemoryUsageOf<Ts>(fnti), true) : false) || ...);
+        return res;
+    }
+
+    template <typename T>
+    static size_t enumMemoryUsageOf(const StringifyFuncAndTypeInfo &fnti)
+    {
+        const auto *ti = reinterpret_cast<const DwarfStringify2::EnumClassTypeInfo<T>*>(fnti.type_info);
+        size_t res = sizeof(*ti) + ti->valueToText.bucket_count() * sizeof(void*);
+        for (const auto &[value, text] : ti->valueToText)
+        {
+            res += sizeof(value) + sizeof(text) + sizeof(void*);
+            for (const auto &t : text)
+            {
+                res += t.capacity() > 15 ? t.capacity() + 1 : 0;
+            }
+        }
+        return res;
+    }
+
+    // State of InitializeStringifier. Not function statics, so that they outlive the thread of Preload at exit, and so
+    // that fork handlers can reach them.
+    static inline std::mutex gMut;
+    static inline std::shared_ptr<DebugDataLoader> gLoader;
+    static inline std::shared_ptr<LibReprGlobalCache> gCache;
+    static inline bool gLoadFailed = false;
+
+    // Layouts of the bound stringifiers after ShareLayouts, guarded by gMut
+    static inline SharedArena gSharedLayouts;
+    static inline bool gLayoutsShared = false;
+
+    // Stringifiers of dynamic types by vptr, func is null for unknown ones. Guarded by gDynamicMut, which is taken after
+    // gMut when both are needed, so that lookups of known types don't wait for loading. Entries are never removed.
+    static inline std::shared_mutex gDynamicMut;
+    static inline std::unordered_map<const void*, DynamicType> gDynamicStringifiers;
+
+    // State of Preload
+    static inline std::mutex gPreloadMut;
+    static inline std::thread *gPreloadThread = nullptr;
+
+    // Loads debug data of the running executable and binds all stringifiers, only the first call does the work.
+    // Stringifiers which can't be bound print "???". `fnti` may be null to only load.
+    static
+    void InitializeStringifier(StringifyFuncAndTypeInfo *fnti)
+    {
+        RegisterForkHandlers();
+
+        std::lock_guard<std::mutex> guard(gMut);
+        if (!gLoader)
+        {
+            if (getenv("LIBREPR_STATS"))
+            {
+                std::atexit([]() { std::cerr << CurrentStats(); });
+            }
+
+            gLoader = std::make_shared<DebugDataLoader>();
+            gLoader->loadFile("/proc/self/exe", true);
+            gBuildIdHash.store(gLoader->rdd.buildIdHash(), std::memory_order_relaxed);
+            gCache = std::make_shared<LibReprGlobalCache>();
+            gLoadFailed = !gLoader->_error.empty();
+
+            std::string error;
+            uint64_t numLayouts = 0;
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                if (!gLoader->rdd.layouts.empty())
+                {
+                    numLayouts = LayoutTable::Bind(gLoader->rdd.layouts, gLoader->rdd.buildIdHash(), markerAddress());
+                }
+                else if (!gLoadFailed)
+                {
+                    gCache->run(*gLoader);
+                }
+            }
+            catch (const std::runtime_error &err)
+            {
+                std::cerr << err.what() << "\n";
+                std::cerr << "librepr: Error binding stringifiers. Values will not be pretty printed.\n";
+                error = err.what();
+                gLoadFailed = true;
+            }
+            auto bindTime = std::chrono::steady_clock::now() - start - gCache->_find_global_offset_time;
+
+            std::lock_guard<std::mutex> statsGuard(gStatsMut);
+            gStats.load_elf = gLoader->_load_elf_time;
+            gStats.parse_abbrev = gLoader->_parse_abbrev_time;
+            gStats.find_global_offset = gCache->_find_global_offset_time;
+            gStats.bind = bindTime;
+            gStats.compilation_units = gLoader->num_compilation_units();
+            gStats.dies_visited = gLoader->_dies_loaded;
+            gStats.debug_info_bytes = gLoader->_die_bytes_loaded;
+            gStats.stringifiers_resolved = gCache->_resolved + numLayouts;
+            gStats.stringifier_cache_hits = gCache->_cache_hits;
+            gStats.loader_bytes = gLoader->memoryUsage();
+            gStats.registry_bytes = gCache->memoryUsage();
+            gStats.fallbacks[static_cast<size_t>(FallbackReason::UnsupportedType)] = gCache->_unsupported;
+            for (const std::string &err : {gLoader->_error, error})
+            {
+                if (!err.empty())
+                {
+                    gStats.errors.push_back(err);
+                }
+            }
+            gStats.errors.insert(gStats.errors.end(), gCache->_errors.begin(), gCache->_errors.end());
+        }
+
+        if (fnti && LoadBoundFunc(*fnti) == InitializeAll)
+        {
+            // TODO implement fallback printers?
+            PublishStringifier(fnti, {DwarfStringify2::Unknown, nullptr});
+
+            std::lock_guard<std::mutex> statsGuard(gStatsMut);
+            ++gStats.fallbacks[static_cast<size_t>(gLoadFailed ? FallbackReason::NoDebugData : FallbackReason::NotInDebugData)];
+        }
+    }
+
+    // Binds `fnti` to Unknown without loading anything if the executable has no debug data at all, as found by
+    // RawDwarfData::HasDebugData once. Returns whether it did. Types StaticReflection prints take this path, so that a
+    // build without -g neither pays for the load nor prints its errors.
+    static
+    bool BindWithoutDebugData(StringifyFuncAndTypeInfo *fnti)
+    {
+        static const bool absent = !RawDwarfData::HasDebugData("/proc/self/exe");
+        if (!absent)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> guard(gMut);
+        if (LoadBoundFunc(*fnti) == InitializeAll)
+        {
+            PublishStringifier(fnti, {DwarfStringify2::Unknown, nullptr});
+            std::lock_guard<std::mutex> statsGuard(gStatsMut);
+            ++gStats.fallbacks[static_cast<size_t>(FallbackReason::NoDebugData)];
+        }
+        return true;
+    }
+
+    // Loads and binds all stringifiers, then binds them again to copies of their layouts in shared memory, so that
+    // processes forked afterwards all read the same pages. The copies are made through a LayoutTable, the .librepr
+    // section if there is one. Previous layouts stay valid for threads still printing with them. Only the first call
+    // does the work.
+    static
+    void ShareLayouts()
+    {
+        InitializeStringifier(nullptr);
+
+        std::lock_guard<std::mutex> guard(gMut);
+        if (gLayoutsShared || gLoadFailed)
+        {
+            return;
+        }
+        gLayoutsShared = true;
+
+        std::string table;
+        if (!gLoader->rdd.layouts.empty())
+        {
+            table.assign(reinterpret_cast<const char*>(gLoader->rdd.layouts.data()), gLoader->rdd.layouts.size());
+        }
+        else
+        {
+            LayoutTable::Writer writer;
+            for (uint64_t location : gCache->_callsites)
+            {
+                const auto *fnti = reinterpret_cast<const StringifyFuncAndTypeInfo*>(gCache->_global_offset + location);
+                writer.bind(location, writer.add(*fnti));
+            }
+            table = writer.write(0, markerAddress() - gCache->_global_offset);
+        }
+
+        try
+        {
+            // Member and enum names point into the table, so it's kept in the arena too
+            auto *copy = static_cast<uint8_t*>(gSharedLayouts.allocate(table.size(), 8));
+            memcpy(copy, table.data(), table.size());
+            LayoutTable::Bind(Buffer(copy, table.size()), 0, markerAddress(), &gSharedLayouts);
+        }
+        catch (const std::exception &err)
+        {
+            // The stringifiers bound so far work as well as the previous ones
+            std::cerr << "librepr: Can't move layouts into shared memory: " << err.what() << "\n";
+        }
+        gSharedLayouts.protect();
+
+        std::lock_guard<std::mutex> statsGuard(gStatsMut);
+        gStats.shared_layout_bytes = gSharedLayouts.size();
+    }
+
+    // Stringifier of the dynamic type of a polymorphic object, by its vptr. Its func is null if the type isn't known,
+    // e.g. without a symbol table. Only the first lookup of each vptr reads the debug data. The result stays valid.
+    static
+    const DynamicType& DynamicStringifier(const void *vptr)
+    {
+        {
+            std::shared_lock<std::shared_mutex> guard(gDynamicMut);
+            if (auto it = gDynamicStringifiers.find(vptr); it != gDynamicStringifiers.end())
+            {
+                return it->second;
+            }
+        }
+
+        InitializeStringifier(nullptr);
+
+        std::lock_guard<std::mutex> guard(gMut);
+        {
+            // Another thread may have loaded it meanwhile
+            std::shared_lock<std::shared_mutex> dynamicGuard(gDynamicMut);
+            if (auto it = gDynamicStringifiers.find(vptr); it != gDynamicStringifiers.end())
+            {
+                return it->second;
+            }
+        }
+
+        DynamicType res = {};
+        if (!gLoadFailed)
+        {
+            try
+            {
+                uint64_t linkAddress = reinterpret_cast<uint64_t>(vptr) - gCache->_global_offset;
+                res = gCache->loadDynamicStringify(*gLoader, linkAddress).value_or(res);
+            }
+            catch (const std::runtime_error &err)
+            {
+                std::cerr << "librepr: Error loading dynamic type: " << err.what() << "\n";
+            }
+        }
+        std::lock_guard<std::shared_mutex> dynamicGuard(gDynamicMut);
+        return gDynamicStringifiers[vptr] = res;
+    }
+
+    // Starts InitializeStringifier on a background thread, later calls return the same future
+    static
+    std::shared_future<void> Preload(std::chrono::nanoseconds maxWait)
+    {
+        RegisterForkHandlers();
+
+        // Joined at exit, before the state it uses is destroyed
+        static struct PreloadJoiner
+        {
+            ~PreloadJoiner()
+            {
+                if (gPreloadThread)
+                {
+                    gPreloadThread->join();
+                    delete gPreloadThread;
+                }
+            }
+        } gJoiner;
+
+        std::lock_guard<std::mutex> guard(gPreloadMut);
+        gPreloadMaxWait.store(maxWait.count(), std::memory_order_relaxed);
+        if (!gPreloadFuture.valid())
+        {
+            LayoutTable::Kinds(); // Also used by the thread, constructed first so that it's destroyed after it
+            std::promise<void> promise;
+            gPreloadFuture = promise.get_future().share();
+            gPreloading.store(true, std::memory_order_release);
+            gPreloadThread = new std::thread([promise = std::move(promise)]() mutable
+            {
+                try
+                {
+                    InitializeStringifier(nullptr);
+                    promise.set_value();
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+                gPreloading.store(false, std::memory_order_release);
+            });
+        }
+        return gPreloadFuture;
+    }
+
+    // Keeps the locks above consistent across fork(). A child doesn't inherit the preload thread: it either finished
+    // binding before the fork (which waits for gMut) or the child loads the debug data itself.
+    static
+    void RegisterForkHandlers()
+    {
+        static const bool registered = []()
+        {
+            pthread_atfork(
+                []() { gPreloadMut.lock(); gMut.lock(); gDynamicMut.lock(); gStatsMut.lock(); },
+                []() { gStatsMut.unlock(); gDynamicMut.unlock(); gMut.unlock(); gPreloadMut.unlock(); },
+                []()
+                {
+                    gPreloadThread = nullptr;
+                    gPreloadFuture = {};
+                    gPreloading.store(false, std::memory_order_relaxed);
+                    gStatsMut.unlock();
+                    gDynamicMut.unlock();
+                    gMut.unlock();
+                    gPreloadMut.unlock();
+                });
+            return true;
+        }();
+        (void)registered;
+    }
+
+    // Whether stringifiers can be bound without waiting longer than PreloadOptions::max_wait for a running preload
+    static
+    bool PreloadReady()
+    {
+        if (!gPreloading.load(std::memory_order_acquire))
+        {
+            return true;
+        }
+        auto maxWait = std::chrono::nanoseconds(gPreloadMaxWait.load(std::memory_order_relaxed));
+        return maxWait.count() > 0 && gPreloadFuture.wait_for(maxWait) == std::future_status::ready;
+    }
+
+    static
+    void InitializeAll(PrintContext &ctx, void *type_info, const void *obj)
+    {
+        StringifyFuncAndTypeInfo *fnti = reinterpret_cast<StringifyFuncAndTypeInfo*>(type_info);
+
+        InitializeStringifier(fnti);
+        fnti->func(ctx, fnti->type_info, obj);
+    }
+};
+
+// Holds `Mut` across fork() so that a child doesn't inherit it locked by a thread it doesn't have, for locks outside of
+// LibReprGlobalCache. Cheap to call once it's registered.
+template <std::mutex &Mut>
+inline
+void HoldAcrossFork()
+{
+    static const bool registered = []()
+    {
+        pthread_atfork([]() { Mut.lock(); }, []() { Mut.unlock(); }, []() { Mut.unlock(); });
+        return true;
+    }();
+    (void)registered;
+}
+
+
+
+// The template argument in __PRETTY_FUNCTION__ of a function with a single one, e.g. "shapes::Circle", "Suit::Spades"
+// or "(Suit)7". GCC follows it with "; " and the typedefs in the signature, otherwise it ends at the last ']'.
+constexpr std::string_view TemplateArgument(std::string_view pretty)
+{
+    size_t begin = pretty.find(" = ");
+    if (begin == std::string_view::npos)
+    {
+        return pretty;
+    }
+    begin += 3;
+    size_t end = pretty.find(';', begin);
+    return pretty.substr(begin, (end == std::string_view::npos ? pretty.rfind(']') : end) - begin);
+}
+
+// Spelling of T, e.g. "shapes::Circle". Names types in callsite stats, repr_signal_safe output and StaticReflection,
+// and is what TypeHash hashes.
+template <typename T>
+constexpr std::string_view TypeName()
+{
+    return TemplateArgument(__PRETTY_FUNCTION__);
+}
+
+
+// Printers derived from the type itself at compile time, for types which can't be printed from the debug data (e.g.
+// built without -g). Covers arithmetic types, enums with a fixed underlying type and aggregates of those. Member names
+// aren't known, so aggregates print like arrays, e.g. {1, Suit::Spades}.
+struct StaticReflection
+{
+    static constexpr size_t kMaxMembers = 16;
+    static constexpr int64_t kMinEnumValue = -16; // Enumerators outside [kMinEnumValue, kMaxEnumValue) print as numbers
+    static constexpr int64_t kMaxEnumValue = 128;
+
+    // Initializes any member when braced, for counting members
+    struct AnyMember
+    {
+        template <typename U>
+        operator U() const;
+    };
+
+    // Initializes only arithmetic and enum members. Nested aggregates take one per member through brace elision, so
+    // counting with it gives the same count as AnyMember only if every member is a scalar (or an aggregate of one).
+    struct AnyScalar
+    {
+        template <typename U, typename = std::enable_if_t<std::is_arithmetic_v<U> || std::is_enum_v<U>>>
+        operator U() const;
+    };
+
+    template <typename T, typename Any, typename Indices, typename = void>
+    struct IsInitializable : std::false_type {};
+
+    template <typename T, size_t... I>
+    struct IsInitializable<T, AnyMember, std::index_sequence<I...>, std::void_t<decltype(T{{(I, AnyMember{})}...})>> : std::true_type {};
+
+    template <typename T, size_t... I>
+    struct IsInitializable<T, AnyScalar, std::index_sequence<I...>, std::void_t<decltype(T{(I, AnyScalar{})...})>> : std::true_type {};
+
+    // Number of members of aggregate T, kMaxMembers + 1 if there are more
+    template <typename T, typename Any, size_t N = kMaxMembers + 1>
+    static constexpr size_t CountMembers()
+    {
+        if constexpr (N == 0 || IsInitializable<T, Any, std::make_index_sequence<N>>::value)
+        {
+            return N;
+        }
+        else
+        {
+            return CountMembers<T, Any, N - 1>();
+        }
+    }
+
+    template <typename T, typename = void>
+    struct HasFixedUnderlyingType : std::false_type {};
+
+    template <typename T>
+    struct HasFixedUnderlyingType<T, std::void_t<decltype(T{std::underlying_type_t<T>{}})>> : std::true_type {};
+
+    // Copies of the members of an aggregate with N members, as a tuple
+    template <size_t N, typename T>
+    static auto Members(const T &val)
+    {
+        if constexpr (N == 1) { const auto &[m0] = val; return std::make_tuple(m0); }
+        else if constexpr (N == 2) { const auto &[m0, m1] = val; return std::make_tuple(m0, m1); }
+        else if constexpr (N == 3) { const auto &[m0, m1, m2] = val; return std::make_tuple(m0, m1, m2); }
+        else if constexpr (N == 4) { const auto &[m0, m1, m2, m3] = val; return std::make_tuple(m0, m1, m2, m3); }
+        else if constexpr (N == 5) { const auto &[m0, m1, m2, m3, m4] = val; return std::make_tuple(m0, m1, m2, m3, m4); }
+        else if constexpr (N == 6) { const auto &[m0, m1, m2, m3, m4, m5] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5); }
+        else if constexpr (N == 7) { const auto &[m0, m1, m2, m3, m4, m5, m6] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6); }
+        else if constexpr (N == 8) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7); }
+        else if constexpr (N == 9) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8); }
+        else if constexpr (N == 10) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9); }
+        else if constexpr (N == 11) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10); }
+        else if constexpr (N == 12) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11); }
+        else if constexpr (N == 13) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12); }
+        else if constexpr (N == 14) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13); }
+        else if constexpr (N == 15) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14); }
+        else if constexpr (N == 16) { const auto &[m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15] = val; return std::make_tuple(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15); }
+        else return std::tuple<>();
+    }
+
+    template <typename... Ts>
+    static constexpr bool AllSupported(const std::tuple<Ts...>*)
+    {
+        return (Supported<Ts>() && ...);
+    }
+
+    // Whether T can be printed without debug data. Members are only enumerated once their count is known to be right,
+    // a wrong count would fail to compile.
+    template <typename T>
+    static constexpr bool Supported()
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            return true;
+        }
+        else if constexpr (std::is_enum_v<T>)
+        {
+            return HasFixedUnderlyingType<T>::value;
+        }
+        else if constexpr (std::is_class_v<T> && std::is_aggregate_v<T> && std::is_standard_layout_v<T>)
+        {
+            constexpr size_t n = CountMembers<T, AnyMember>();
+            if constexpr (n > kMaxMembers || n != CountMembers<T, AnyScalar>())
+            {
+                return false;
+            }
+            else
+            {
+                return AllSupported(static_cast<decltype(Members<n>(std::declval<const T&>()))*>(nullptr));
+            }
+        }
+        return false;
+    }
+
+    // Fixed width type with the same size and signedness as arithmetic T, as the debug data would describe it
+    template <typename T>
+    static auto FixedWidth()
+    {
+        if constexpr (std::is_floating_point_v<T> || std::is_same_v<T, bool>) return T{};
+        else if constexpr (sizeof(T) == 1) return std::conditional_t<std::is_signed_v<T>, int8_t, uint8_t>{};
+        else if constexpr (sizeof(T) == 2) return std::conditional_t<std::is_signed_v<T>, int16_t, uint16_t>{};
+        else if constexpr (sizeof(T) == 4) return std::conditional_t<std::is_signed_v<T>, int32_t, uint32_t>{};
+        else return std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>{};
+    }
+
+    // Last component of a qualified name
+    static constexpr std::string_view UnqualifiedName(std::string_view name)
+    {
+        size_t pos = name.rfind("::");
+        return pos == std::string_view::npos ? name : name.substr(pos + 2);
+    }
+
+    template <typename E>
+    static constexpr std::string_view EnumName()
+    {
+        return UnqualifiedName(TypeName<E>());
+    }
+
+    template <auto V>
+    static constexpr std::string_view EnumeratorName()
+    {
+        return TemplateArgument(__PRETTY_FUNCTION__);
+    }
+
+    template <typename E, typename U, int64_t... I>
+    static void AddEnumerators(DwarfStringify2::EnumClassTypeInfo<U> &type_info, std::integer_sequence<int64_t, I...>)
+    {
+        auto add = [&](U value, std::string_view name)
+        {
+            // Values which aren't enumerators are spelled as casts
+            if (!name.empty() && name[0] != '(')
+            {
+                type_info.valueToText.emplace(value, DwarfStringify2::EnumeratorText(type_info.enum_name, UnqualifiedName(name)));
+            }
+        };
+        (add(static_cast<U>(kMinEnumValue + I), EnumeratorName<static_cast<E>(static_cast<U>(kMinEnumValue + I))>()), ...);
+    }
+
+    // Same type info the debug data would give, built on first use
+    template <typename E, typename U = decltype(FixedWidth<std::underlying_type_t<E>>())>
+    static const DwarfStringify2::EnumClassTypeInfo<U>& EnumTypeInfo()
+    {
+        static const std::string name(EnumName<E>());
+        static const DwarfStringify2::EnumClassTypeInfo<U> type_info = []()
+        {
+            DwarfStringify2::EnumClassTypeInfo<U> res;
+            res.enum_name = name.c_str();
+            AddEnumerators<E>(res, std::make_integer_sequence<int64_t, kMaxEnumValue - kMinEnumValue>());
+            return res;
+        }();
+        return type_info;
+    }
+
+    template <typename T>
+    static void Print(PrintContext &ctx, const T &val)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            DwarfStringify2::Bool(ctx, nullptr, &val);
+        }
+        else if constexpr (std::is_arithmetic_v<T>)
+        {
+            DwarfStringify2::Number<decltype(FixedWidth<T>())>(ctx, nullptr, &val);
+        }
+        else if constexpr (std::is_enum_v<T>)
+        {
+            using U = decltype(FixedWidth<std::underlying_type_t<T>>());
+            DwarfStringify2::EnumClass<U>(ctx, const_cast<void*>(static_cast<const void*>(&EnumTypeInfo<T>())), &val);
+        }
+        else
+        {
+            PrintMembers(ctx, Members<CountMembers<T, AnyMember>()>(val));
+        }
+    }
+
+    template <typename... Ts>
+    static void PrintMembers(PrintContext &ctx, const std::tuple<Ts...> &members)
+    {
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(sizeof...(Ts), false);
+        size_t i = 0;
+        std::apply([&](const auto &...m)
+        {
+            [[maybe_unused]] auto printMember = [&](const auto &member)
+            {
+                if (!ctx.beginElement(i)) return false;
+                ctx.separator(i);
+                Print(ctx, member);
+                ++i;
+                return true;
+            };
+            (void)(printMember(m) && ...);
+        }, members);
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+};
+
+// Identifies a type across builds, for matching printers generated by librepr-gen. FNV-1a of TypeName, the generator
+// reads it back from the librepr_H__ parameter of GetBoundStringifier.
+template <typename T>
+constexpr uint64_t TypeHash()
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : TypeName<T>())
+    {
+        hash = (hash ^ (unsigned char)c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Each instantiation owns a stringifier, which is bound to the dwarf type of `librepr_T__` by LibReprGlobalCache::run
+template <typename librepr_T__, uint64_t librepr_H__>
+inline
+StringifyFuncAndTypeInfo& GetBoundStringifier()
+{
+    static StringifyFuncAndTypeInfo librepr_stringify_fnti__ = {
+        LibReprGlobalCache::InitializeAll,
+        reinterpret_cast<void*>(&librepr_stringify_fnti__)
+    };
+    return librepr_stringify_fnti__;
+}
+
+template <typename T>
+inline
+StringifyFuncAndTypeInfo& GetStringifier()
+{
+    return GetBoundStringifier<T, TypeHash<T>()>();
+}
+
+// Specialized by the header librepr-gen writes, for each type it has a printer for
+template <uint64_t TypeHash>
+struct GeneratedStringifier
+{
+    static constexpr bool available = false;
+};
+
+} // namespace librepr::_internal_v3
+
+#ifdef LIBREPR_GENERATED_HEADER
+#include LIBREPR_GENERATED_HEADER
+#endif
+
+namespace librepr::_internal_v3 {
+
+// Whether T has a generated printer, which is used instead of the one bound from debug data. Types whose size changed
+// since the printer was generated are left to the debug data.
+template <typename T>
+constexpr bool HasGeneratedStringifier()
+{
+    using Generated = GeneratedStringifier<TypeHash<T>()>;
+    if constexpr (Generated::available)
+    {
+        return Generated::size == sizeof(T);
+    }
+    return false;
+}
+
+// Stringifier used to print a T
+template <typename T>
+inline
+StringifyFuncAndTypeInfo& GetPrinter()
+{
+    if constexpr (HasGeneratedStringifier<T>())
+    {
+        return GeneratedStringifier<TypeHash<T>()>::fnti;
+    }
+    else
+    {
+        return GetStringifier<T>();
+    }
+}
+
+// What prints an object and the bytes it reads
+struct PrintedObject
+{
+    const StringifyFuncAndTypeInfo *fnti;
+    const void *data;
+    size_t size;
+};
+
+// Objects of polymorphic types are printed as their dynamic type, found from the vtable the object points to, with the
+// complete object. Other objects, those whose dynamic type isn't known and types with a generated printer are printed by
+// `fnti` (the printer of T, bound already).
+template <typename T>
+inline
+PrintedObject ResolvePrintedObject(const StringifyFuncAndTypeInfo &fnti, const T &val)
+{
+    if constexpr (std::is_polymorphic_v<T> && !HasGeneratedStringifier<T>())
+    {
+        const DynamicType &dynamic = LibReprGlobalCache::DynamicStringifier(DwarfStringify2::Load<const void*>(&val, 0));
+        if (dynamic.fnti.func)
+        {
+            return {&dynamic.fnti, dynamic_cast<const void*>(&val), dynamic.size};
+        }
+    }
+    return {&fnti, reinterpret_cast<const void*>(&val), sizeof(T)};
+}
+
+// Prints `val`, generated printers are called directly so that they can be inlined. Types which can't be printed from
+// the debug data use StaticReflection if they can, or always with LIBREPR_PREFER_STATIC_REFLECTION.
+template <typename T>
+inline
+void Stringify(PrintContext &ctx, const T &val)
+{
+#ifdef LIBREPR_PREFER_STATIC_REFLECTION
+    constexpr bool kPreferStatic = true;
+#else
+    constexpr bool kPreferStatic = false;
+#endif
+
+    if constexpr (HasGeneratedStringifier<T>())
+    {
+        GeneratedStringifier<TypeHash<T>()>::print(ctx, nullptr, reinterpret_cast<const void*>(&val));
+    }
+    else if constexpr (kPreferStatic && StaticReflection::Supported<T>())
+    {
+        StaticReflection::Print(ctx, val);
+    }
+    else
+    {
+        StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+        if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+        {
+            if constexpr (StaticReflection::Supported<T>())
+            {
+                if (LibReprGlobalCache::BindWithoutDebugData(&fnti))
+                {
+                    StaticReflection::Print(ctx, val);
+                    return;
+                }
+            }
+            if (!LibReprGlobalCache::PreloadReady())
+            {
+                // Don't block on librepr::preload(), the value is printed properly once it's done
+                DwarfStringify2::RawBytes(ctx, &val, sizeof(T));
+                return;
+            }
+            LibReprGlobalCache::InitializeStringifier(&fnti);
+        }
+
+        if (PrintedObject obj = ResolvePrintedObject(fnti, val); obj.fnti != &fnti)
+        {
+            obj.fnti->func(ctx, obj.fnti->type_info, obj.data);
+            return;
+        }
+
+        if constexpr (StaticReflection::Supported<T>())
+        {
+            if (fnti.func == DwarfStringify2::Unknown)
+            {
+                StaticReflection::Print(ctx, val);
+                return;
+            }
+        }
+        fnti.func(ctx, fnti.type_info, reinterpret_cast<const void*>(&val));
+    }
+}
+
+enum class SpanFormat
+{
+    Rows,    // Member names once as a header, then a line of member values per object, e.g. "id, px\n1, 2.5\n"
+    Csv,     // Same as Rows, as CSV. Strings are written as is, cells with a comma, quote or newline are quoted.
+    Tsv,     // Same as Rows, separated by tabs. Strings are written as is, with tabs, newlines and backslashes escaped.
+    Columns, // A line per member with its values across all objects, e.g. "id: 1, 2\npx: 2.5, 3.5\n"
+};
+
+// Prints spans of objects for librepr::repr_span. Each member is formatted across all objects before the next one,
+// numbers without going through a stream.
+struct SpanPrinter
+{
+    // Text of one member of every object, the cell of object i ends at ends[i]
+    struct Column
+    {
+        std::string_view name;
+        std::string text;
+        std::vector<size_t> ends;
+
+        std::string_view cell(size_t i) const
+        {
+            size_t begin = i ? ends[i - 1] : 0;
+            return std::string_view(text).substr(begin, ends[i] - begin);
+        }
+    };
+
+    template <typename T>
+    static std::string Print(const T *data, size_t count, SpanFormat format)
+    {
+        StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+        if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+        {
+            LibReprGlobalCache::InitializeStringifier(&fnti);
+        }
+
+        bool rawStrings = format == SpanFormat::Csv || format == SpanFormat::Tsv;
+        std::vector<Column> columns;
+        if (fnti.func == DwarfStringify2::Struct)
+        {
+            const auto *type_info = reinterpret_cast<const DwarfStringify2::StructTypeInfo*>(fnti.type_info);
+            columns.resize(type_info->members.size());
+            for (size_t m = 0; m < columns.size(); ++m)
+            {
+                const auto &member = type_info->members[m];
+                columns[m].name = member.name;
+                FormatColumn(columns[m], member.stringifier, reinterpret_cast<const char*>(data) + member.offset, sizeof(T), count, rawStrings);
+            }
+        }
+        else
+        {
+            // Printed whole, through the same path as repr
+            Column &column = columns.emplace_back();
+            column.name = "value";
+            std::stringstream ss;
+            PrintContext ctx(ss);
+            for (size_t i = 0; i < count; ++i)
+            {
+                Stringify(ctx, data[i]);
+                column.ends.push_back(ss.tellp());
+            }
+            column.text = ss.str();
+        }
+
+        return Write(columns, count, format);
+    }
+
+    static void FormatColumn(Column &column, const StringifyFuncAndTypeInfo &fnti, const char *data, size_t stride, size_t count, bool rawStrings)
+    {
+        using S = DwarfStringify2;
+        column.ends.reserve(count);
+
+        if (FormatNumbersIfNumeric<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t, float, double, long double>(column, fnti.func, data, stride, count))
+        {
+            return;
+        }
+
+        if (fnti.func == S::Bool)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                column.text += data[i * stride] ? "true" : "false";
+                column.ends.push_back(column.text.size());
+            }
+            return;
+        }
+
+        if (rawStrings && fnti.func == S::StdString)
+        {
+            const auto *type_info = reinterpret_cast<const S::StringTypeInfo*>(fnti.type_info);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const char *obj = data + i * stride;
+                column.text.append(S::Load<const char*>(obj, type_info->data_offset), S::Load<size_t>(obj, type_info->size_offset));
+                column.ends.push_back(column.text.size());
+            }
+            return;
+        }
+
+        if (rawStrings && fnti.func == S::CharArray)
+        {
+            const auto *type_info = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const char *str = data + i * stride;
+                const char *nul = static_cast<const char*>(memchr(str, 0, type_info->count));
+                column.text.append(str, nul ? nul - str : type_info->count);
+                column.ends.push_back(column.text.size());
+            }
+            return;
+        }
+
+        std::stringstream ss;
+        PrintContext ctx(ss);
+        for (size_t i = 0; i < count; ++i)
+        {
+            fnti.func(ctx, fnti.type_info, data + i * stride);
+            column.ends.push_back(ss.tellp());
+        }
+        column.text = ss.str();
+    }
+
+    template <typename... Ts>
+    static bool FormatNumbersIfNumeric(Column &column, StringifyFunc func, const char *data, size_t stride, size_t count)
+    {
+        return ((func == DwarfStringify2::Number<Ts> ? (FormatNumbers<Ts>(column, data, stride, count), true) : false) || ...);
+    }
+
+    template <typename T>
+    static void FormatNumbers(Column &column, const char *data, size_t stride, size_t count)
+    {
+        column.text.reserve(count * 8);
+        char buf[DwarfStringify2::kMaxNumberLength];
+        for (size_t i = 0; i < count; ++i)
+        {
+            column.text.append(buf, DwarfStringify2::FormatNumber(buf, DwarfStringify2::Load<T>(data, i * stride)) - buf);
+            column.ends.push_back(column.text.size());
+        }
+    }
+
+    static void WriteCell(std::string &out, std::string_view cell, SpanFormat format)
+    {
+        if (format == SpanFormat::Csv && cell.find_first_of(",\"\r\n") != std::string_view::npos)
+        {
+            out += '"';
+            for (char c : cell)
+            {
+                out += c;
+                if (c == '"')
+                {
+                    out += '"';
+                }
+            }
+            out += '"';
+        }
+        else if (format == SpanFormat::Tsv && cell.find_first_of("\t\r\n\\") != std::string_view::npos)
+        {
+            for (char c : cell)
+            {
+                switch (c)
+                {
+                case '\t':  out += "\\t"; break;
+                case '\r':  out += "\\r"; break;
+                case '\n':  out += "\\n"; break;
+                case '\\': out += "\\\\"; break;
+                default:    out += c; break;
+                }
+            }
+        }
+        else
+        {
+            out += cell;
+        }
+    }
+
+    static std::string Write(const std::vector<Column> &columns, size_t count, SpanFormat format)
+    {
+        std::string out;
+        size_t size = 0;
+        for (const Column &column : columns)
+        {
+            size += column.name.size() + column.text.size() + 2 * (count + 1);
+        }
+        out.reserve(size);
+
+        if (format == SpanFormat::Columns)
+        {
+            for (const Column &column : columns)
+            {
+                out += column.name;
+                out += ':';
+                for (size_t i = 0; i < count; ++i)
+                {
+                    out += i ? ", " : " ";
+                    out += column.cell(i);
+                }
+                out += '\n';
+            }
+            return out;
+        }
+
+        const char *separator = format == SpanFormat::Csv ? "," : format == SpanFormat::Tsv ? "\t" : ", ";
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            if (c)
+            {
+                out += separator;
+            }
+            WriteCell(out, columns[c].name, format);
+        }
+        out += '\n';
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (size_t c = 0; c < columns.size(); ++c)
+            {
+                if (c)
+                {
+                    out += separator;
+                }
+                WriteCell(out, columns[c].cell(i), format);
+            }
+            out += '\n';
+        }
+        return out;
+    }
+};
+
+struct FieldProjection;
+
+// Member paths selected by librepr::fields, e.g. ".header.seq" or ".legs[*].px"
+struct FieldSelection
+{
+    std::vector<std::string> paths;
+    std::string key; // Paths joined, identifies the selection in the cache of FieldProjections
+
+    // Projection this selection was last resolved to, found by repr without a lock or a lookup as long as the
+    // selection is used with a single type. Projections are never freed. Copies resolve their own.
+    mutable std::atomic<const FieldProjection*> projection{nullptr};
+
+    FieldSelection() = default;
+
+    FieldSelection(const FieldSelection &other)
+        : paths(other.paths)
+        , key(other.key)
+    {
+    }
+
+    FieldSelection& operator=(const FieldSelection &other)
+    {
+        paths = other.paths;
+        key = other.key;
+        projection.store(nullptr, std::memory_order_relaxed);
+        return *this;
+    }
+};
+
+// A FieldSelection resolved against the stringifier of a type: offsets to follow and the printer of each path's leaf
+struct FieldProjection
+{
+    struct Step
+    {
+        enum class Kind
+        {
+            Offset,      // Member at `offset`
+            ArrayEach,   // Every element of a fixed size array
+            VectorEach,  // Every element of a std::vector
+            ArrayIndex,  // Element `index` of a fixed size array
+            VectorIndex, // Element `index` of a std::vector, if it has one
+        };
+
+        Kind kind;
+        size_t offset = 0; // Kind::Offset
+        size_t index = 0;  // Kind::*Index
+        const DwarfStringify2::ArrayTypeInfo *array = nullptr;
+        const DwarfStringify2::VectorTypeInfo *vector = nullptr;
+    };
+
+    struct Path
+    {
+        std::array<std::string, kNumOutputFormats> key; // Per OutputFormat, e.g. `.header.seq=`
+        std::vector<Step> steps;
+        StringifyFuncAndTypeInfo leaf;
+    };
+
+    const StringifyFuncAndTypeInfo *root = nullptr;
+    std::vector<Path> paths;
+
+    // Paths which don't resolve print "???"
+    static FieldProjection Compile(const StringifyFuncAndTypeInfo &root, const std::vector<std::string> &paths)
+    {
+        using S = DwarfStringify2;
+
+        FieldProjection res;
+        res.root = &root;
+        for (const std::string &text : paths)
+        {
+            Path &path = res.paths.emplace_back();
+            std::string_view name = text;
+            if (!name.empty() && name[0] == '.')
+            {
+                name.remove_prefix(1);
+            }
+            for (OutputFormat format : {OutputFormat::Repr, OutputFormat::Json, OutputFormat::MsgPack})
+            {
+                path.key[static_cast<size_t>(format)] = S::MemberKey(format, name);
+            }
+
+            if (!Resolve(root, text, path))
+            {
+                path.steps.clear();
+                path.leaf = {S::Unknown, nullptr};
+            }
+        }
+        return res;
+    }
+
+    static bool Resolve(StringifyFuncAndTypeInfo fnti, std::string_view text, Path &path)
+    {
+        using S = DwarfStringify2;
+        using Kind = Step::Kind;
+
+        while (!text.empty())
+        {
+            if (text[0] == '.')
+            {
+                size_t end = text.find_first_of(".[", 1);
+                std::string_view name = text.substr(1, end - 1);
+                text.remove_prefix(std::min(end, text.size()));
+
+                if (fnti.func != S::Struct)
+                {
+                    return false;
+                }
+                const auto *type_info = reinterpret_cast<const S::StructTypeInfo*>(fnti.type_info);
+                auto it = std::find_if(type_info->members.begin(), type_info->members.end(), [&](const auto &m) { return name == m.name; });
+                if (it == type_info->members.end())
+                {
+                    return false;
+                }
+
+                // Consecutive members are a single offset
+                if (!path.steps.empty() && path.steps.back().kind == Kind::Offset)
+                {
+                    path.steps.back().offset += it->offset;
+                }
+                else
+                {
+                    Step step{Kind::Offset};
+                    step.offset = it->offset;
+                    path.steps.push_back(step);
+                }
+                fnti = it->stringifier;
+            }
+            else if (text[0] == '[')
+            {
+                size_t end = text.find(']');
+                if (end == std::string_view::npos)
+                {
+                    return false;
+                }
+                std::string_view subscript = text.substr(1, end - 1);
+                text.remove_prefix(end + 1);
+
+                bool each = subscript == "*";
+                Step step{Kind::Offset};
+                if (!each && std::from_chars(subscript.data(), subscript.data() + subscript.size(), step.index).ptr != subscript.data() + subscript.size())
+                {
+                    return false;
+                }
+
+                if (fnti.func == S::Array || fnti.func == S::CharArray)
+                {
+                    step.array = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+                    step.kind = each ? Kind::ArrayEach : Kind::ArrayIndex;
+                    if (!each && step.index >= step.array->count)
+                    {
+                        return false;
+                    }
+                    fnti = step.array->elem;
+                }
+                else if (fnti.func == S::StdVector)
+                {
+                    step.vector = reinterpret_cast<const S::VectorTypeInfo*>(fnti.type_info);
+                    step.kind = each ? Kind::VectorEach : Kind::VectorIndex;
+                    fnti = step.vector->elem;
+                }
+                else
+                {
+                    return false;
+                }
+                path.steps.push_back(step);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        path.leaf = fnti;
+        return true;
+    }
+
+    void print(PrintContext &ctx, const void *obj) const
+    {
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(paths.size(), true);
+        size_t i = 0;
+        for (; i < paths.size(); ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+
+            const Path &path = paths[i];
+            ctx.separator(i);
+            const std::string &key = path.key[static_cast<size_t>(ctx.format())];
+            ctx.out.write(key.data(), key.size());
+            printSteps(ctx, path, 0, static_cast<const char*>(obj));
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+
+    static void printSteps(PrintContext &ctx, const Path &path, size_t stepIdx, const char *obj)
+    {
+        using S = DwarfStringify2;
+        using Kind = Step::Kind;
+
+        for (; stepIdx < path.steps.size(); ++stepIdx)
+        {
+            const Step &step = path.steps[stepIdx];
+            switch (step.kind)
+            {
+            case Kind::Offset:
+                obj += step.offset;
+                break;
+            case Kind::ArrayIndex:
+                obj += step.index * step.array->elem_size;
+                break;
+            case Kind::VectorIndex:
+            {
+                const char *begin = S::Load<const char*>(obj, step.vector->begin_offset);
+                const char *end = S::Load<const char*>(obj, step.vector->end_offset);
+                if (end < begin || step.index >= size_t(end - begin) / step.vector->elem_size)
+                {
+                    ctx.writeNull("???");
+                    return;
+                }
+                obj = begin + step.index * step.vector->elem_size;
+                break;
+            }
+            case Kind::ArrayEach:
+                printEach(ctx, path, stepIdx + 1, obj, step.array->elem_size, step.array->count);
+                return;
+            case Kind::VectorEach:
+            {
+                const char *begin = S::Load<const char*>(obj, step.vector->begin_offset);
+                const char *end = S::Load<const char*>(obj, step.vector->end_offset);
+                if (end < begin || (end - begin) % step.vector->elem_size != 0)
+                {
+                    ctx.writeNull("???");
+                    return;
+                }
+                printEach(ctx, path, stepIdx + 1, begin, step.vector->elem_size, (end - begin) / step.vector->elem_size);
+                return;
+            }
+            }
+        }
+
+        path.leaf.func(ctx, path.leaf.type_info, obj);
+    }
+
+    // The rest of the path for each of `count` elements, as a list
+    static void printEach(PrintContext &ctx, const Path &path, size_t stepIdx, const char *data, size_t elem_size, size_t count)
+    {
+        if (!ctx.enterAggregate())
+        {
+            ctx.writeDepthMarker("{...}");
+            return;
+        }
+
+        ctx.openAggregate(count, false);
+        size_t i = 0;
+        for (; i < count; ++i)
+        {
+            if (!ctx.beginElement(i)) break;
+            ctx.separator(i);
+            printSteps(ctx, path, stepIdx, data + i * elem_size);
+        }
+        ctx.closeAggregate(i);
+
+        ctx.leaveAggregate();
+    }
+};
+
+// FieldProjections by stringifier and FieldSelection::key, built on first use
+inline std::mutex gProjectionsMut;
+inline std::map<std::pair<const void*, std::string>, std::unique_ptr<FieldProjection>> gProjections;
+
+template <typename T>
+inline
+const FieldProjection& GetProjection(const FieldSelection &fields)
+{
+    StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+    const FieldProjection *cached = fields.projection.load(std::memory_order_acquire);
+    if (cached && cached->root == &fnti)
+    {
+        return *cached;
+    }
+
+    if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+    {
+        LibReprGlobalCache::InitializeStringifier(&fnti);
+    }
+
+    HoldAcrossFork<gProjectionsMut>();
+    std::lock_guard<std::mutex> guard(gProjectionsMut);
+    std::unique_ptr<FieldProjection> &res = gProjections[{&fnti, fields.key}];
+    if (!res)
+    {
+        res = std::make_unique<FieldProjection>(FieldProjection::Compile(fnti, fields.paths));
+    }
+    fields.projection.store(res.get(), std::memory_order_release);
+    return *res;
+}
+
+// Text printed by a repr call with ReprOptions, cut at max_bytes with a "..." marker. Counted in gTruncatedReprCount if
+// it was cut short.
+inline
+std::string FinishRepr(std::stringstream &ss, PrintContext &ctx, const ReprOptions &opts)
+{
+    std::string res = ss.str();
+    if (opts.format == OutputFormat::Repr && opts.max_bytes && res.size() > opts.max_bytes)
+    {
+        // Elements are only checked against the limit before they are printed, cut the overshoot. Json and
+        // MessagePack output is kept whole so that it stays valid.
+        res.resize(opts.max_bytes);
+        res += "...";
+        ctx.truncated = true;
+    }
+    if (ctx.truncated)
+    {
+        gTruncatedReprCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return res;
+}
+
+// What a TypeLayout describes, see librepr::layout_of
+enum class FieldKind
+{
+    Unknown,   // Not resolved, e.g. a type without debug data
+    Bool,
+    Integer,   // `is_signed`
+    Float,
+    Enum,      // `enumerators`, `is_signed` for the underlying type
+    Pointer,   // The pointee isn't described
+    CString,   // char*
+    Struct,    // `fields` and `bases`
+    Array,     // `count` elements of `element_size` bytes
+    CharArray, // char[N], printed as a string
+    Vector,    // std::vector, elements in [begin, end) stored at `begin_offset` and `end_offset`
+    BitVector, // std::vector<bool>, 64-bit words in [begin, end) stored at `begin_offset` and `end_offset`
+    String,    // std::string and std::string_view, `data_offset` and `size_offset`
+    List,      // std::list
+    Tree,      // std::map, std::set and their multi variants
+    Hashtable, // std::unordered_map, std::unordered_set and their multi variants
+    Optional,  // std::optional, field "value", engaged flag at `engaged_offset`
+    SmartPtr,  // std::unique_ptr and std::shared_ptr, pointer to an `element` at `data_offset`
+    Pair,      // std::pair, fields "first" and "second"
+};
+
+struct TypeLayout;
+
+struct FieldLayout
+{
+    std::string name;
+    size_t offset;
+    size_t size; // 0 if unknown
+    const TypeLayout *type;
+};
+
+struct BaseLayout
+{
+    std::string name;
+    size_t offset;
+    size_t first_field; // Fields of the base are [first_field, first_field + field_count) of the derived type
+    size_t field_count;
+};
+
+struct EnumeratorLayout
+{
+    int64_t value; // Sign or zero extended from the underlying type
+    std::string name;
+};
+
+// Layout of a type resolved from the debug data. Offsets are relative to the start of the object. Layouts are never
+// modified or freed once built, so they may be used from any thread.
+struct TypeLayout
+{
+    FieldKind kind = FieldKind::Unknown;
+    size_t size = 0; // 0 if unknown
+    bool is_signed = false;
+    std::string name; // Enum
+
+    std::vector<FieldLayout> fields;           // Struct (including members of bases), Optional, Pair
+    std::vector<BaseLayout> bases;             // Struct, direct and indirect, empty for layouts from .librepr sections
+    std::vector<EnumeratorLayout> enumerators; // Enum, by value
+
+    const TypeLayout *element = nullptr; // Array, CharArray, Vector, List, Tree, Hashtable, SmartPtr
+    size_t element_size = 0;
+    size_t count = 0;                    // Array, CharArray
+    size_t begin_offset = 0;             // Vector, BitVector
+    size_t end_offset = 0;
+    size_t data_offset = 0;              // String, SmartPtr
+    size_t size_offset = 0;              // String, List, Tree, Hashtable (SIZE_MAX if the container doesn't store it)
+    size_t engaged_offset = 0;           // Optional
+};
+
+// Builds TypeLayouts from bound stringifiers. Callers hold gLayoutsMut.
+struct LayoutReflection
+{
+    // Kind, type info and size. The size isn't known everywhere (e.g. the value of an optional), such references get
+    // a layout of their own.
+    using Key = std::tuple<uint64_t, const void*, size_t>;
+
+    static const TypeLayout* Get(std::map<Key, std::unique_ptr<TypeLayout>> &layouts, const StringifyFuncAndTypeInfo &fnti, size_t size)
+    {
+        Key key{LayoutTable::KindOf(fnti.func), fnti.type_info, size};
+        std::unique_ptr<TypeLayout> &res = layouts[key];
+        if (!res)
+        {
+            // Registered before it's filled in, for types which refer to themselves
+            res = std::make_unique<TypeLayout>();
+            Fill(layouts, *res, fnti, size);
+        }
+        return res.get();
+    }
+
+private:
+    using S = DwarfStringify2;
+
+    static void Fill(std::map<Key, std::unique_ptr<TypeLayout>> &layouts, TypeLayout &res, const StringifyFuncAndTypeInfo &fnti, size_t size)
+    {
+        StringifyFunc func = fnti.func;
+        res.size = size;
+
+        if (func == S::Bool)
+        {
+            res.kind = FieldKind::Bool;
+        }
+        else if (func == S::Pointer || func == S::CString)
+        {
+            res.kind = func == S::Pointer ? FieldKind::Pointer : FieldKind::CString;
+        }
+        else if (func == S::Struct)
+        {
+            const auto *ti = reinterpret_cast<const S::StructTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::Struct;
+            for (const auto &m : ti->members)
+            {
+                res.fields.push_back({m.name, m.offset, m.size, Get(layouts, m.stringifier, m.size)});
+            }
+            for (const auto &base : ti->bases)
+            {
+                res.bases.push_back({base.name, base.offset, base.first_member, base.member_count});
+            }
+        }
+        else if (func == S::Array || func == S::CharArray)
+        {
+            const auto *ti = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+            res.kind = func == S::Array ? FieldKind::Array : FieldKind::CharArray;
+            res.element = Get(layouts, ti->elem, ti->elem_size);
+            res.element_size = ti->elem_size;
+            res.count = ti->count;
+        }
+        else if (func == S::StdVector)
+        {
+            const auto *ti = reinterpret_cast<const S::VectorTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::Vector;
+            res.element = Get(layouts, ti->elem, ti->elem_size);
+            res.element_size = ti->elem_size;
+            res.begin_offset = ti->begin_offset;
+            res.end_offset = ti->end_offset;
+        }
+        else if (func == S::StdBitVector)
+        {
+            const auto *ti = reinterpret_cast<const S::BitVectorTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::BitVector;
+            res.begin_offset = ti->begin_offset;
+            res.end_offset = ti->end_offset;
+        }
+        else if (func == S::StdString)
+        {
+            const auto *ti = reinterpret_cast<const S::StringTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::String;
+            res.data_offset = ti->data_offset;
+            res.size_offset = ti->size_offset;
+        }
+        else if (func == S::StdList || func == S::StdRbTree || func == S::StdHashtable)
+        {
+            const auto *ti = reinterpret_cast<const S::NodeContainerTypeInfo*>(fnti.type_info);
+            res.kind = func == S::StdList ? FieldKind::List : func == S::StdRbTree ? FieldKind::Tree : FieldKind::Hashtable;
+            res.element = Get(layouts, ti->elem, ti->elem_size);
+            res.element_size = ti->elem_size;
+            res.size_offset = ti->count_offset;
+        }
+        else if (func == S::StdOptional)
+        {
+            const auto *ti = reinterpret_cast<const S::OptionalTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::Optional;
+            res.fields.push_back({"value", ti->value_offset, 0, Get(layouts, ti->value, 0)});
+            res.engaged_offset = ti->engaged_offset;
+        }
+        else if (func == S::StdSmartPtr)
+        {
+            const auto *ti = reinterpret_cast<const S::SmartPtrTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::SmartPtr;
+            res.element = Get(layouts, ti->pointee, ti->pointee_size);
+            res.element_size = ti->pointee_size;
+            res.data_offset = ti->ptr_offset;
+        }
+        else if (func == S::StdPair)
+        {
+            const auto *ti = reinterpret_cast<const S::PairTypeInfo*>(fnti.type_info);
+            res.kind = FieldKind::Pair;
+            res.fields.push_back({"first", ti->first_offset, 0, Get(layouts, ti->first, 0)});
+            res.fields.push_back({"second", ti->second_offset, 0, Get(layouts, ti->second, 0)});
+        }
+        else
+        {
+            FillNumber<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t, float, double, long double>(res, fnti)
+                || FillEnum<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(res, fnti);
+        }
+    }
+
+    template <typename... Ts>
+    static bool FillNumber(TypeLayout &res, const StringifyFuncAndTypeInfo &fnti)
+    {
+        return ((fnti.func == S::Number<Ts> ? (FillNumberOf<Ts>(res), true) : false) || ...);
+    }
+
+    template <typename T>
+    static void FillNumberOf(TypeLayout &res)
+    {
+        res.kind = std::is_floating_point_v<T> ? FieldKind::Float : FieldKind::Integer;
+        res.size = sizeof(T);
+        res.is_signed = std::is_signed_v<T>;
+    }
+
+    template <typename... Ts>
+    static bool FillEnum(TypeLayout &res, const StringifyFuncAndTypeInfo &fnti)
+    {
+        return ((fnti.func == S::EnumClass<Ts> ? (FillEnumOf<Ts>(res, fnti), true) : false) || ...);
+    }
+
+    template <typename UnderlyingT>
+    static void FillEnumOf(TypeLayout &res, const StringifyFuncAndTypeInfo &fnti)
+    {
+        const auto *ti = reinterpret_cast<const S::EnumClassTypeInfo<UnderlyingT>*>(fnti.type_info);
+        res.kind = FieldKind::Enum;
+        res.size = sizeof(UnderlyingT);
+        res.is_signed = std::is_signed_v<UnderlyingT>;
+        res.name = ti->enum_name;
+        for (const auto &[value, text] : ti->valueToText)
+        {
+            // Repr text is `Name::Enumerator`
+            std::string_view name = text[static_cast<size_t>(OutputFormat::Repr)];
+            name.remove_prefix(std::min(name.size(), res.name.size() + 2));
+            res.enumerators.push_back({static_cast<int64_t>(value), std::string(name)});
+        }
+        std::sort(res.enumerators.begin(), res.enumerators.end(), [](const EnumeratorLayout &a, const EnumeratorLayout &b)
+        {
+            return a.value < b.value;
+        });
+    }
+};
+
+inline std::mutex gLayoutsMut;
+inline std::map<LayoutReflection::Key, std::unique_ptr<TypeLayout>> gLayouts;
+
+// Output buffer of repr_signal_safe, writes past its end are dropped
+struct SignalSafeWriter
+{
+    char *buf;
+    size_t len;
+    size_t pos = 0;
+    bool truncated = false;
+
+    void write(const char *data, size_t n)
+    {
+        if (n > len - pos)
+        {
+            n = len - pos;
+            truncated = true;
+        }
+        memcpy(buf + pos, data, n);
+        pos += n;
+    }
+
+    void write(std::string_view text)
+    {
+        write(text.data(), text.size());
+    }
+
+    bool full() const
+    {
+        return pos == len;
+    }
+};
+
+// Printers for repr_signal_safe. They only read stringifiers which are already bound: no locks, no allocations and no
+// streams. Types they don't handle print "???".
+struct SignalSafePrinter
+{
+    static constexpr size_t kMaxDepth = 32;
+
+    static void Print(SignalSafeWriter &out, const StringifyFuncAndTypeInfo &fnti, const char *obj, size_t depth)
+    {
+        using S = DwarfStringify2;
+        StringifyFunc func = fnti.func;
+
+        if (out.full())
+        {
+            return;
+        }
+
+        if (func == S::Bool)
+        {
+            out.write(*obj ? "true" : "false");
+        }
+        else if (NumberIfNumeric<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t, float, double, long double>(out, func, obj)
+                 || EnumIfEnum<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(out, fnti, obj))
+        {
+        }
+        else if (func == S::Pointer || func == S::CString)
+        {
+            // The pointee of a `char*` may not be valid, only its address is printed
+            uint64_t addr = S::Load<uint64_t>(obj, 0);
+            if (addr)
+            {
+                Hex(out, addr);
+            }
+            else
+            {
+                out.write("nullptr");
+            }
+        }
+        else if (func == S::CharArray)
+        {
+            const auto *type_info = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+            const char *nul = static_cast<const char*>(memchr(obj, 0, type_info->count));
+            String(out, obj, nul ? nul - obj : type_info->count);
+        }
+        else if (func == S::StdString)
+        {
+            const auto *type_info = reinterpret_cast<const S::StringTypeInfo*>(fnti.type_info);
+            String(out, S::Load<const char*>(obj, type_info->data_offset), S::Load<size_t>(obj, type_info->size_offset));
+        }
+        else if (depth >= kMaxDepth && (func == S::Struct || func == S::Array || func == S::StdVector || func == S::StdOptional))
+        {
+            out.write("{...}");
+        }
+        else if (func == S::StdOptional)
+        {
+            const auto *type_info = reinterpret_cast<const S::OptionalTypeInfo*>(fnti.type_info);
+            if (S::Load<bool>(obj, type_info->engaged_offset))
+            {
+                Print(out, type_info->value, obj + type_info->value_offset, depth + 1);
+            }
+            else
+            {
+                out.write("std::nullopt");
+            }
+        }
+        else if (func == S::Struct)
+        {
+            const auto *type_info = reinterpret_cast<const S::StructTypeInfo*>(fnti.type_info);
+            out.write("{");
+            for (size_t i = 0; i < type_info->members.size() && !out.full(); ++i)
+            {
+                const auto &m = type_info->members[i];
+                if (i)
+                {
+                    out.write(", ");
+                }
+                out.write(m.keys[static_cast<size_t>(OutputFormat::Repr)]);
+                Print(out, m.stringifier, obj + m.offset, depth + 1);
+            }
+            out.write("}");
+        }
+        else if (func == S::Array)
+        {
+            const auto *type_info = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+            Elements(out, type_info->elem, type_info->elem_size, obj, type_info->count, depth);
+        }
+        else if (func == S::StdVector)
+        {
+            const auto *type_info = reinterpret_cast<const S::VectorTypeInfo*>(fnti.type_info);
+            const char *begin = S::Load<const char*>(obj, type_info->begin_offset);
+            const char *end = S::Load<const char*>(obj, type_info->end_offset);
+            if (end < begin || (end - begin) % type_info->elem_size != 0)
+            {
+                out.write("???");
+                return;
+            }
+            Elements(out, type_info->elem, type_info->elem_size, begin, (end - begin) / type_info->elem_size, depth);
+        }
+        else
+        {
+            out.write("???");
+        }
+    }
+
+    static void Elements(SignalSafeWriter &out, const StringifyFuncAndTypeInfo &elem, size_t elem_size, const char *data, size_t count, size_t depth)
+    {
+        out.write("{");
+        for (size_t i = 0; i < count && !out.full(); ++i)
+        {
+            if (i)
+            {
+                out.write(", ");
+            }
+            Print(out, elem, data + i * elem_size, depth + 1);
+        }
+        out.write("}");
+    }
+
+    // Escaped the same as DwarfStringify2::EscapedString does
+    static void String(SignalSafeWriter &out, const char *data, size_t len)
+    {
+        out.write("\"");
+        const char *end = data + len;
+        for (const char *it = data; !out.full(); ++it)
+        {
+            const char *run = it;
+            it = DwarfStringify2::FindEscape(it, end);
+            out.write(run, it - run);
+            if (it == end)
+            {
+                break;
+            }
+
+            unsigned char c = *it;
+            switch (c)
+            {
+            case '"':  out.write("\\\""); break;
+            case '\\': out.write("\\\\"); break;
+            case '\n': out.write("\\n"); break;
+            case '\r': out.write("\\r"); break;
+            case '\t': out.write("\\t"); break;
+            default:
+                {
+                    const char esc[4] = {'\\', char('0' + (c >> 6)), char('0' + ((c >> 3) & 7)), char('0' + (c & 7))};
+                    out.write(esc, 4);
+                }
+                break;
+            }
+        }
+        out.write("\"");
+    }
+
+    static void Hex(SignalSafeWriter &out, uint64_t val)
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        char text[18] = {'0', 'x'};
+        for (int i = 0; i < 16; ++i)
+        {
+            text[17 - i] = digits[(val >> (4 * i)) & 0xf];
+        }
+        out.write(text, sizeof(text));
+    }
+
+    // FormatNumber is reentrant and doesn't allocate. long double goes through double, to_chars of it may not be.
+    template <typename T>
+    static void Number(SignalSafeWriter &out, T val)
+    {
+        char buf[DwarfStringify2::kMaxNumberLength];
+        if constexpr (std::is_same_v<T, long double>)
+        {
+            out.write(buf, DwarfStringify2::FormatNumber(buf, (double)val) - buf);
+        }
+        else
+        {
+            out.write(buf, DwarfStringify2::FormatNumber(buf, val) - buf);
+        }
+    }
+
+    template <typename... Ts>
+    static bool NumberIfNumeric(SignalSafeWriter &out, StringifyFunc func, const char *obj)
+    {
+        return ((func == DwarfStringify2::Number<Ts> ? (Number(out, DwarfStringify2::Load<Ts>(obj, 0)), true) : false) || ...);
+    }
+
+    template <typename... Ts>
+    static bool EnumIfEnum(SignalSafeWriter &out, const StringifyFuncAndTypeInfo &fnti, const char *obj)
+    {
+        return ((fnti.func == DwarfStringify2::EnumClass<Ts> ? (Enum<Ts>(out, fnti, obj), true) : false) || ...);
+    }
+
+    template <typename UnderlyingT>
+    static void Enum(SignalSafeWriter &out, const StringifyFuncAndTypeInfo &fnti, const char *obj)
+    {
+        const auto *type_info = reinterpret_cast<const DwarfStringify2::EnumClassTypeInfo<UnderlyingT>*>(fnti.type_info);
+        UnderlyingT val = DwarfStringify2::Load<UnderlyingT>(obj, 0);
+
+        auto it = type_info->valueToText.find(val);
+        if (it != type_info->valueToText.end())
+        {
+            out.write(it->second[static_cast<size_t>(OutputFormat::Repr)]);
+            return;
+        }
+
+        out.write("static_cast<");
+        out.write(type_info->enum_name);
+        out.write(">(");
+        Number(out, val);
+        out.write(")");
+    }
+
+    // Bytes of a value whose stringifier isn't bound, e.g. "<raw Card 0100000002000000>"
+    static void RawBytes(SignalSafeWriter &out, std::string_view type_name, const char *obj, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        out.write("<raw ");
+        out.write(type_name);
+        out.write(" ");
+        for (size_t i = 0; i < size && !out.full(); ++i)
+        {
+            uint8_t b = obj[i];
+            char hex[2] = {digits[b >> 4], digits[b & 0xf]};
+            out.write(hex, 2);
+        }
+        out.write(">");
+    }
+};
+
+// Record written by librepr::capture, followed by `size` bytes of the object
+struct CaptureHeader
+{
+    static constexpr uint32_t kMagic = 0x3143524c; // "LRC1"
+
+    uint32_t magic;
+    uint32_t size;
+    uint64_t build_id; // RawDwarfData::buildIdHash of the executable which wrote the record
+    uint64_t type_die; // Offset of the object's type in .debug_info
+    uint64_t address;  // Address of the object when captured, pointers into the object itself can still be followed
+};
+
+// Renders capture records using the debug data of the executable which wrote them
+struct CaptureDecoder
+{
+    explicit CaptureDecoder(const char *path)
+    {
+        _loader.loadFile(path);
+        _build_id = _loader.rdd.buildIdHash();
+    }
+
+    // Prints the record at the beginning of [data, data + len). Returns the size of the record, or 0 if the record
+    // is incomplete.
+    size_t decode(const void *data, size_t len, std::ostream &out, const ReprOptions &opts = {})
+    {
+        CaptureHeader header;
+        if (len < sizeof(header))
+        {
+            return 0;
+        }
+        memcpy(&header, data, sizeof(header));
+
+        if (header.magic != CaptureHeader::kMagic)
+        {
+            throw std::runtime_error("Not a capture record");
+        }
+        if (len - sizeof(header) < header.size)
+        {
+            return 0;
+        }
+        if (header.build_id != _build_id)
+        {
+            throw std::runtime_error("Capture record is from a different executable");
+        }
+
+        // Records are packed, copy the object to aligned storage
+        _object.resize((header.size + sizeof(max_align_t) - 1) / sizeof(max_align_t));
+        memcpy(_object.data(), (const char*)data + sizeof(header), header.size);
+
+        PrintContext ctx(out, opts);
+        ctx.setDetachedObject(_object.data(), header.address, header.size);
+
+        size_t cu_idx = _loader.findCompilationUnit(header.type_die);
+        if (header.type_die == 0 || cu_idx == (size_t)-1)
+        {
+            ctx.writeNull("???");
+        }
+        else
+        {
+            uint64_t typeDieOffset = header.type_die - _loader._compilation_units[cu_idx]._offset;
+            StringifyFuncAndTypeInfo fnti = _cache.loadStringify(_loader, cu_idx, typeDieOffset);
+            fnti.func(ctx, fnti.type_info, _object.data());
+        }
+
+        return sizeof(header) + header.size;
+    }
+
+private:
+    DebugDataLoader _loader;
+    LibReprGlobalCache _cache;
+    uint64_t _build_id;
+    std::vector<max_align_t> _object;
+};
+
+
+// What repr_async does when the ring of the calling thread has no room for a record
+enum class BackpressurePolicy
+{
+    Drop,   // Discard the record
+    Block,  // Wait for the formatter thread to make room
+    Sample, // Keep one of every `sample_rate` records once the ring is half full, drop when full
+};
+
+struct AsyncOptions
+{
+    size_t ring_size = 1 << 16; // Bytes per producing thread, rounded up to a power of two
+    BackpressurePolicy policy = BackpressurePolicy::Drop;
+    uint32_t sample_rate = 16;
+    ReprOptions repr_options;   // Applied to every record
+};
+
+struct AsyncStats
+{
+    uint64_t enqueued = 0;
+    uint64_t dropped = 0;
+    uint64_t sampled_out = 0;
+    uint64_t blocked = 0;   // Records which had to wait for room under BackpressurePolicy::Block
+    uint64_t formatted = 0;
+};
+
+using AsyncCallback = void (*)(void *user, std::string_view text);
+
+// Precedes each record in an AsyncRing, followed by the bytes of the object
+struct alignas(max_align_t) AsyncRecord
+{
+    uint32_t size;     // Of the whole record including padding, 0 marks the end of the ring and the rest is skipped
+    uint32_t obj_size;
+    const StringifyFuncAndTypeInfo *fnti;
+    AsyncCallback callback;
+    void *user;
+    uint64_t address;
+};
+
+// Single producer single consumer byte ring, owned by one thread calling repr_async and drained by the formatter
+struct AsyncRing
+{
+    static constexpr size_t kAlign = sizeof(max_align_t);
+
+    AsyncRing(size_t size, BackpressurePolicy policy_, uint32_t sample_rate_)
+        : policy(policy_)
+        , sample_rate(sample_rate_ ? sample_rate_ : 1)
+    {
+        size_t cap = 1024;
+        while (cap < size)
+        {
+            cap *= 2;
+        }
+        _buf.resize(cap / kAlign);
+        _mask = cap - 1;
+    }
+
+    size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+    static size_t recordSize(size_t obj_size)
+    {
+        return (sizeof(AsyncRecord) + obj_size + kAlign - 1) / kAlign * kAlign;
+    }
+
+    // Producer side. Returns false if there is no room for the record.
+    bool tryPush(const AsyncRecord &rec, const void *obj)
+    {
+        size_t size = recordSize(rec.obj_size);
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        size_t pos = head & _mask;
+        size_t padding = (capacity() - pos < size) ? capacity() - pos : 0;
+
+        if (head + padding + size - _cached_tail > capacity())
+        {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+            if (head + padding + size - _cached_tail > capacity())
+            {
+                return false;
+            }
+        }
+
+        if (padding)
+        {
+            // Records are never split, skip to the beginning
+            reinterpret_cast<AsyncRecord*>(data() + pos)->size = 0;
+            pos = 0;
+        }
+        AsyncRecord *dst = reinterpret_cast<AsyncRecord*>(data() + pos);
+        *dst = rec;
+        dst->size = size;
+        memcpy(dst + 1, obj, rec.obj_size);
+
+        _head.store(head + padding + size, std::memory_order_seq_cst);
+        return true;
+    }
+
+    // Fraction of the ring in use as seen by the producer, may be stale
+    bool atLeastHalfFull() const
+    {
+        return _head.load(std::memory_order_relaxed) - _cached_tail >= capacity() / 2;
+    }
+
+    // Consumer side. Calls fn for each record available, returns the number of records consumed.
+    template <typename Fn>
+    size_t drain(Fn &&fn)
+    {
+        size_t cnt = 0;
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        uint64_t head = _head.load(std::memory_order_acquire);
+        while (tail != head)
+        {
+            size_t pos = tail & _mask;
+            const AsyncRecord *rec = reinterpret_cast<const AsyncRecord*>(data() + pos);
+            if (rec->size == 0)
+            {
+                tail += capacity() - pos;
+            }
+            else
+            {
+                fn(*rec, rec + 1);
+                tail += rec->size;
+                ++cnt;
+            }
+            _tail.store(tail, std::memory_order_release);
+        }
+        return cnt;
+    }
+
+    bool empty() const
+    {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+    // Forgets the queued records and the counters, in a child after fork(). The parent formats the records itself.
+    void reset()
+    {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        _tail.store(head, std::memory_order_relaxed);
+        _cached_tail = head;
+        enqueued.store(0, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_relaxed);
+        sampled_out.store(0, std::memory_order_relaxed);
+        blocked.store(0, std::memory_order_relaxed);
+        sample_counter = 0;
+    }
+
+    const BackpressurePolicy policy;
+    const uint32_t sample_rate;
+
+    // Written only by the producer, read by anyone
+    std::atomic<uint64_t> enqueued{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> sampled_out{0};
+    std::atomic<uint64_t> blocked{0};
+    uint32_t sample_counter = 0;
+
+    // Set when the producing thread exits, the formatter forgets the ring once it is drained
+    std::atomic<bool> closed{false};
+
+private:
+    char* data()
+    {
+        return reinterpret_cast<char*>(_buf.data());
+    }
+
+    std::vector<max_align_t> _buf;
+    size_t _mask;
+
+    alignas(64) std::atomic<uint64_t> _head{0};
+    uint64_t _cached_tail = 0;
+    alignas(64) std::atomic<uint64_t> _tail{0};
+};
+
+inline std::mutex gAsyncOptionsMut;
+inline AsyncOptions gAsyncOptions;
+inline bool gAsyncStarted = false;
+
+// Owns the formatter thread which prints records queued by repr_async and passes the text to their callbacks
+class AsyncFormatter
+{
+public:
+    static AsyncFormatter& instance()
+    {
+        static AsyncFormatter formatter;
+        return formatter;
+    }
+
+    AsyncFormatter(const AsyncFormatter&) = delete;
+    AsyncFormatter& operator=(const AsyncFormatter&) = delete;
+
+    ~AsyncFormatter()
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mut);
+            _stop = true;
+        }
+        _cv.notify_all();
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+    }
+
+    // Ring of the calling thread
+    AsyncRing& ring()
+    {
+        std::shared_ptr<AsyncRing> &own = threadRing();
+        if (!own)
+        {
+            own = std::make_shared<AsyncRing>(_opts.ring_size, _opts.policy, _opts.sample_rate);
+            std::lock_guard<std::mutex> guard(_mut);
+            _rings.push_back(own);
+            ++_rings_version;
+        }
+        return *own;
+    }
+
+    void push(const AsyncRecord &rec, const void *obj)
+    {
+        if (_restart.load(std::memory_order_relaxed))
+        {
+            startThread();
+        }
+        AsyncRing &r = ring();
+
+        if (AsyncRing::recordSize(rec.obj_size) > r.capacity())
+        {
+            r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (r.policy == BackpressurePolicy::Sample && r.atLeastHalfFull() && (r.sample_counter++ % r.sample_rate) != 0)
+        {
+            r.sampled_out.store(r.sampled_out.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (!r.tryPush(rec, obj))
+        {
+            if (r.policy != BackpressurePolicy::Block)
+            {
+                r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+
+            r.blocked.store(r.blocked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            do
+            {
+                if (_sleeping.load(std::memory_order_seq_cst))
+                {
+                    wake();
+                }
+                std::this_thread::yield();
+            } while (!r.tryPush(rec, obj));
+        }
+
+        r.enqueued.store(r.enqueued.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (_sleeping.load(std::memory_order_seq_cst))
+        {
+            wake();
+        }
+    }
+
+    // Waits until everything queued so far by any thread is formatted
+    void flush()
+    {
+        if (_restart.load(std::memory_order_relaxed))
+        {
+            startThread();
+        }
+        uint64_t target = stats().enqueued;
+        wake();
+        std::unique_lock<std::mutex> lock(_mut);
+        _flushed_cv.wait(lock, [&]{ return _formatted.load(std::memory_order_acquire) >= target; });
+    }
+
+    AsyncStats stats()
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        AsyncStats res = _retired;
+        for (const auto &r : _rings)
+        {
+            res.enqueued += r->enqueued.load(std::memory_order_relaxed);
+            res.dropped += r->dropped.load(std::memory_order_relaxed);
+            res.sampled_out += r->sampled_out.load(std::memory_order_relaxed);
+            res.blocked += r->blocked.load(std::memory_order_relaxed);
+        }
+        res.formatted = _formatted.load(std::memory_order_relaxed);
+        return res;
+    }
+
+private:
+    AsyncFormatter()
+    {
+        HoldAcrossFork<gAsyncOptionsMut>();
+        std::lock_guard<std::mutex> guard(gAsyncOptionsMut);
+        _opts = gAsyncOptions;
+        gAsyncStarted = true;
+        _thread = std::thread([this]{ loop(); });
+
+        pthread_atfork(
+            []() { instance()._mut.lock(); },
+            []() { instance()._mut.unlock(); },
+            []() { instance().resetAfterFork(); });
+    }
+
+    static std::shared_ptr<AsyncRing>& threadRing()
+    {
+        struct Handle
+        {
+            ~Handle()
+            {
+                if (ring)
+                {
+                    ring->closed.store(true, std::memory_order_release);
+                }
+            }
+            std::shared_ptr<AsyncRing> ring;
+        };
+        thread_local Handle handle;
+        return handle.ring;
+    }
+
+    // A child of fork() has neither the formatter thread nor the threads which owned the other rings, and the condition
+    // variables may count waiters from those threads. Only the forking thread's ring is kept, emptied, and the
+    // formatter thread is started again on the next push or flush.
+    void resetAfterFork()
+    {
+        // The std::thread and condition variables refer to threads of the parent, they are replaced without being
+        // destroyed (which would terminate or wait for them)
+        new (&_thread) std::thread();
+        new (&_cv) std::condition_variable();
+        new (&_flushed_cv) std::condition_variable();
+
+        std::shared_ptr<AsyncRing> own = threadRing();
+        _rings.clear();
+        if (own)
+        {
+            own->reset();
+            _rings.push_back(own);
+        }
+        ++_rings_version;
+        _retired = {};
+        _formatted.store(0, std::memory_order_relaxed);
+        _sleeping.store(false, std::memory_order_relaxed);
+        _restart.store(true, std::memory_order_relaxed);
+        _mut.unlock();
+    }
+
+    void startThread()
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        if (_restart.load(std::memory_order_relaxed))
+        {
+            _thread = std::thread([this]{ loop(); });
+            _restart.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void wake()
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        _cv.notify_one();
+    }
+
+    void loop()
+    {
+        std::vector<std::shared_ptr<AsyncRing>> rings;
+        uint64_t rings_version = (uint64_t)-1;
+        std::stringstream ss;
+
+        auto format = [&](const AsyncRecord &rec, const void *obj)
+        {
+            ss.str(std::string());
+            PrintContext ctx(ss, _opts.repr_options);
+            ctx.setDetachedObject(obj, rec.address, rec.obj_size);
+            rec.fnti->func(ctx, rec.fnti->type_info, obj);
+
+            rec.callback(rec.user, FinishRepr(ss, ctx, _opts.repr_options));
+        };
+
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> guard(_mut);
+                if (rings_version != _rings_version)
+                {
+                    rings = _rings;
+                    rings_version = _rings_version;
+                }
+            }
+
+            size_t cnt = 0;
+            bool has_closed = false;
+            for (const auto &r : rings)
+            {
+                cnt += r->drain(format);
+                has_closed |= r->closed.load(std::memory_order_acquire);
+            }
+            if (cnt)
+            {
+                _formatted.fetch_add(cnt, std::memory_order_release);
+                std::lock_guard<std::mutex> guard(_mut);
+                _flushed_cv.notify_all();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mut);
+            if (has_closed)
+            {
+                retireClosedRings();
+            }
+            if (_stop)
+            {
+                return;
+            }
+
+            // Producers only notify when they see this flag, so rings are checked once more after setting it
+            _sleeping.store(true, std::memory_order_seq_cst);
+            bool pending = std::any_of(_rings.begin(), _rings.end(), [](const auto &r){ return !r->empty(); });
+            if (!pending)
+            {
+                _cv.wait_for(lock, std::chrono::milliseconds(10));
+            }
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Must be called with _mut held
+    void retireClosedRings()
+    {
+        auto it = std::remove_if(_rings.begin(), _rings.end(), [&](const auto &r)
+        {
+            if (!r->closed.load(std::memory_order_acquire) || !r->empty())
+            {
+                return false;
+            }
+            _retired.enqueued += r->enqueued.load(std::memory_order_relaxed);
+            _retired.dropped += r->dropped.load(std::memory_order_relaxed);
+            _retired.sampled_out += r->sampled_out.load(std::memory_order_relaxed);
+            _retired.blocked += r->blocked.load(std::memory_order_relaxed);
+            return true;
+        });
+        if (it != _rings.end())
+        {
+            _rings.erase(it, _rings.end());
+            ++_rings_version;
+        }
+    }
+
+    AsyncOptions _opts;
+
+    std::mutex _mut;
+    std::condition_variable _cv;
+    std::condition_variable _flushed_cv;
+    std::vector<std::shared_ptr<AsyncRing>> _rings;
+    uint64_t _rings_version = 0;
+    AsyncStats _retired;
+    bool _stop = false;
+
+    std::atomic<bool> _sleeping{false};
+    std::atomic<uint64_t> _formatted{0};
+    std::atomic<bool> _restart{false}; // Set in a child of fork() until the formatter thread is started again
+
+    std::thread _thread;
+};
+
+
+// Stringifier of a type whose output depends only on its bytes (see DwarfStringify2::IsPlainValue), with the bytes it
+// prints. ReprCache keys and Throttle hashes are made of these bytes only, so that padding doesn't matter.
+struct PlainValue
+{
+    const StringifyFuncAndTypeInfo *fnti = nullptr;
+    std::vector<DwarfStringify2::StructTypeInfo::DataRun> runs;
+
+    // Null for types which aren't plain. Checked once per type, binding its stringifier first if needed.
+    template <typename T>
+    static const PlainValue* Get()
+    {
+        static const std::unique_ptr<PlainValue> plain = []() -> std::unique_ptr<PlainValue>
+        {
+            StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+            if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+            {
+                LibReprGlobalCache::InitializeStringifier(&fnti);
+            }
+
+            auto res = std::make_unique<PlainValue>();
+            res->fnti = &fnti;
+            if (!DwarfStringify2::IsPlainValue(fnti) || !DwarfStringify2::AppendDataRuns(res->runs, fnti, 0, sizeof(T)))
+            {
+                return nullptr;
+            }
+            return res;
+        }();
+        return plain.get();
+    }
+};
+
+struct ReprCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t uncacheable = 0; // Calls for types which can't be cached, see ReprCache
+};
+
+// Remembers the output for the most recently printed objects, keyed by their bytes with padding left out. Only types
+// whose output depends on nothing but their own bytes are cached, anything with strings, containers or pointers in it
+// is printed every time.
+class ReprCache
+{
+public:
+    explicit ReprCache(size_t capacity = 64)
+        : _capacity(capacity ? capacity : 1)
+    {
+    }
+
+    ReprCache(const ReprCache&) = delete;
+    ReprCache& operator=(const ReprCache&) = delete;
+
+    // Objects of polymorphic types are printed as their dynamic type like by librepr::repr, and never cached
+    template <typename T>
+    std::string repr(const T &val)
+    {
+        const PlainValue *plain = std::is_polymorphic_v<T> ? nullptr : PlainValue::Get<T>();
+        if (!plain)
+        {
+            {
+                std::lock_guard<std::mutex> guard(_mut);
+                ++_stats.uncacheable;
+            }
+            StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+            if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+            {
+                LibReprGlobalCache::InitializeStringifier(&fnti);
+            }
+            PrintedObject obj = ResolvePrintedObject(fnti, val);
+            return format(*obj.fnti, static_cast<const char*>(obj.data));
+        }
+        return lookup(*plain, reinterpret_cast<const char*>(&val));
+    }
+
+    ReprCacheStats stats() const
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        return _stats;
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string text;
+    };
+
+    static std::string format(const StringifyFuncAndTypeInfo &fnti, const char *obj)
+    {
+        std::stringstream ss;
+        PrintContext ctx(ss);
+        fnti.func(ctx, fnti.type_info, obj);
+        return ss.str();
+    }
+
+    std::string lookup(const PlainValue &plain, const char *obj)
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+
+        // Key is the stringifier followed by the bytes of the value, so objects of different types never match.
+        // Padding isn't part of the key, it may hold anything.
+        _key.assign(reinterpret_cast<const char*>(&plain.fnti), sizeof(plain.fnti));
+        for (const auto &run : plain.runs)
+        {
+            _key.append(obj + run.offset, run.size);
+        }
+
+        if (auto it = _index.find(_key); it != _index.end())
+        {
+            ++_stats.hits;
+            _entries.splice(_entries.begin(), _entries, it->second);
+            return it->second->text;
+        }
+
+        ++_stats.misses;
+        if (_entries.size() >= _capacity)
+        {
+            ++_stats.evictions;
+            _index.erase(_entries.back().key);
+            _entries.pop_back();
+        }
+        _entries.push_front(Entry{_key, format(*plain.fnti, obj)});
+        _index.emplace(_entries.front().key, _entries.begin());
+        return _entries.front().text;
+    }
+
+    const size_t _capacity;
+
+    mutable std::mutex _mut;
+    std::list<Entry> _entries; // Most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> _index;
+    std::string _key;
+    ReprCacheStats _stats;
+};
+
+// Which calls of a throttled repr print, see Throttle
+enum class ThrottlePolicy
+{
+    Sample,    // One of every `sample_rate` calls
+    RateLimit, // Token bucket refilled with `rate` tokens per second, holding up to `burst`
+    Dedupe,    // Values equal to the last one printed are dropped for `window`
+};
+
+struct ThrottleOptions
+{
+    ThrottlePolicy policy = ThrottlePolicy::Sample;
+    uint64_t sample_rate = 16;
+    double rate = 1;
+    uint64_t burst = 1;
+    std::chrono::nanoseconds window = std::chrono::seconds(1);
+};
+
+struct ThrottleStats
+{
+    uint64_t printed = 0;
+    uint64_t suppressed = 0;
+};
+
+// State of a single throttled callsite, usually a function local static. Calls are admitted or suppressed with a few
+// relaxed atomics before anything is formatted. Dedupe compares the bytes of the value (padding left out) for types
+// whose output depends on nothing but those, other types are formatted and compared by their output.
+class Throttle
+{
+public:
+    explicit Throttle(const ThrottleOptions &opts = {})
+        : _opts(opts)
+    {
+        _opts.sample_rate = std::max<uint64_t>(_opts.sample_rate, 1);
+        _interval = _opts.rate > 0 ? int64_t(1e9 / _opts.rate) : INT64_MAX / 2;
+        _tolerance = _interval * int64_t(std::max<uint64_t>(_opts.burst, 1) - 1);
+    }
+
+    Throttle(const Throttle&) = delete;
+    Throttle& operator=(const Throttle&) = delete;
+
+    // Whether a call printing `val` goes ahead, counted as suppressed if not
+    template <typename T>
+    bool admit(const T &val)
+    {
+        bool pass = true;
+        if (_opts.policy == ThrottlePolicy::Sample)
+        {
+            pass = _calls.fetch_add(1, std::memory_order_relaxed) % _opts.sample_rate == 0;
+        }
+        else if (_opts.policy == ThrottlePolicy::RateLimit)
+        {
+            pass = takeToken();
+        }
+        else if (const PlainValue *plain = PlainValue::Get<T>())
+        {
+            pass = firstInWindow(HashRuns(*plain, reinterpret_cast<const char*>(&val)));
+        }
+
+        if (!pass)
+        {
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+        }
+        return pass;
+    }
+
+    // Called with the output of an admitted call. Returns false if it is suppressed after all (Dedupe of values
+    // compared by their output), otherwise prefixes it with the number of calls suppressed since the last one printed,
+    // e.g. "[41 suppressed] {...}". Json and MessagePack output is left as is so that it stays valid.
+    template <typename T>
+    bool finish(std::string &text, OutputFormat format)
+    {
+        if (_opts.policy == ThrottlePolicy::Dedupe && !PlainValue::Get<T>() && !firstInWindow(HashBytes(text.data(), text.size())))
+        {
+            _suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _printed.fetch_add(1, std::memory_order_relaxed);
+        uint64_t suppressed = _suppressed.load(std::memory_order_relaxed);
+        uint64_t pending = suppressed - _reported.exchange(suppressed, std::memory_order_relaxed);
+        if (pending && format == OutputFormat::Repr)
+        {
+            text.insert(0, "[" + std::to_string(pending) + " suppressed] ");
+        }
+        return true;
+    }
+
+    ThrottleStats stats() const
+    {
+        ThrottleStats res;
+        res.printed = _printed.load(std::memory_order_relaxed);
+        res.suppressed = _suppressed.load(std::memory_order_relaxed);
+        return res;
+    }
+
+private:
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // FNV-1a
+    static uint64_t HashBytes(const char *data, size_t len, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // Padding isn't hashed, it may hold anything
+    static uint64_t HashRuns(const PlainValue &plain, const char *obj)
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const auto &run : plain.runs)
+        {
+            hash = HashBytes(obj + run.offset, run.size, hash);
+        }
+        return hash;
+    }
+
+    // Generic cell rate algorithm: `_tat` is when the bucket would be full again, a call may go ahead while that's at
+    // most `burst - 1` intervals away
+    bool takeToken()
+    {
+        int64_t now = NowNs();
+        int64_t tat = _tat.load(std::memory_order_relaxed);
+        int64_t next;
+        do
+        {
+            int64_t start = std::max(tat, now);
+            if (start - now > _tolerance)
+            {
+                return false;
+            }
+            next = start + _interval;
+        } while (!_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Concurrent calls may both print the same value, which is fine for throttling
+    bool firstInWindow(uint64_t hash)
+    {
+        int64_t now = NowNs();
+        if (_last_hash.load(std::memory_order_relaxed) == hash
+            && now - _last_printed.load(std::memory_order_relaxed) < _opts.window.count())
+        {
+            return false;
+        }
+        _last_hash.store(hash, std::memory_order_relaxed);
+        _last_printed.store(now, std::memory_order_relaxed);
+        return true;
+    }
+
+    ThrottleOptions _opts;
+    int64_t _interval;  // Nanoseconds per token
+    int64_t _tolerance;
+
+    std::atomic<uint64_t> _calls{0};
+    std::atomic<int64_t> _tat{INT64_MIN / 2};
+    std::atomic<uint64_t> _last_hash{0};
+    std::atomic<int64_t> _last_printed{INT64_MIN / 2};
+    std::atomic<uint64_t> _printed{0};
+    std::atomic<uint64_t> _suppressed{0};
+    std::atomic<uint64_t> _reported{0}; // Value of _suppressed when a call last printed
+};
+
+#ifdef LIBREPR_CALLSITE_STATS
+
+// Bucket `i` counts calls which took [2^i, 2^(i+1)) nanoseconds, the last one counts anything slower
+constexpr size_t kLatencyBuckets = 32;
+
+struct CallsiteStats
+{
+    std::string_view type_name;
+    uint64_t calls = 0;
+    uint64_t output_bytes = 0;
+    std::array<uint64_t, kLatencyBuckets> latency_ns{};
+};
+
+// Counters of a single callsite in a single thread. Only the owning thread writes them, others may read them.
+struct CallsiteCounters
+{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> output_bytes{0};
+    std::array<std::atomic<uint64_t>, kLatencyBuckets> latency_ns{};
+
+    static void Increment(std::atomic<uint64_t> &counter, uint64_t val)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+    }
+
+    void addTo(CallsiteStats &stats) const
+    {
+        stats.calls += calls.load(std::memory_order_relaxed);
+        stats.output_bytes += output_bytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kLatencyBuckets; ++i)
+        {
+            stats.latency_ns[i] += latency_ns[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+class CallsiteRegistry;
+
+// Counters of all callsites in a single thread, in chunks so that they don't move while they're read
+class ThreadCallsiteCounters
+{
+public:
+    static constexpr size_t kChunkSize = 64;
+    static constexpr size_t kMaxChunks = 1024; // Callsites beyond kChunkSize * kMaxChunks aren't counted
+
+    ThreadCallsiteCounters();
+    ~ThreadCallsiteCounters();
+
+    static ThreadCallsiteCounters& instance()
+    {
+        thread_local ThreadCallsiteCounters counters;
+        return counters;
+    }
+
+    CallsiteCounters* get(size_t id)
+    {
+        size_t chunk = id / kChunkSize;
+        if (chunk >= kMaxChunks)
+        {
+            return nullptr;
+        }
+        CallsiteCounters *counters = _chunks[chunk].load(std::memory_order_relaxed);
+        if (!counters)
+        {
+            counters = new CallsiteCounters[kChunkSize];
+            _chunks[chunk].store(counters, std::memory_order_release);
+        }
+        return &counters[id % kChunkSize];
+    }
+
+    void addTo(std::vector<CallsiteStats> &stats) const
+    {
+        for (size_t id = 0; id < stats.size(); ++id)
+        {
+            if (id / kChunkSize >= kMaxChunks)
+            {
+                break;
+            }
+            if (const CallsiteCounters *counters = _chunks[id / kChunkSize].load(std::memory_order_acquire))
+            {
+                counters[id % kChunkSize].addTo(stats[id]);
+            }
+        }
+    }
+
+private:
+    std::array<std::atomic<CallsiteCounters*>, kMaxChunks> _chunks{};
+};
+
+// Names of all callsites seen so far, the counters of running threads, and the totals of exited ones
+class CallsiteRegistry
+{
+public:
+    static CallsiteRegistry& instance()
+    {
+        static CallsiteRegistry registry;
+        return registry;
+    }
+
+    size_t add(std::string_view type_name)
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        _exited.emplace_back().type_name = type_name;
+        return _exited.size() - 1;
+    }
+
+    void addThread(ThreadCallsiteCounters *counters)
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        _threads.push_back(counters);
+    }
+
+    void removeThread(ThreadCallsiteCounters *counters)
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        counters->addTo(_exited);
+        _threads.erase(std::find(_threads.begin(), _threads.end(), counters));
+    }
+
+    std::vector<CallsiteStats> snapshot()
+    {
+        std::lock_guard<std::mutex> guard(_mut);
+        std::vector<CallsiteStats> res = _exited;
+        for (const ThreadCallsiteCounters *counters : _threads)
+        {
+            counters->addTo(res);
+        }
+        return res;
+    }
+
+private:
+    // The counters of threads which a child of fork() doesn't have are kept, they are never freed or written to
+    CallsiteRegistry()
+    {
+        pthread_atfork(
+            []() { instance()._mut.lock(); },
+            []() { instance()._mut.unlock(); },
+            []() { instance()._mut.unlock(); });
+    }
+
+    std::mutex _mut;
+    std::vector<ThreadCallsiteCounters*> _threads;
+    std::vector<CallsiteStats> _exited; // Indexed by callsite id
+};
+
+inline ThreadCallsiteCounters::ThreadCallsiteCounters()
+{
+    CallsiteRegistry::instance().addThread(this);
+}
+
+inline ThreadCallsiteCounters::~ThreadCallsiteCounters()
+{
+    CallsiteRegistry::instance().removeThread(this);
+    for (auto &chunk : _chunks)
+    {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+size_t CallsiteId()
+{
+    static const size_t id = CallsiteRegistry::instance().add(TypeName<T>());
+    return id;
+}
+
+// Counts a repr call from construction until finish()
+template <typename T>
+class CallsiteTimer
+{
+public:
+    CallsiteTimer()
+        : _start(std::chrono::steady_clock::now())
+    {
+    }
+
+    void finish(size_t output_bytes)
+    {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        size_t bucket = std::min<size_t>(ns ? 63 - __builtin_clzll(ns) : 0, kLatencyBuckets - 1);
+
+        CallsiteCounters *counters = ThreadCallsiteCounters::instance().get(CallsiteId<T>());
+        if (counters)
+        {
+            CallsiteCounters::Increment(counters->calls, 1);
+            CallsiteCounters::Increment(counters->output_bytes, output_bytes);
+            CallsiteCounters::Increment(counters->latency_ns[bucket], 1);
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point _start;
+};
+
+#endif // LIBREPR_CALLSITE_STATS
+
+} // namespace librepr::_internal_v3
+
+
+
+
+namespace librepr {
+
+
+
+using ReprOptions = _internal_v3::ReprOptions;
+using OutputFormat = _internal_v3::OutputFormat;
+
+template <typename T>
+inline
+std::string repr(const T &val)
+{
+    using namespace _internal_v3;
+
+#ifdef LIBREPR_CALLSITE_STATS
+    CallsiteTimer<T> timer;
+#endif
+
+    std::stringstream ss;
+    PrintContext ctx(ss);
+    Stringify(ctx, val);
+
+#ifdef LIBREPR_CALLSITE_STATS
+    std::string res = ss.str();
+    timer.finish(res.size());
+    return res;
+#else
+    return ss.str();
+#endif
+}
+
+// Same as above, but stops printing with a "..." marker once any of the limits in `opts` is reached
+template <typename T>
+inline
+std::string repr(const T &val, const ReprOptions &opts)
+{
+    using namespace _internal_v3;
+
+#ifdef LIBREPR_CALLSITE_STATS
+    CallsiteTimer<T> timer;
+#endif
+
+    std::stringstream ss;
+    PrintContext ctx(ss, opts);
+    Stringify(ctx, val);
+    std::string res = FinishRepr(ss, ctx, opts);
+
+#ifdef LIBREPR_CALLSITE_STATS
+    timer.finish(res.size());
+#endif
+    return res;
+}
+
+// Prints the members which differ between `old_val` and `new_val`, e.g. `.pos.x: 1 -> 2, .hp: 10 -> 7`. Members are
+// compared by their bytes first, only the ones which differ are printed. Returns an empty string if nothing changed.
+template <typename T>
+inline
+std::string repr_diff(const T &old_val, const T &new_val)
+{
+    using namespace _internal_v3;
+
+    StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+    if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+    {
+        LibReprGlobalCache::InitializeStringifier(&fnti);
+    }
+
+    std::string res;
+    DwarfStringify2::Diff(res, fnti, reinterpret_cast<const char*>(&old_val), reinterpret_cast<const char*>(&new_val), sizeof(T));
+    return res;
+}
+
+using ReprCache = _internal_v3::ReprCache;
+using ReprCacheStats = _internal_v3::ReprCacheStats;
+
+using ThrottlePolicy = _internal_v3::ThrottlePolicy;
+using ThrottleOptions = _internal_v3::ThrottleOptions;
+using ThrottleStats = _internal_v3::ThrottleStats;
+using Throttle = _internal_v3::Throttle;
+
+// Same as repr, but only if `throttle` lets the call through, otherwise returns an empty string without formatting
+// anything. The first call printed after suppressed ones is prefixed with their count, e.g. "[41 suppressed] {...}".
+//
+//   static librepr::Throttle throttle(opts);
+//   if (std::string text = librepr::repr(msg, throttle); !text.empty()) log(text);
+template <typename T>
+inline
+std::string repr(const T &val, Throttle &throttle, const ReprOptions &opts = {})
+{
+    if (!throttle.admit(val))
+    {
+        return {};
+    }
+
+    std::string res = repr(val, opts);
+    if (!throttle.finish<T>(res, opts.format))
+    {
+        return {};
+    }
+    return res;
+}
+
+using CaptureDecoder = _internal_v3::CaptureDecoder;
+
+// Size of the record written by capture() for a T
+template <typename T>
+constexpr size_t capture_size()
+{
+    return sizeof(_internal_v3::CaptureHeader) + sizeof(T);
+}
+
+// Writes a binary record of `val` into `buf` without formatting it, the record can be printed later by
+// librepr-decode (or CaptureDecoder) given the same executable. Only the bytes of the object itself are kept, anything
+// it points to outside of itself prints as "???". Objects of polymorphic types are kept whole as their dynamic type,
+// which may need more than capture_size<T>(). Returns the size of the record, or 0 if `len` is too small.
+template <typename T>
+inline
+size_t capture(const T &val, void *buf, size_t len)
+{
+    using namespace _internal_v3;
+
+    StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+    if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+    {
+        LibReprGlobalCache::InitializeStringifier(&fnti);
+    }
+
+    PrintedObject obj = ResolvePrintedObject(fnti, val);
+    size_t size = sizeof(CaptureHeader) + obj.size;
+    if (len < size)
+    {
+        return 0;
+    }
+
+    CaptureHeader header;
+    header.magic = CaptureHeader::kMagic;
+    header.size = obj.size;
+    header.build_id = gBuildIdHash.load(std::memory_order_relaxed);
+    header.type_die = obj.fnti->type_die;
+    header.address = reinterpret_cast<uint64_t>(obj.data);
+
+    memcpy(buf, &header, sizeof(header));
+    memcpy((char*)buf + sizeof(header), obj.data, obj.size);
+    return size;
+}
+
+using BackpressurePolicy = _internal_v3::BackpressurePolicy;
+using AsyncOptions = _internal_v3::AsyncOptions;
+using AsyncStats = _internal_v3::AsyncStats;
+using AsyncCallback = _internal_v3::AsyncCallback;
+
+// Sets the options used by repr_async, must be called before its first use. Returns false if it is too late.
+inline
+bool configure_async(const AsyncOptions &opts)
+{
+    using namespace _internal_v3;
+
+    HoldAcrossFork<gAsyncOptionsMut>();
+    std::lock_guard<std::mutex> guard(gAsyncOptionsMut);
+    if (gAsyncStarted)
+    {
+        return false;
+    }
+    gAsyncOptions = opts;
+    return true;
+}
+
+// Copies the bytes of `val` into a ring owned by the calling thread and returns, a background thread prints it later
+// and passes the text to `callback`. Like capture(), only the object itself is copied (whole, as its dynamic type, for
+// polymorphic types) and anything it points to outside of itself prints as "???". Callbacks are called from the
+// formatter thread one at a time, in order for records from the same thread.
+template <typename T>
+inline
+void repr_async(const T &val, AsyncCallback callback, void *user = nullptr)
+{
+    using namespace _internal_v3;
+
+    StringifyFuncAndTypeInfo &fnti = GetPrinter<T>();
+    if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+    {
+        LibReprGlobalCache::InitializeStringifier(&fnti);
+    }
+
+    PrintedObject obj = ResolvePrintedObject(fnti, val);
+    AsyncRecord rec;
+    rec.obj_size = obj.size;
+    rec.fnti = obj.fnti;
+    rec.callback = callback;
+    rec.user = user;
+    rec.address = reinterpret_cast<uint64_t>(obj.data);
+    AsyncFormatter::instance().push(rec, obj.data);
+}
+
+// Same as above, writes a line to `out` for each record. `out` must outlive the record.
+template <typename T>
+inline
+void repr_async(const T &val, std::ostream &out)
+{
+    repr_async(val, [](void *user, std::string_view text)
+    {
+        *static_cast<std::ostream*>(user) << text << '\n';
+    }, &out);
+}
+
+// Waits until all records queued so far are passed to their callbacks. Must not be called from a callback.
+inline
+void flush_async()
+{
+    _internal_v3::AsyncFormatter::instance().flush();
+}
+
+inline
+AsyncStats async_stats()
+{
+    return _internal_v3::AsyncFormatter::instance().stats();
+}
+
+// Same as repr, but async-signal-safe, for crash handlers: it doesn't allocate, lock or load debug data. Values are
+// only printed if their stringifier was already bound by an earlier repr call (or preload), otherwise their bytes are
+// printed with the type name. Standard library types other than strings and vectors print as "???", and limits other
+// than the buffer size don't apply. Writes at most `len` bytes including a terminating NUL, output which doesn't fit
+// ends with "...". Returns the length written, not counting the NUL.
+template <typename T>
+inline
+size_t repr_signal_safe(const T &val, char *buf, size_t len)
+{
+    using namespace _internal_v3;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    SignalSafeWriter out{buf, len - 1};
+    const StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+    const char *obj = reinterpret_cast<const char*>(&val);
+    if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll || fnti.func == DwarfStringify2::Unknown)
+    {
+        SignalSafePrinter::RawBytes(out, TypeName<T>(), obj, sizeof(T));
+    }
+    else
+    {
+        SignalSafePrinter::Print(out, fnti, obj, 0);
+    }
+
+    if (out.truncated && out.pos >= 3)
+    {
+        memcpy(buf + out.pos - 3, "...", 3);
+    }
+    buf[out.pos] = 0;
+    return out.pos;
+}
+
+using FieldSelection = _internal_v3::FieldSelection;
+
+// Selects member paths for repr, e.g. fields(".header.seq", ".status", ".legs[*].px"). Paths are made of `.member`,
+// `[index]` and `[*]` (every element of an array or std::vector). Keep the selection, e.g. in a static: it holds the
+// resolved paths, a selection made for each call is resolved again through a locked lookup.
+template <typename... Paths>
+inline
+FieldSelection fields(const Paths &...paths)
+{
+    FieldSelection res;
+    (res.paths.emplace_back(paths), ...);
+    for (const std::string &path : res.paths)
+    {
+        res.key += path;
+        res.key += '\n';
+    }
+    return res;
+}
+
+// Prints only the selected members of `val`, e.g. "{.header.seq=5, .legs[*].px={1.5, 2.5}}". The paths are resolved
+// once for each type, later calls only read the selected members. Paths which can't be resolved print "???". Output is
+// cut at `opts.max_bytes` like other reprs.
+template <typename T>
+inline
+std::string repr(const T &val, const FieldSelection &fields, const ReprOptions &opts = {})
+{
+    using namespace _internal_v3;
+
+    const FieldProjection &projection = GetProjection<T>(fields);
+    std::stringstream ss;
+    PrintContext ctx(ss, opts);
+    projection.print(ctx, &val);
+    return FinishRepr(ss, ctx, opts);
+}
+
+using FieldKind = _internal_v3::FieldKind;
+using TypeLayout = _internal_v3::TypeLayout;
+using FieldLayout = _internal_v3::FieldLayout;
+using BaseLayout = _internal_v3::BaseLayout;
+using EnumeratorLayout = _internal_v3::EnumeratorLayout;
+
+// Layout of T as repr sees it: members with their offsets, sizes and types, base classes, enumerators and the storage
+// of standard library types. Built on the first call for each type and kept for the lifetime of the program, so the
+// reference may be held and shared between threads. Types which can't be resolved have kind FieldKind::Unknown.
+template <typename T>
+inline
+const TypeLayout& layout_of()
+{
+    using namespace _internal_v3;
+
+    static const TypeLayout &res = []() -> const TypeLayout&
+    {
+        StringifyFuncAndTypeInfo &fnti = GetStringifier<T>();
+        if (LoadBoundFunc(fnti) == LibReprGlobalCache::InitializeAll)
+        {
+            LibReprGlobalCache::InitializeStringifier(&fnti);
+        }
+
+        HoldAcrossFork<gLayoutsMut>();
+        std::lock_guard<std::mutex> guard(gLayoutsMut);
+        return *LayoutReflection::Get(gLayouts, fnti, sizeof(T));
+    }();
+    return res;
+}
+
+using SpanFormat = _internal_v3::SpanFormat;
+
+// Prints `count` objects starting at `data` as a table with a column per member, see SpanFormat. Member names are
+// printed once, and each member is formatted across all objects at once. Types other than structs print as a single
+// "value" column.
+template <typename T>
+inline
+std::string repr_span(const T *data, size_t count, SpanFormat format = SpanFormat::Rows)
+{
+    return _internal_v3::SpanPrinter::Print(data, count, format);
+}
+
+template <typename T, typename Alloc>
+inline
+std::string repr_span(const std::vector<T, Alloc> &vec, SpanFormat format = SpanFormat::Rows)
+{
+    return repr_span(vec.data(), vec.size(), format);
+}
+
+// Number of repr calls so far which were truncated due to ReprOptions limits
+inline
+uint64_t truncated_repr_count()
+{
+    return _internal_v3::gTruncatedReprCount.load(std::memory_order_relaxed);
+}
+
+using ReprStats = _internal_v3::ReprStats;
+using FallbackReason = _internal_v3::FallbackReason;
+
+#ifdef LIBREPR_CALLSITE_STATS
+using CallsiteStats = _internal_v3::CallsiteStats;
+
+// Calls, output bytes and latency histogram of repr for each type printed so far, summed over all threads. Only
+// available when built with LIBREPR_CALLSITE_STATS.
+inline
+std::vector<CallsiteStats> callsite_stats()
+{
+    return _internal_v3::CallsiteRegistry::instance().snapshot();
+}
+#endif
+
+// Time and memory spent loading the debug data, and why any values print as "???". Empty until the first value is
+// printed. Setting LIBREPR_STATS in the environment writes them to std::cerr at exit.
+inline
+ReprStats stats()
+{
+    return _internal_v3::CurrentStats();
+}
+
+using PreloadOptions = _internal_v3::PreloadOptions;
+
+// Loads the debug data and binds all stringifiers on a background thread, so that the first repr call doesn't pay for
+// it. Until it's done, repr prints the raw bytes of values (after waiting up to `opts.max_wait`). Later calls only
+// update the options and return the same future. repr_diff, capture, ReprCache and repr_async still wait for it.
+inline
+std::shared_future<void> preload(const PreloadOptions &opts = {})
+{
+    return _internal_v3::LibReprGlobalCache::Preload(opts.max_wait);
+}
+
+// Loads the debug data and binds all stringifiers in the calling process, waiting for preload() if it's running, then
+// moves their layouts into a read-only MAP_SHARED mapping. Call it in a process which forks workers: the bound
+// stringifiers are inherited, so workers print without loading the debug data again, and all of them read one copy of
+// the layouts. Forking at any other point is safe too, but children which inherit unbound stringifiers load the debug
+// data themselves.
+inline
+void prepare_fork()
+{
+    _internal_v3::LibReprGlobalCache::ShareLayouts();
 }
 
 
@@ -0,0 +1,215 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// The SPSC ring behind repr_async, its backpressure policies and flush_async. Exits with 1 on the first failure.
+//
+// Build (debug info is required):
+//   g++ -std=c++17 -g -I.. async_ring.cpp -o async_ring -pthread
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <librepr.hpp>
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+using namespace librepr::_internal_v3;
+
+struct Order
+{
+    uint64_t id;
+    double price;
+    char pad[40];
+};
+
+// Records of varying sizes from one thread, drained by another: all arrive once, in order, across many wraparounds
+static void TestSpsc()
+{
+    AsyncRing ring(1024, BackpressurePolicy::Block, 1);
+    constexpr uint64_t kCount = 200000;
+
+    std::thread producer([&]()
+    {
+        char obj[200] = {};
+        for (uint64_t i = 0; i < kCount; ++i)
+        {
+            AsyncRecord rec = {};
+            rec.obj_size = 8 + i % 192;
+            memcpy(obj, &i, 8);
+            while (!ring.tryPush(rec, obj))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint64_t next = 0;
+    while (next < kCount)
+    {
+        size_t drained = ring.drain([&](const AsyncRecord &rec, const void *obj)
+        {
+            uint64_t id;
+            memcpy(&id, obj, 8);
+            CHECK(id == next);
+            CHECK(rec.obj_size == 8 + id % 192);
+            ++next;
+        });
+        if (!drained)
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ring.empty());
+}
+
+// A full ring refuses records until it is drained
+static void TestFull()
+{
+    AsyncRing ring(1024, BackpressurePolicy::Drop, 1);
+    AsyncRecord rec = {};
+    rec.obj_size = sizeof(Order);
+    Order order = {};
+
+    size_t pushed = 0;
+    while (ring.tryPush(rec, &order))
+    {
+        ++pushed;
+    }
+    CHECK(pushed == ring.capacity() / AsyncRing::recordSize(sizeof(Order)));
+    CHECK(ring.drain([](const AsyncRecord&, const void*) {}) == pushed);
+    CHECK(ring.tryPush(rec, &order));
+}
+
+// The formatter is held in the callback of the first record until `gRelease` is set, so that the ring fills up
+static std::atomic<bool> gRelease{false};
+static std::atomic<uint64_t> gCalls{0};
+
+static void HoldingCallback(void *, std::string_view)
+{
+    while (!gRelease.load())
+    {
+        std::this_thread::yield();
+    }
+    gCalls.fetch_add(1);
+}
+
+// Each policy runs in a child, since the async options can only be set once per process
+static void RunPolicy(BackpressurePolicy policy)
+{
+    AsyncOptions opts;
+    opts.ring_size = 1024;
+    opts.policy = policy;
+    opts.sample_rate = 4;
+    CHECK(librepr::configure_async(opts));
+
+    constexpr uint64_t kCount = 100;
+    std::thread releaser;
+    if (policy == BackpressurePolicy::Block)
+    {
+        releaser = std::thread([]() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); gRelease = true; });
+    }
+    for (uint64_t i = 0; i < kCount; ++i)
+    {
+        librepr::repr_async(Order{i, 1.5, {}}, HoldingCallback);
+    }
+    gRelease = true;
+    if (releaser.joinable())
+    {
+        releaser.join();
+    }
+    librepr::flush_async();
+
+    AsyncStats stats = librepr::async_stats();
+    CHECK(stats.enqueued + stats.dropped + stats.sampled_out == kCount);
+    CHECK(stats.formatted == stats.enqueued);
+    CHECK(gCalls.load() == stats.enqueued);
+    switch (policy)
+    {
+    case BackpressurePolicy::Drop:
+        CHECK(stats.dropped > 0);
+        CHECK(stats.sampled_out == 0);
+        break;
+    case BackpressurePolicy::Block:
+        CHECK(stats.enqueued == kCount);
+        CHECK(stats.blocked > 0);
+        break;
+    case BackpressurePolicy::Sample:
+        CHECK(stats.sampled_out > 0);
+        break;
+    }
+}
+
+static void TestPolicy(BackpressurePolicy policy)
+{
+    pid_t pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0)
+    {
+        RunPolicy(policy);
+        _exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// flush_async waits for the records of all threads, output cut by max_bytes counts as truncated
+static void TestFlush()
+{
+    AsyncOptions opts;
+    opts.repr_options.max_bytes = 8;
+    CHECK(librepr::configure_async(opts));
+
+    static std::atomic<uint64_t> calls{0};
+    uint64_t truncated = librepr::truncated_repr_count();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([]()
+        {
+            for (uint64_t i = 0; i < 1000; ++i)
+            {
+                librepr::repr_async(Order{i, 2.5, {}}, [](void *, std::string_view text)
+                {
+                    CHECK(text.size() == 11);
+                    calls.fetch_add(1);
+                });
+            }
+            librepr::flush_async();
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    librepr::flush_async();
+
+    AsyncStats stats = librepr::async_stats();
+    CHECK(calls.load() == stats.enqueued);
+    CHECK(stats.formatted == stats.enqueued);
+    CHECK(stats.enqueued + stats.dropped == 4000);
+    CHECK(librepr::truncated_repr_count() - truncated == stats.enqueued);
+}
+
+int main()
+{
+    TestSpsc();
+    TestFull();
+    TestPolicy(BackpressurePolicy::Drop);
+    TestPolicy(BackpressurePolicy::Block);
+    TestPolicy(BackpressurePolicy::Sample);
+    TestFlush();
+    printf("ok\n");
+}
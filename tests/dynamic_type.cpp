@@ -0,0 +1,70 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Polymorphic objects print as their dynamic type through every entry point: repr, ReprCache, repr_async and capture.
+// Exits with 1 on the first failure.
+//
+// Build (debug info is required):
+//   g++ -std=c++17 -g -I.. dynamic_type.cpp -o dynamic_type -pthread
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include <librepr.hpp>
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+struct Base
+{
+    virtual ~Base() = default;
+    int a = 1;
+};
+
+struct Derived : Base
+{
+    int extra = 42;
+    double more = 2.5;
+};
+
+// Output without the vptr, which differs between runs
+static std::string Members(std::string_view text)
+{
+    return std::string(text.substr(text.find(", .") + 2));
+}
+
+int main()
+{
+    Derived d;
+    const Base &b = d;
+    const std::string expected = ".a=1, .extra=42, .more=2.5}";
+    CHECK(Members(librepr::repr(b)) == expected);
+
+    librepr::ReprCache cache;
+    CHECK(Members(cache.repr(b)) == expected);
+    CHECK(Members(cache.repr(b)) == expected);
+
+    static std::string async;
+    librepr::repr_async(b, [](void *, std::string_view text) { async = Members(text); });
+    librepr::flush_async();
+    CHECK(async == expected);
+
+    // The record holds the whole Derived, so it doesn't fit in the size for a Base
+    char buf[librepr::capture_size<Derived>()];
+    CHECK(librepr::capture(b, buf, librepr::capture_size<Base>()) == 0);
+    size_t len = librepr::capture(b, buf, sizeof(buf));
+    CHECK(len == sizeof(buf));
+
+    std::ostringstream decoded;
+    librepr::CaptureDecoder decoder("/proc/self/exe");
+    CHECK(decoder.decode(buf, len, decoded) == len);
+    CHECK(Members(decoded.str()) == expected);
+
+    printf("ok\n");
+}
@@ -0,0 +1,152 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Printing in forked children: before and after prepare_fork, which moves the layouts into shared memory, and while
+// other threads of the parent print. Exits with 1 on the first failure.
+//
+// Build (debug info is required):
+//   g++ -std=c++17 -g -I.. fork.cpp -o fork -pthread
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <librepr.hpp>
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+enum class Side { Buy, Sell };
+
+struct Header
+{
+    uint64_t seq;
+};
+
+struct Order : Header
+{
+    Side side;
+    std::string symbol;
+    std::vector<int> fills;
+    std::optional<double> price;
+};
+
+static const Order kOrder = {{7}, Side::Sell, "a symbol longer than the small string buffer", {1, 2, 3}, 1.5};
+static const char kExpected[] = "{.seq=7, .side=Side::Sell, .symbol=\"a symbol longer than the small string buffer\", "
+    ".fills={1, 2, 3}, .price=1.5}";
+
+// Runs `fn` in a child and checks that it exits with 0
+static void InChild(const std::function<void()> &fn)
+{
+    pid_t pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0)
+    {
+        fn();
+        _exit(0);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void PrintInChild()
+{
+    CHECK(librepr::repr(kOrder) == kExpected);
+
+    // Data behind pointers isn't copied for repr_async
+    static std::atomic<int> calls{0};
+    librepr::repr_async(Header{7}, [](void *, std::string_view text)
+    {
+        CHECK(text == "{.seq=7}");
+        calls.fetch_add(1);
+    });
+    librepr::flush_async();
+    CHECK(calls.load() == 1);
+}
+
+// Whether a read-only shared mapping of this process holds `p`
+static bool InSharedMemory(const void *p)
+{
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        uintptr_t begin, end;
+        char perms[5];
+        if (sscanf(line.c_str(), "%lx-%lx %4s", &begin, &end, perms) == 3 && std::string(perms) == "r--s"
+            && reinterpret_cast<uintptr_t>(p) >= begin && reinterpret_cast<uintptr_t>(p) < end)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main()
+{
+    // Children forked before anything is loaded load the debug data themselves
+    InChild(PrintInChild);
+
+    librepr::prepare_fork();
+    CHECK(librepr::stats().shared_layout_bytes > 0);
+    CHECK(librepr::repr(kOrder) == kExpected);
+
+    // Bases are kept through the table the layouts are copied with
+    const librepr::TypeLayout &layout = librepr::layout_of<Order>();
+    CHECK(layout.bases.size() == 1 && layout.bases[0].name == "Header" && layout.bases[0].field_count == 1);
+
+    // The stringifier bound for Order points into the shared mapping, as does what it refers to
+    using namespace librepr::_internal_v3;
+    const StringifyFuncAndTypeInfo &fnti = GetStringifier<Order>();
+    CHECK(fnti.func == DwarfStringify2::Struct);
+    const auto *ti = reinterpret_cast<const DwarfStringify2::StructTypeInfo*>(fnti.type_info);
+    CHECK(InSharedMemory(ti));
+    CHECK(InSharedMemory(ti->members.data()));
+    CHECK(InSharedMemory(ti->members[0].name));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        InChild(PrintInChild);
+    }
+
+    // Forking while other threads print, hold locks and have records in flight
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            while (!stop.load())
+            {
+                CHECK(librepr::repr(kOrder) == kExpected);
+                librepr::repr_async(Header{7}, [](void *, std::string_view text) { CHECK(text == "{.seq=7}"); });
+            }
+        });
+    }
+    for (int i = 0; i < 20; ++i)
+    {
+        InChild(PrintInChild);
+    }
+    stop = true;
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    librepr::flush_async();
+
+    printf("ok\n");
+}
@@ -0,0 +1,172 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// repr_signal_safe called from signal handlers, for a raised signal and for a real SIGSEGV. Any allocation while a
+// handler runs aborts. Exits with 1 on the first failure.
+//
+// Build (debug info is required):
+//   g++ -std=c++17 -g -I.. signal_safe.cpp -o signal_safe -pthread
+
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <librepr.hpp>
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static std::atomic<bool> gInHandler{false};
+
+// GCC takes the malloc and free below for a mismatched pair once the replaced operators are inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size)
+{
+    if (gInHandler.load(std::memory_order_relaxed))
+    {
+        static const char msg[] = "allocation in a signal handler\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        abort();
+    }
+    if (void *p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+enum class Suit { Hearts, Spades };
+
+struct Card
+{
+    int rank;
+    Suit suit;
+};
+
+struct State
+{
+    uint64_t seq;
+    Card cards[2];
+    std::string name;
+    std::vector<int> fills;
+    std::optional<double> price;
+};
+
+struct Pair
+{
+    uint32_t a;
+    uint32_t b;
+};
+
+static State gState = {7, {{1, Suit::Hearts}, {12, Suit::Spades}}, "a name longer than the small string buffer", {1, 2, 3}, 1.5};
+static Pair gPair = {1, 2};
+
+// Written by the handlers
+static char gStateText[1024];
+static size_t gStateLen;
+static char gPairText[128];
+static char gShort[16];
+static size_t gShortLen;
+static sigjmp_buf gJump;
+static int *volatile gNull = nullptr;
+
+static void PrintAll()
+{
+    gInHandler = true;
+    gStateLen = librepr::repr_signal_safe(gState, gStateText, sizeof(gStateText));
+    librepr::repr_signal_safe(gPair, gPairText, sizeof(gPairText));
+    gShortLen = librepr::repr_signal_safe(gState, gShort, sizeof(gShort));
+    gInHandler = false;
+}
+
+static void OnSignal(int)
+{
+    PrintAll();
+}
+
+static void OnSegv(int)
+{
+    PrintAll();
+    siglongjmp(gJump, 1);
+}
+
+static void Reset()
+{
+    gStateText[0] = gPairText[0] = gShort[0] = 0;
+    gStateLen = gShortLen = 0;
+}
+
+// What the handlers wrote, compared to repr outside of them
+static void CheckOutput(const std::string &expected)
+{
+    CHECK(gStateLen == expected.size());
+    CHECK(gStateText == expected);
+    CHECK(std::string(gPairText) == "{.a=1, .b=2}");
+    CHECK(gShortLen == sizeof(gShort) - 1);
+    CHECK(std::string(gShort) == expected.substr(0, sizeof(gShort) - 4) + "...");
+}
+
+int main()
+{
+    struct sigaction sa = {};
+    sa.sa_handler = OnSignal;
+    sigemptyset(&sa.sa_mask);
+    CHECK(sigaction(SIGUSR1, &sa, nullptr) == 0);
+
+    // Nothing is loaded yet, values print as their raw bytes
+    Reset();
+    CHECK(raise(SIGUSR1) == 0);
+    CHECK(std::string(gPairText) == "<raw Pair 0100000002000000>");
+
+    // Binds all stringifiers
+    const std::string expected = librepr::repr(gState);
+    CHECK(expected == "{.seq=7, .cards={{.rank=1, .suit=Suit::Hearts}, {.rank=12, .suit=Suit::Spades}}, "
+        ".name=\"a name longer than the small string buffer\", .fills={1, 2, 3}, .price=1.5}");
+
+    Reset();
+    CHECK(raise(SIGUSR1) == 0);
+    CheckOutput(expected);
+
+    // A real fault, the handler jumps back out of it
+    sa.sa_handler = OnSegv;
+    CHECK(sigaction(SIGSEGV, &sa, nullptr) == 0);
+    Reset();
+    if (sigsetjmp(gJump, 1) == 0)
+    {
+        *gNull = 1;
+        CHECK(false);
+    }
+    CheckOutput(expected);
+
+    // Same with the layouts in the read-only shared memory of prepare_fork
+    librepr::prepare_fork();
+    Reset();
+    CHECK(raise(SIGUSR1) == 0);
+    CheckOutput(expected);
+
+    printf("ok\n");
+}
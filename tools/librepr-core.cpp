@@ -0,0 +1,544 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Prints global variables, or objects at given addresses, from a core file of an executable built with debug data.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-core.cpp -o librepr-core
+//
+// Usage:
+//   librepr-core [--json] [--max-elements N] <executable> <core> <target>...
+//
+// Each target is printed on its own line as `target = value`, and is one of:
+//   symbol          A global or static member variable by qualified name, e.g. `app::gConfig`
+//   symbol:Type     The variable printed as another type
+//   0xADDR:Type     An object at an address of the crashed process, e.g. `0x5581a2c0:app::Session`
+//
+// Types are structs, classes, enums, typedefs and base types by qualified name. Pointers in printed objects are
+// followed through the core's memory. Memory which isn't in the core (e.g. read-only data) is read from the
+// executable, that of shared libraries is printed as unreadable.
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <librepr.hpp>
+
+using namespace librepr::_internal_v3;
+
+// A read only mapping of a whole file
+struct MappedFile
+{
+    explicit MappedFile(const char *path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("Can't open ") + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size = st.st_size;
+            void *res = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = res == MAP_FAILED ? nullptr : (const char*)res;
+        }
+        close(fd);
+        if (!data || size < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0 || data[EI_CLASS] != ELFCLASS64)
+        {
+            throw std::runtime_error(std::string(path) + " isn't a 64 bit ELF file");
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+        {
+            munmap((void*)data, size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const Elf64_Ehdr& header() const
+    {
+        return *reinterpret_cast<const Elf64_Ehdr*>(data);
+    }
+
+    const Elf64_Phdr* programHeader(size_t i) const
+    {
+        const Elf64_Ehdr &ehdr = header();
+        uint64_t off = ehdr.e_phoff + i * ehdr.e_phentsize;
+        if (off + sizeof(Elf64_Phdr) > size)
+        {
+            throw std::runtime_error("Truncated program headers");
+        }
+        return reinterpret_cast<const Elf64_Phdr*>(data + off);
+    }
+
+    const char *data = nullptr;
+    size_t size = 0;
+};
+
+// Memory of the crashed process, from the PT_LOAD segments of the core, then those of the executable
+struct CoreMemory
+{
+    struct Segment
+    {
+        uint64_t vaddr;
+        uint64_t size;
+        const char *data;
+    };
+
+    std::vector<Segment> segments;
+
+    void add(const MappedFile &file, const Elf64_Phdr &phdr, uint64_t bias)
+    {
+        if (phdr.p_type == PT_LOAD && phdr.p_filesz > 0 && phdr.p_offset + phdr.p_filesz <= file.size)
+        {
+            segments.push_back({phdr.p_vaddr + bias, phdr.p_filesz, file.data + phdr.p_offset});
+        }
+    }
+
+    static const char* Read(void *user, uint64_t addr, size_t len)
+    {
+        for (const Segment &seg : static_cast<CoreMemory*>(user)->segments)
+        {
+            if (addr >= seg.vaddr && addr - seg.vaddr <= seg.size && len <= seg.size - (addr - seg.vaddr))
+            {
+                return seg.data + (addr - seg.vaddr);
+            }
+        }
+        return nullptr;
+    }
+
+    static uint64_t AddressOf(void *user, const char *local)
+    {
+        for (const Segment &seg : static_cast<CoreMemory*>(user)->segments)
+        {
+            if (local >= seg.data && local <= seg.data + seg.size)
+            {
+                return seg.vaddr + (local - seg.data);
+            }
+        }
+        return 0;
+    }
+
+    MemoryView view()
+    {
+        return {this, Read, AddressOf};
+    }
+};
+
+// What the notes of the core tell about where the executable was loaded
+struct CoreNotes
+{
+    uint64_t entry = 0; // AT_ENTRY from NT_AUXV
+    std::vector<std::pair<std::string, uint64_t>> files; // Mappings at file offset 0 from NT_FILE, by path
+};
+
+static CoreNotes ReadNotes(const MappedFile &core)
+{
+    CoreNotes res;
+    for (size_t i = 0; i < core.header().e_phnum; ++i)
+    {
+        const Elf64_Phdr &phdr = *core.programHeader(i);
+        if (phdr.p_type != PT_NOTE || phdr.p_offset + phdr.p_filesz > core.size)
+        {
+            continue;
+        }
+
+        const char *it = core.data + phdr.p_offset;
+        const char *end = it + phdr.p_filesz;
+        auto align = [](uint64_t n) { return (n + 3) & ~3ull; };
+        while (end - it >= (ptrdiff_t)sizeof(Elf64_Nhdr))
+        {
+            const Elf64_Nhdr &note = *reinterpret_cast<const Elf64_Nhdr*>(it);
+            const char *desc = it + sizeof(Elf64_Nhdr) + align(note.n_namesz);
+            if (desc > end || note.n_descsz > (uint64_t)(end - desc))
+            {
+                break;
+            }
+            it = desc + align(note.n_descsz);
+
+            if (note.n_type == NT_AUXV)
+            {
+                const Elf64_auxv_t *aux = reinterpret_cast<const Elf64_auxv_t*>(desc);
+                for (size_t j = 0; j < note.n_descsz / sizeof(Elf64_auxv_t) && aux[j].a_type != AT_NULL; ++j)
+                {
+                    if (aux[j].a_type == AT_ENTRY)
+                    {
+                        res.entry = aux[j].a_un.a_val;
+                    }
+                }
+            }
+            else if (note.n_type == NT_FILE && note.n_descsz >= 16)
+            {
+                // count, page size, {start, end, offset in pages} * count, then the paths
+                const uint64_t *words = reinterpret_cast<const uint64_t*>(desc);
+                uint64_t count = words[0];
+                if (count > (note.n_descsz - 16) / 24)
+                {
+                    continue;
+                }
+                const char *name = desc + 16 + count * 24;
+                for (uint64_t j = 0; j < count && name < desc + note.n_descsz; ++j)
+                {
+                    std::string path(name, strnlen(name, desc + note.n_descsz - name));
+                    name += path.size() + 1;
+                    if (words[2 + j * 3 + 2] == 0)
+                    {
+                        res.files.push_back({std::move(path), words[2 + j * 3]});
+                    }
+                }
+            }
+        }
+    }
+    return res;
+}
+
+// Difference between the addresses in the crashed process and the link time addresses of the executable, nonzero for
+// position independent executables. Taken from the entry point in the auxiliary vector, or from where the executable
+// was mapped if the core has no NT_AUXV.
+static uint64_t LoadBias(const MappedFile &exe, const char *exePath, const CoreNotes &notes)
+{
+    const Elf64_Ehdr &ehdr = exe.header();
+    if (ehdr.e_type != ET_DYN)
+    {
+        return 0;
+    }
+    if (notes.entry)
+    {
+        return notes.entry - ehdr.e_entry;
+    }
+
+    std::string_view base = exePath;
+    base = base.substr(base.rfind('/') + 1);
+    uint64_t firstVaddr = UINT64_MAX;
+    for (size_t i = 0; i < ehdr.e_phnum; ++i)
+    {
+        const Elf64_Phdr &phdr = *exe.programHeader(i);
+        if (phdr.p_type == PT_LOAD && phdr.p_offset == 0)
+        {
+            firstVaddr = std::min(firstVaddr, phdr.p_vaddr);
+        }
+    }
+    for (const auto &[path, start] : notes.files)
+    {
+        if (firstVaddr != UINT64_MAX && std::string_view(path).substr(path.rfind('/') + 1) == base)
+        {
+            return start - firstVaddr;
+        }
+    }
+    throw std::runtime_error("Can't find where the executable was loaded in the core");
+}
+
+// Variable or type found in the debug data
+struct DieRef
+{
+    bool found = false;
+    size_t cu_idx = 0;
+    uint64_t type_offset = 0; // Of the variable's type, or of the type itself
+    uint64_t address = 0;     // Link time address of variables
+    bool polymorphic = false; // Types with a vtable, printed as their dynamic type
+};
+
+struct Target
+{
+    std::string text;
+    std::string symbol; // Empty when an address is given
+    std::string type;   // Empty for the variable's own type
+    uint64_t address = 0;
+};
+
+// Splits `symbol:Type` on its single colon, `::` is part of qualified names
+static Target ParseTarget(const std::string &text)
+{
+    Target res;
+    res.text = text;
+    size_t sep = std::string::npos;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] == ':' && i + 1 < text.size() && text[i + 1] == ':')
+        {
+            ++i;
+        }
+        else if (text[i] == ':')
+        {
+            sep = i;
+            break;
+        }
+    }
+
+    std::string first = text.substr(0, sep);
+    if (sep != std::string::npos)
+    {
+        res.type = text.substr(sep + 1);
+    }
+    if (first.size() > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X'))
+    {
+        char *end;
+        res.address = strtoull(first.c_str(), &end, 16);
+        if (*end || res.type.empty())
+        {
+            throw std::runtime_error("Expected 0xADDR:Type, got " + text);
+        }
+    }
+    else
+    {
+        res.symbol = first;
+    }
+    if (first.empty() || (sep != std::string::npos && res.type.empty()))
+    {
+        throw std::runtime_error("Invalid target " + text);
+    }
+    return res;
+}
+
+// Finds the wanted variables and types by qualified name in a single pass over the debug data. The first definition
+// of each one is used.
+static void FindDies(DebugDataLoader &loader, std::map<std::string, DieRef> &variables, std::map<std::string, DieRef> &types)
+{
+    size_t remaining = variables.size() + types.size();
+    for (size_t i = 0; i < loader.num_compilation_units() && remaining > 0; ++i)
+    {
+        // Declarations of static members and extern variables, by offset, which definitions refer to
+        std::unordered_map<uint64_t, std::pair<std::string, std::optional<uint64_t>>> declarations;
+
+        // Qualified name of each enclosing DIE as in librepr-dump, variables in scopes named "?" (e.g. function
+        // statics) can only be printed by address
+        std::vector<std::string> scopes;
+        for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
+        {
+            DwarfTag tag = acc.tag();
+            if (tag == DwarfTag::None)
+            {
+                if (!scopes.empty())
+                {
+                    scopes.pop_back();
+                }
+                continue;
+            }
+
+            std::string name = "?";
+            std::optional<std::string_view> ownName = acc.getCStringView(DwarfAttr::Name);
+            std::string prefix = scopes.empty() || scopes.back().empty() ? "" : scopes.back() + "::";
+            std::string qualified = prefix + std::string(ownName.value_or("?"));
+            bool named = ownName && qualified[0] != '?' && qualified.find("::?") == std::string::npos;
+
+            if (tag == DwarfTag::CompileUnit)
+            {
+                name.clear();
+            }
+            else if (tag == DwarfTag::Namespace || tag == DwarfTag::StructureType || tag == DwarfTag::ClassType
+                     || tag == DwarfTag::UnionType)
+            {
+                name = prefix + std::string(ownName.value_or(tag == DwarfTag::Namespace ? "(anonymous namespace)" : "?"));
+            }
+
+            if ((tag == DwarfTag::Variable || tag == DwarfTag::Member) && acc.has(DwarfAttr::Declaration) && named)
+            {
+                declarations[acc._offset - acc._cu->_offset] = {qualified, acc.getOffset(DwarfAttr::Type)};
+            }
+            else if (tag == DwarfTag::Variable && acc.has(DwarfAttr::Location))
+            {
+                std::optional<uint64_t> type = acc.getOffset(DwarfAttr::Type);
+                if (std::optional<uint64_t> spec = acc.getOffset(DwarfAttr::Specification))
+                {
+                    auto decl = declarations.find(*spec);
+                    named = decl != declarations.end();
+                    if (named)
+                    {
+                        qualified = decl->second.first;
+                        type = type ? type : decl->second.second;
+                    }
+                }
+
+                std::optional<uint64_t> address = acc.getOffset(DwarfAttr::Location);
+                auto it = named ? variables.find(qualified) : variables.end();
+                if (it != variables.end() && !it->second.found && type && address)
+                {
+                    it->second = {true, i, *type, *address};
+                    --remaining;
+                }
+            }
+            else if ((tag == DwarfTag::StructureType || tag == DwarfTag::ClassType || tag == DwarfTag::EnumerationType
+                      || tag == DwarfTag::Typedef || tag == DwarfTag::BaseType)
+                     && named && !acc.has(DwarfAttr::Declaration))
+            {
+                auto it = types.find(qualified);
+                if (it != types.end() && !it->second.found)
+                {
+                    it->second = {true, i, acc._offset - acc._cu->_offset};
+                    --remaining;
+                }
+            }
+
+            if (acc.has_children())
+            {
+                scopes.push_back(std::move(name));
+            }
+        }
+    }
+}
+
+// Prints the object at `address` of the crashed process, as its dynamic type if it's polymorphic
+static std::string Print(DebugDataLoader &loader, LibReprGlobalCache &cache, CoreMemory &memory, uint64_t bias,
+                         const DieRef &type, uint64_t address, const ReprOptions &opts)
+{
+    std::optional<uint64_t> size = cache.getTypeByteSize(loader, type.cu_idx, type.type_offset);
+    const char *local = memory.Read(&memory, address, size.value_or(0));
+    if (!size || !local)
+    {
+        std::ostringstream res;
+        res << "<unreadable at 0x" << std::hex << address << ">";
+        return res.str();
+    }
+
+    StringifyFuncAndTypeInfo fnti = cache.loadStringify(loader, type.cu_idx, type.type_offset);
+    DIEAccessor die = cache.resolveTypeDie(loader, type.cu_idx, type.type_offset);
+    if (die.has(DwarfAttr::ContainingType) && *size >= sizeof(uint64_t))
+    {
+        // The vtable starts with the offset of the whole object from this subobject, like dynamic_cast<void*>
+        uint64_t vptr = *reinterpret_cast<const uint64_t*>(local);
+        const char *offsetToTop = memory.Read(&memory, vptr - 2 * sizeof(uint64_t), sizeof(int64_t));
+        std::optional<DynamicType> dynamic = cache.loadDynamicStringify(loader, vptr - bias);
+        const char *whole = offsetToTop ? memory.Read(&memory, address + *reinterpret_cast<const int64_t*>(offsetToTop), 1) : nullptr;
+        if (dynamic && whole)
+        {
+            fnti = dynamic->fnti;
+            local = whole;
+        }
+    }
+
+    std::ostringstream res;
+    PrintContext ctx(res, opts);
+    MemoryView view = memory.view();
+    ctx.setMemoryView(view);
+    fnti.func(ctx, fnti.type_info, local);
+    return res.str();
+}
+
+static int Usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--json] [--max-elements N] <executable> <core> <symbol | symbol:Type | 0xADDR:Type>...\n";
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    ReprOptions opts;
+    opts.max_elements = 1000;
+    std::vector<const char*> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--json")
+        {
+            opts.format = OutputFormat::Json;
+        }
+        else if (arg == "--max-elements" && i + 1 < argc)
+        {
+            opts.max_elements = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg.substr(0, 2) != "--")
+        {
+            args.push_back(argv[i]);
+        }
+        else
+        {
+            return Usage(argv[0]);
+        }
+    }
+    if (args.size() < 3)
+    {
+        return Usage(argv[0]);
+    }
+
+    try
+    {
+        std::vector<Target> targets;
+        std::map<std::string, DieRef> variables, types;
+        for (size_t i = 2; i < args.size(); ++i)
+        {
+            targets.push_back(ParseTarget(args[i]));
+            if (!targets.back().symbol.empty())
+            {
+                variables[targets.back().symbol];
+            }
+            if (!targets.back().type.empty())
+            {
+                types[targets.back().type];
+            }
+        }
+
+        MappedFile exe(args[0]);
+        MappedFile core(args[1]);
+        if (core.header().e_type != ET_CORE)
+        {
+            throw std::runtime_error(std::string(args[1]) + " isn't a core file");
+        }
+
+        uint64_t bias = LoadBias(exe, args[0], ReadNotes(core));
+        CoreMemory memory;
+        for (size_t i = 0; i < core.header().e_phnum; ++i)
+        {
+            memory.add(core, *core.programHeader(i), 0);
+        }
+        for (size_t i = 0; i < exe.header().e_phnum; ++i)
+        {
+            memory.add(exe, *exe.programHeader(i), bias);
+        }
+
+        DebugDataLoader loader;
+        loader.loadFile(args[0]);
+        if (!loader._error.empty())
+        {
+            return 1;
+        }
+        FindDies(loader, variables, types);
+
+        LibReprGlobalCache cache;
+        int status = 0;
+        for (const Target &target : targets)
+        {
+            const DieRef *variable = target.symbol.empty() ? nullptr : &variables[target.symbol];
+            const DieRef *type = target.type.empty() ? variable : &types[target.type];
+            if (variable && !variable->found)
+            {
+                std::cerr << "Variable " << target.symbol << " not found in the debug data\n";
+                status = 1;
+                continue;
+            }
+            if (!type->found)
+            {
+                std::cerr << "Type " << target.type << " not found in the debug data\n";
+                status = 1;
+                continue;
+            }
+
+            uint64_t address = variable ? variable->address + bias : target.address;
+            std::cout << target.text << " = " << Print(loader, cache, memory, bias, *type, address, opts) << "\n";
+        }
+        return status;
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,83 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Prints records written by librepr::capture, one per line.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-decode.cpp -o librepr-decode
+//
+// Usage:
+//   librepr-decode [--json] <executable> [records-file]
+//
+// Records are read from stdin when no file is given, --json prints each record as a line of JSON. The executable must be the same build that wrote the records.
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include <librepr.hpp>
+
+int main(int argc, char *argv[])
+{
+    const char *prog = argv[0];
+    librepr::ReprOptions opts;
+    if (argc > 1 && std::string_view(argv[1]) == "--json")
+    {
+        opts.format = librepr::OutputFormat::Json;
+        --argc;
+        ++argv;
+    }
+
+    if (argc != 2 && argc != 3)
+    {
+        std::cerr << "Usage: " << prog << " [--json] <executable> [records-file]\n";
+        return 1;
+    }
+
+    std::vector<char> data;
+    if (argc == 3)
+    {
+        std::ifstream in(argv[2], std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "Can't open " << argv[2] << "\n";
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+
+    try
+    {
+        librepr::CaptureDecoder decoder(argv[1]);
+
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            size_t len = decoder.decode(data.data() + pos, data.size() - pos, std::cout, opts);
+            if (len == 0)
+            {
+                std::cerr << "Truncated record at offset " << pos << "\n";
+                return 1;
+            }
+            std::cout << "\n";
+            pos += len;
+        }
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
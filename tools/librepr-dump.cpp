@@ -0,0 +1,448 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Lists every struct, class and enum in the debug data of an executable with the layout librepr resolves for it,
+// without running the executable.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-dump.cpp -o librepr-dump -pthread
+//
+// Usage:
+//   librepr-dump [--json] [--jobs N] [--name TEXT]... [--namespace NS]... [--stats] <executable>
+//
+// --json        Writes a JSON object per type and line instead of text
+// --jobs N      Compilation units are processed by N threads (default: number of cores)
+// --name TEXT   Only types whose qualified name contains TEXT
+// --namespace NS  Only types in namespace NS (or nested in it)
+// --stats       Prints timings and counts to stderr
+//
+// Filters may be repeated, a type is listed if it matches any of them. Types defined in more than one compilation
+// unit are listed once, from the first unit defining them.
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <librepr.hpp>
+
+using namespace librepr::_internal_v3;
+
+struct Options
+{
+    bool json = false;
+    size_t jobs = 0;
+    std::vector<std::string> names;
+    std::vector<std::string> namespaces;
+    bool stats = false;
+    const char *path = nullptr;
+};
+
+struct Counts
+{
+    uint64_t failed = 0;
+    uint64_t unsupported = 0; // Members of types librepr can't print, e.g. unions
+    uint64_t dies = 0;
+};
+
+static const char* KindName(FieldKind kind)
+{
+    switch (kind)
+    {
+    case FieldKind::Unknown:   return "Unknown";
+    case FieldKind::Bool:      return "Bool";
+    case FieldKind::Integer:   return "Integer";
+    case FieldKind::Float:     return "Float";
+    case FieldKind::Enum:      return "Enum";
+    case FieldKind::Pointer:   return "Pointer";
+    case FieldKind::CString:   return "CString";
+    case FieldKind::Struct:    return "Struct";
+    case FieldKind::Array:     return "Array";
+    case FieldKind::CharArray: return "CharArray";
+    case FieldKind::Vector:    return "Vector";
+    case FieldKind::BitVector: return "BitVector";
+    case FieldKind::String:    return "String";
+    case FieldKind::List:      return "List";
+    case FieldKind::Tree:      return "Tree";
+    case FieldKind::Hashtable: return "Hashtable";
+    case FieldKind::Optional:  return "Optional";
+    case FieldKind::SmartPtr:  return "SmartPtr";
+    case FieldKind::Pair:      return "Pair";
+    }
+    return "Unknown";
+}
+
+static std::string JsonString(std::string_view text)
+{
+    std::string res = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            res += '\\';
+            res += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            const char *hex = "0123456789abcdef";
+            res += "\\u00";
+            res += hex[(c >> 4) & 0xf];
+            res += hex[c & 0xf];
+        }
+        else
+        {
+            res += c;
+        }
+    }
+    return res + "\"";
+}
+
+// Short description of a member type, e.g. "Vector of Integer (4 bytes, signed)". Nested structs are listed on their
+// own, only their size is printed here.
+static void DescribeText(std::ostream &out, const TypeLayout &type)
+{
+    out << KindName(type.kind);
+    if (type.kind == FieldKind::Enum)
+    {
+        out << " " << type.name;
+    }
+    if (type.size)
+    {
+        out << " (" << type.size << (type.size == 1 ? " byte" : " bytes") << ((type.kind == FieldKind::Integer || type.kind == FieldKind::Enum) && type.is_signed ? ", signed" : "") << ")";
+    }
+    if (type.kind == FieldKind::Array || type.kind == FieldKind::CharArray)
+    {
+        out << " [" << type.count << "]";
+    }
+    if (type.element)
+    {
+        out << " of ";
+        DescribeText(out, *type.element);
+    }
+}
+
+static void DescribeJson(std::ostream &out, const TypeLayout &type)
+{
+    out << "{\"kind\":\"" << KindName(type.kind) << "\",\"size\":" << type.size;
+    if (type.kind == FieldKind::Integer || type.kind == FieldKind::Enum)
+    {
+        out << ",\"signed\":" << (type.is_signed ? "true" : "false");
+    }
+    if (type.kind == FieldKind::Enum)
+    {
+        out << ",\"enum\":" << JsonString(type.name);
+    }
+    if (type.kind == FieldKind::Array || type.kind == FieldKind::CharArray)
+    {
+        out << ",\"count\":" << type.count;
+    }
+    if (type.element)
+    {
+        out << ",\"element_size\":" << type.element_size << ",\"element\":";
+        DescribeJson(out, *type.element);
+    }
+    out << "}";
+}
+
+static void WriteText(std::ostream &out, const std::string &name, const char *keyword, uint64_t size, const TypeLayout &layout)
+{
+    out << keyword << " " << name << ", " << size << " bytes\n";
+    if (layout.kind == FieldKind::Enum)
+    {
+        for (const EnumeratorLayout &e : layout.enumerators)
+        {
+            out << "    " << e.value << " " << e.name << "\n";
+        }
+    }
+    else if (layout.kind == FieldKind::Struct)
+    {
+        for (const BaseLayout &base : layout.bases)
+        {
+            out << "    base " << base.name << " at " << base.offset << "\n";
+        }
+        for (const FieldLayout &f : layout.fields)
+        {
+            out << "    " << f.offset << " " << f.name << ": ";
+            DescribeText(out, *f.type);
+            out << "\n";
+        }
+    }
+    else
+    {
+        // Standard library types are recognized as a whole
+        out << "    ";
+        DescribeText(out, layout);
+        out << "\n";
+    }
+    out << "\n";
+}
+
+static void WriteJson(std::ostream &out, const std::string &name, const char *keyword, uint64_t size, const TypeLayout &layout)
+{
+    out << "{\"name\":" << JsonString(name) << ",\"tag\":\"" << keyword << "\",\"size\":" << size << ",\"layout\":";
+    DescribeJson(out, layout);
+    if (layout.kind == FieldKind::Enum)
+    {
+        out << ",\"enumerators\":[";
+        for (size_t i = 0; i < layout.enumerators.size(); ++i)
+        {
+            const EnumeratorLayout &e = layout.enumerators[i];
+            out << (i ? "," : "") << "{\"name\":" << JsonString(e.name) << ",\"value\":" << e.value << "}";
+        }
+        out << "]";
+    }
+    else if (layout.kind == FieldKind::Struct)
+    {
+        out << ",\"bases\":[";
+        for (size_t i = 0; i < layout.bases.size(); ++i)
+        {
+            const BaseLayout &base = layout.bases[i];
+            out << (i ? "," : "") << "{\"name\":" << JsonString(base.name) << ",\"offset\":" << base.offset
+                << ",\"first_field\":" << base.first_field << ",\"field_count\":" << base.field_count << "}";
+        }
+        out << "],\"fields\":[";
+        for (size_t i = 0; i < layout.fields.size(); ++i)
+        {
+            const FieldLayout &f = layout.fields[i];
+            out << (i ? "," : "") << "{\"name\":" << JsonString(f.name) << ",\"offset\":" << f.offset << ",\"type\":";
+            DescribeJson(out, *f.type);
+            out << "}";
+        }
+        out << "]";
+    }
+    out << "}\n";
+}
+
+static bool Matches(const Options &opts, const std::string &name)
+{
+    if (opts.names.empty() && opts.namespaces.empty())
+    {
+        return true;
+    }
+    for (const std::string &text : opts.names)
+    {
+        if (name.find(text) != std::string::npos)
+        {
+            return true;
+        }
+    }
+    for (const std::string &ns : opts.namespaces)
+    {
+        if (name.size() > ns.size() + 2 && name.compare(0, ns.size(), ns) == 0 && name.compare(ns.size(), 2, "::") == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Output of each listed type, by qualified name, with the unit it was taken from
+using Listing = std::map<std::string, std::pair<size_t, std::string>>;
+
+// Lists the types of the units it takes from `next`. Each worker has its own loader and cache, they share nothing but
+// the mapped file.
+static void Worker(const Options &opts, std::atomic<size_t> &next, Listing &res, Counts &counts)
+{
+    DebugDataLoader loader;
+    loader.loadFile(opts.path);
+    LibReprGlobalCache cache;
+    cache._quiet = true; // Unsupported members are counted instead
+    std::map<LayoutReflection::Key, std::unique_ptr<TypeLayout>> layouts;
+
+    for (size_t i; (i = next.fetch_add(1)) < loader.num_compilation_units(); )
+    {
+        // Qualified name of each enclosing DIE, like LibReprGlobalCache::loadVtables. Scopes which aren't namespaces
+        // or classes (e.g. functions) are named "?", types in them are skipped.
+        std::vector<std::string> scopes;
+        for (DIEAccessor acc = loader.loadCompilationUnitRootDie(i); acc; ++acc)
+        {
+            DwarfTag tag = acc.tag();
+            if (tag == DwarfTag::None)
+            {
+                if (!scopes.empty())
+                {
+                    scopes.pop_back();
+                }
+                continue;
+            }
+
+            std::string name = "?";
+            if (tag == DwarfTag::CompileUnit)
+            {
+                name.clear();
+            }
+            else if (tag == DwarfTag::Namespace || tag == DwarfTag::StructureType || tag == DwarfTag::ClassType
+                     || tag == DwarfTag::UnionType || tag == DwarfTag::EnumerationType)
+            {
+                std::optional<std::string_view> ownName = acc.getCStringView(DwarfAttr::Name);
+                name = scopes.empty() || scopes.back().empty() ? "" : scopes.back() + "::";
+                name += ownName.value_or(tag == DwarfTag::Namespace ? "(anonymous namespace)" : "?");
+
+                bool listed = tag != DwarfTag::Namespace && tag != DwarfTag::UnionType && ownName
+                    && !acc.has(DwarfAttr::Declaration) && name[0] != '?' && name.find("::?") == std::string::npos;
+                if (listed && Matches(opts, name) && (!res.count(name) || res[name].first > i))
+                {
+                    const char *keyword = tag == DwarfTag::EnumerationType ? "enum" : tag == DwarfTag::ClassType ? "class" : "struct";
+                    uint64_t size = acc.getUnsigned(DwarfAttr::ByteSize).value_or(0);
+                    std::ostringstream out;
+                    bool ok = true;
+                    try
+                    {
+                        StringifyFuncAndTypeInfo fnti = cache.loadStringify(loader, i, acc._offset - acc._cu->_offset);
+                        const TypeLayout &layout = *LayoutReflection::Get(layouts, fnti, size);
+                        if (opts.json)
+                        {
+                            WriteJson(out, name, keyword, size, layout);
+                        }
+                        else
+                        {
+                            WriteText(out, name, keyword, size, layout);
+                        }
+                    }
+                    catch (const std::exception&)
+                    {
+                        ++counts.failed;
+                        ok = false;
+                    }
+                    if (ok)
+                    {
+                        res[name] = {i, out.str()};
+                    }
+                }
+            }
+
+            if (acc.has_children())
+            {
+                scopes.push_back(std::move(name));
+            }
+        }
+    }
+    counts.unsupported = cache._unsupported;
+    counts.dies = loader._dies_loaded;
+}
+
+static int Usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--json] [--jobs N] [--name TEXT]... [--namespace NS]... [--stats] <executable>\n";
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--json")
+        {
+            opts.json = true;
+        }
+        else if (arg == "--stats")
+        {
+            opts.stats = true;
+        }
+        else if ((arg == "--jobs" || arg == "--name" || arg == "--namespace") && i + 1 < argc)
+        {
+            const char *val = argv[++i];
+            if (arg == "--jobs")
+            {
+                const char *end = val + strlen(val);
+                auto [ptr, ec] = std::from_chars(val, end, opts.jobs);
+                if (ec != std::errc() || ptr != end || opts.jobs == 0)
+                {
+                    return Usage(argv[0]);
+                }
+            }
+            else
+            {
+                (arg == "--name" ? opts.names : opts.namespaces).push_back(val);
+            }
+        }
+        else if (arg.substr(0, 2) != "--" && !opts.path)
+        {
+            opts.path = argv[i];
+        }
+        else
+        {
+            return Usage(argv[0]);
+        }
+    }
+    if (!opts.path)
+    {
+        return Usage(argv[0]);
+    }
+    if (opts.jobs == 0)
+    {
+        opts.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Checked once up front, so that a file which can't be loaded is reported once
+    size_t numUnits;
+    {
+        DebugDataLoader loader;
+        loader.loadFile(opts.path);
+        if (!loader._error.empty())
+        {
+            return 1;
+        }
+        numUnits = loader.num_compilation_units();
+    }
+    opts.jobs = std::min(opts.jobs, std::max<size_t>(numUnits, 1));
+
+    std::atomic<size_t> next{0};
+    std::vector<Listing> listings(opts.jobs);
+    std::vector<Counts> counts(opts.jobs);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < opts.jobs; ++t)
+    {
+        threads.emplace_back(Worker, std::cref(opts), std::ref(next), std::ref(listings[t]), std::ref(counts[t]));
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Types seen by more than one worker are taken from the first unit defining them, as a single thread would
+    Listing merged;
+    Counts total;
+    for (size_t t = 0; t < opts.jobs; ++t)
+    {
+        for (auto &[name, entry] : listings[t])
+        {
+            auto it = merged.find(name);
+            if (it == merged.end() || it->second.first > entry.first)
+            {
+                merged[name] = std::move(entry);
+            }
+        }
+        total.failed += counts[t].failed;
+        total.unsupported += counts[t].unsupported;
+        total.dies += counts[t].dies;
+    }
+
+    for (const auto &[name, entry] : merged)
+    {
+        std::cout << entry.second;
+    }
+    std::cout.flush();
+
+    if (opts.stats)
+    {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "units: " << numUnits << ", threads: " << opts.jobs << ", types: " << merged.size()
+                  << ", failed: " << total.failed << ", unsupported members: " << total.unsupported << ", dies: " << total.dies << ", time: " << elapsed.count() << " ms\n";
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Stores the layouts of every type printed by an executable into its .librepr section, so that it still prints after
+// its debug data is stripped.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-embed.cpp -o librepr-embed
+//
+// Usage:
+//   librepr-embed <executable> <output>
+//
+// The output is a copy of the executable with the section added, made by objcopy (set OBJCOPY to use another one).
+// It may then be stripped. The section must be written again whenever the executable is relinked.
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <librepr.hpp>
+
+extern char **environ;
+
+using namespace librepr::_internal_v3;
+
+class LayoutWriter
+{
+public:
+    LayoutWriter(DebugDataLoader &loader, LibReprGlobalCache &cache)
+        : _loader(loader)
+        , _cache(cache)
+    {
+    }
+
+    void addCallsite(size_t cu_idx, uint64_t typeDieOffset, uint64_t typeHash, uint64_t fntiLocation)
+    {
+        // The same type appears once in each compilation unit using it, any of them will do
+        auto it = _roots.find(typeHash);
+        if (typeHash == 0 || it == _roots.end())
+        {
+            uint64_t node = _writer.add(_cache.loadStringify(_loader, cu_idx, typeDieOffset));
+            it = _roots.emplace(typeHash, node).first;
+        }
+        _writer.bind(fntiLocation, it->second);
+    }
+
+    std::string write(uint64_t buildIdHash, uint64_t markerLocation)
+    {
+        return _writer.write(buildIdHash, markerLocation);
+    }
+
+private:
+    DebugDataLoader &_loader;
+    LibReprGlobalCache &_cache;
+
+    LayoutTable::Writer _writer;
+    std::map<uint64_t, uint64_t> _roots; // Node of each TypeHash
+};
+
+static int runObjcopy(const char *input, const std::string &section, const char *output)
+{
+    const char *objcopy = getenv("OBJCOPY") ? getenv("OBJCOPY") : "objcopy";
+    std::string remove = "--remove-section=.librepr";
+    std::string add = "--add-section=.librepr=" + section;
+    std::vector<char*> args = {
+        const_cast<char*>(objcopy), remove.data(), add.data(), const_cast<char*>(input), const_cast<char*>(output), nullptr
+    };
+
+    pid_t pid;
+    if (posix_spawnp(&pid, objcopy, nullptr, nullptr, args.data(), environ) != 0)
+    {
+        std::cerr << "Can't run " << objcopy << "\n";
+        return 1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        std::cerr << objcopy << " failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <executable> <output>\n";
+        return 1;
+    }
+
+    std::string table;
+    try
+    {
+        DebugDataLoader loader;
+        loader.loadFile(argv[1]);
+
+        LibReprGlobalCache cache;
+        LayoutWriter writer(loader, cache);
+        LibReprGlobalCache::forEachCallsite(loader, [&](size_t cu_idx, uint64_t typeDieOffset, uint64_t typeHash, uint64_t fntiLocation)
+        {
+            writer.addCallsite(cu_idx, typeDieOffset, typeHash, fntiLocation);
+        });
+        table = writer.write(loader.rdd.buildIdHash(), LibReprGlobalCache::findMarkerLocation(loader));
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+
+    std::string section = std::string(argv[2]) + ".librepr.tmp";
+    {
+        std::ofstream out(section, std::ios::binary);
+        out.write(table.data(), table.size());
+        if (!out)
+        {
+            std::cerr << "Can't write " << section << "\n";
+            return 1;
+        }
+    }
+
+    int res = runObjcopy(argv[1], section, argv[2]);
+    remove(section.c_str());
+    return res;
+}
@@ -0,0 +1,410 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Writes a header of printers for every type printed by an executable, so that a later build doesn't need to load
+// any debug data for them.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-gen.cpp -o librepr-gen
+//
+// Usage:
+//   librepr-gen <executable> > repr_generated.hpp
+//
+// Then build again with -DLIBREPR_GENERATED_HEADER='"repr_generated.hpp"'. Types are matched by their name, so the
+// header must be regenerated when any of the printed types change.
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <librepr.hpp>
+
+using namespace librepr::_internal_v3;
+
+class HeaderGenerator
+{
+public:
+    HeaderGenerator(DebugDataLoader &loader, LibReprGlobalCache &cache)
+        : _loader(loader)
+        , _cache(cache)
+    {
+    }
+
+    void addType(uint64_t typeHash, size_t cu_idx, uint64_t typeDieOffset)
+    {
+        // The same type appears once in each compilation unit using it, any of them will do
+        if (typeHash == 0 || _roots.count(typeHash))
+        {
+            return;
+        }
+
+        std::optional<uint64_t> size = _cache.getTypeByteSize(_loader, cu_idx, typeDieOffset);
+        if (!size)
+        {
+            return;
+        }
+
+        StringifyFuncAndTypeInfo fnti = _cache.loadStringify(_loader, cu_idx, typeDieOffset);
+        _roots[typeHash] = Root{*size, emit(fnti)};
+    }
+
+    void write(std::ostream &out)
+    {
+        out << "// Generated by librepr-gen, do not edit\n\n";
+        out << "#pragma once\n\n";
+        out << "namespace librepr::_internal_v3 {\n\n";
+        out << "namespace generated {\n\n";
+        out << _declarations.str() << "\n";
+        out << _definitions.str();
+        out << "} // namespace generated\n\n";
+
+        for (const auto &[typeHash, root] : _roots)
+        {
+            out << "template <>\n";
+            out << "struct GeneratedStringifier<0x" << std::hex << typeHash << std::dec << "ull>\n";
+            out << "{\n";
+            out << "    static constexpr bool available = true;\n";
+            out << "    static constexpr size_t size = " << root.size << ";\n";
+            out << "\n";
+            out << "    static void print(PrintContext &ctx, void *, const void *obj)\n";
+            out << "    {\n";
+            out << "        using namespace generated;\n";
+            out << "        " << call(root.printer, "obj") << ";\n";
+            out << "    }\n";
+            out << "\n";
+            out << "    static inline StringifyFuncAndTypeInfo fnti = {print, nullptr};\n";
+            out << "};\n\n";
+        }
+
+        out << "} // namespace librepr::_internal_v3\n";
+    }
+
+private:
+    // How generated code refers to a stringifier: a function and the type info it's called with
+    struct Printer
+    {
+        std::string func;
+        std::string type_info = "nullptr";
+    };
+
+    struct Root
+    {
+        size_t size;
+        Printer printer;
+    };
+
+    static std::string call(const Printer &printer, const std::string &obj)
+    {
+        return printer.func + "(ctx, " + printer.type_info + ", " + obj + ")";
+    }
+
+    static std::string initializer(const Printer &printer)
+    {
+        return "{" + printer.func + ", " + printer.type_info + "}";
+    }
+
+    // Escapes arbitrary bytes (e.g. MessagePack headers) into a string literal
+    static std::string quoted(std::string_view text)
+    {
+        std::stringstream ss;
+        ss << '"';
+        for (unsigned char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                ss << '\\' << c;
+            }
+            else if (c < 0x20 || c >= 0x7f)
+            {
+                // Always 3 digits, so that a following digit isn't taken as part of the escape
+                ss << '\\' << char('0' + (c >> 6)) << char('0' + ((c >> 3) & 7)) << char('0' + (c & 7));
+            }
+            else
+            {
+                ss << c;
+            }
+        }
+        ss << '"';
+        return ss.str();
+    }
+
+    // Same as above, as a string_view initializer, so that it may contain NUL
+    static std::string literal(std::string_view text)
+    {
+        return "{" + quoted(text) + ", " + std::to_string(text.size()) + "}";
+    }
+
+    template <typename T>
+    static std::string number(T val)
+    {
+        if constexpr (std::is_signed_v<T>)
+        {
+            return "static_cast<" + typeName<T>() + ">(" + (val == INT64_MIN ? std::string("-9223372036854775807ll-1") : std::to_string((int64_t)val) + "ll") + ")";
+        }
+        else
+        {
+            return "static_cast<" + typeName<T>() + ">(" + std::to_string((uint64_t)val) + "ull)";
+        }
+    }
+
+    template <typename T>
+    static std::string typeName()
+    {
+        if constexpr (std::is_same_v<T, int8_t>)      return "int8_t";
+        if constexpr (std::is_same_v<T, int16_t>)     return "int16_t";
+        if constexpr (std::is_same_v<T, int32_t>)     return "int32_t";
+        if constexpr (std::is_same_v<T, int64_t>)     return "int64_t";
+        if constexpr (std::is_same_v<T, uint8_t>)     return "uint8_t";
+        if constexpr (std::is_same_v<T, uint16_t>)    return "uint16_t";
+        if constexpr (std::is_same_v<T, uint32_t>)    return "uint32_t";
+        if constexpr (std::is_same_v<T, uint64_t>)    return "uint64_t";
+        if constexpr (std::is_same_v<T, float>)       return "float";
+        if constexpr (std::is_same_v<T, double>)      return "double";
+        if constexpr (std::is_same_v<T, long double>) return "long double";
+        return "";
+    }
+
+    template <typename... Ts>
+    std::optional<Printer> emitNumber(StringifyFunc func)
+    {
+        std::optional<Printer> res;
+        ((func == DwarfStringify2::Number<Ts> ? (res = Printer{"DwarfStringify2::Number<" + typeName<Ts>() + ">"}, true) : false) || ...);
+        return res;
+    }
+
+    template <typename... Ts>
+    std::optional<Printer> emitEnum(const StringifyFuncAndTypeInfo &fnti)
+    {
+        std::optional<Printer> res;
+        ((fnti.func == DwarfStringify2::EnumClass<Ts> ? (res = emitEnumOf<Ts>(fnti), true) : false) || ...);
+        return res;
+    }
+
+    template <typename T>
+    Printer emitEnumOf(const StringifyFuncAndTypeInfo &fnti)
+    {
+        const auto *type_info = reinterpret_cast<const DwarfStringify2::EnumClassTypeInfo<T>*>(fnti.type_info);
+
+        std::string name = newName("print_");
+        _declarations << "inline void " << name << "(PrintContext &ctx, void *, const void *obj);\n";
+
+        std::stringstream &out = _definitions;
+        out << "inline void " << name << "(PrintContext &ctx, void *, const void *obj)\n";
+        out << "{\n";
+        out << "    " << typeName<T>() << " val;\n";
+        out << "    memcpy(&val, obj, sizeof(val));\n";
+        out << "    switch (val)\n";
+        out << "    {\n";
+        std::map<T, const DwarfStringify2::Texts*> sorted;
+        for (const auto &[value, text] : type_info->valueToText)
+        {
+            sorted[value] = &text;
+        }
+        for (const auto &[value, text] : sorted)
+        {
+            out << "    case " << number(value) << ": DwarfStringify2::Text(ctx, "
+                << literal((*text)[0]) << ", " << literal((*text)[1]) << ", " << literal((*text)[2]) << "); return;\n";
+        }
+        out << "    default: break;\n";
+        out << "    }\n";
+        out << "    DwarfStringify2::UnknownEnumerator(ctx, " << quoted(type_info->enum_name) << ", val);\n";
+        out << "}\n\n";
+        return Printer{name};
+    }
+
+    Printer emitStruct(const StringifyFuncAndTypeInfo &fnti)
+    {
+        const auto *type_info = reinterpret_cast<const DwarfStringify2::StructTypeInfo*>(fnti.type_info);
+
+        // Registered before the members are emitted, for types which refer to themselves
+        std::string name = newName("print_");
+        _declarations << "inline void " << name << "(PrintContext &ctx, void *, const void *obj);\n";
+        _emitted[fnti.type_info] = Printer{name};
+
+        std::vector<Printer> members;
+        for (const auto &m : type_info->members)
+        {
+            members.push_back(emit(m.stringifier));
+        }
+
+        std::stringstream &out = _definitions;
+        out << "inline void " << name << "(PrintContext &ctx, void *, const void *obj)\n";
+        out << "{\n";
+        out << "    const char *o = static_cast<const char*>(obj);\n";
+        out << "    if (!ctx.enterAggregate())\n";
+        out << "    {\n";
+        out << "        ctx.writeDepthMarker(\"{...}\");\n";
+        out << "        return;\n";
+        out << "    }\n";
+        out << "    ctx.openAggregate(" << members.size() << ", true);\n";
+        out << "    size_t i = 0;\n";
+        out << "    do\n";
+        out << "    {\n";
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            const auto &m = type_info->members[i];
+            out << "        if (!ctx.beginElement(" << i << ")) break;\n";
+            if (i)
+            {
+                out << "        ctx.separator(" << i << ");\n";
+            }
+            out << "        DwarfStringify2::Text(ctx, " << literal(m.keys[0]) << ", " << literal(m.keys[1]) << ", " << literal(m.keys[2]) << ");\n";
+            out << "        " << call(members[i], "o + " + std::to_string(m.offset)) << ";\n";
+            out << "        ++i;\n";
+        }
+        out << "    } while (false);\n";
+        out << "    ctx.closeAggregate(i);\n";
+        out << "    ctx.leaveAggregate();\n";
+        out << "}\n\n";
+        return Printer{name};
+    }
+
+    // Standard library types and arrays reuse the runtime printers, with their type info as constants
+    Printer emitTypeInfo(const char *func, const char *type, const std::string &fields)
+    {
+        std::string name = newName("type_info_");
+        _definitions << "inline DwarfStringify2::" << type << " " << name << " = {" << fields << "};\n\n";
+        return Printer{std::string("DwarfStringify2::") + func, "&" + name};
+    }
+
+    Printer emit(const StringifyFuncAndTypeInfo &fnti)
+    {
+        if (fnti.type_info)
+        {
+            if (auto it = _emitted.find(fnti.type_info); it != _emitted.end())
+            {
+                return it->second;
+            }
+        }
+
+        Printer res = emitNew(fnti);
+        if (fnti.type_info)
+        {
+            _emitted[fnti.type_info] = res;
+        }
+        return res;
+    }
+
+    Printer emitNew(const StringifyFuncAndTypeInfo &fnti)
+    {
+        using S = DwarfStringify2;
+        StringifyFunc func = fnti.func;
+
+        if (auto res = emitNumber<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t, float, double, long double>(func))
+        {
+            return *res;
+        }
+        if (auto res = emitEnum<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t>(fnti))
+        {
+            return *res;
+        }
+        if (func == S::Bool)    return Printer{"DwarfStringify2::Bool"};
+        if (func == S::CString) return Printer{"DwarfStringify2::CString"};
+        if (func == S::Pointer) return Printer{"DwarfStringify2::Pointer"};
+        if (func == S::Struct)  return emitStruct(fnti);
+
+        auto num = [](size_t n) { return std::to_string(n); };
+
+        if (func == S::Array || func == S::CharArray)
+        {
+            const auto *ti = reinterpret_cast<const S::ArrayTypeInfo*>(fnti.type_info);
+            std::string elem = initializer(emit(ti->elem));
+            return emitTypeInfo(func == S::Array ? "Array" : "CharArray", "ArrayTypeInfo", elem + ", " + num(ti->elem_size) + ", " + num(ti->count));
+        }
+        if (func == S::StdVector)
+        {
+            const auto *ti = reinterpret_cast<const S::VectorTypeInfo*>(fnti.type_info);
+            std::string elem = initializer(emit(ti->elem));
+            return emitTypeInfo("StdVector", "VectorTypeInfo", elem + ", " + num(ti->elem_size) + ", " + num(ti->begin_offset) + ", " + num(ti->end_offset));
+        }
+        if (func == S::StdBitVector)
+        {
+            const auto *ti = reinterpret_cast<const S::BitVectorTypeInfo*>(fnti.type_info);
+            return emitTypeInfo("StdBitVector", "BitVectorTypeInfo", num(ti->begin_offset) + ", " + num(ti->end_offset) + ", " + num(ti->end_bit_offset));
+        }
+        if (func == S::StdString)
+        {
+            const auto *ti = reinterpret_cast<const S::StringTypeInfo*>(fnti.type_info);
+            return emitTypeInfo("StdString", "StringTypeInfo", num(ti->data_offset) + ", " + num(ti->size_offset));
+        }
+        if (func == S::StdList || func == S::StdRbTree || func == S::StdHashtable)
+        {
+            const auto *ti = reinterpret_cast<const S::NodeContainerTypeInfo*>(fnti.type_info);
+            std::string elem = initializer(emit(ti->elem));
+            const char *name = func == S::StdList ? "StdList" : func == S::StdRbTree ? "StdRbTree" : "StdHashtable";
+            std::string count = ti->count_offset == SIZE_MAX ? "SIZE_MAX" : num(ti->count_offset);
+            return emitTypeInfo(name, "NodeContainerTypeInfo", elem + ", " + num(ti->elem_size) + ", " + num(ti->head_offset) + ", " + count + ", " + num(ti->node_value_offset));
+        }
+        if (func == S::StdOptional)
+        {
+            const auto *ti = reinterpret_cast<const S::OptionalTypeInfo*>(fnti.type_info);
+            std::string value = initializer(emit(ti->value));
+            return emitTypeInfo("StdOptional", "OptionalTypeInfo", value + ", " + num(ti->value_offset) + ", " + num(ti->engaged_offset));
+        }
+        if (func == S::StdSmartPtr)
+        {
+            const auto *ti = reinterpret_cast<const S::SmartPtrTypeInfo*>(fnti.type_info);
+            std::string pointee = initializer(emit(ti->pointee));
+            return emitTypeInfo("StdSmartPtr", "SmartPtrTypeInfo", pointee + ", " + num(ti->pointee_size) + ", " + num(ti->ptr_offset));
+        }
+        if (func == S::StdPair)
+        {
+            const auto *ti = reinterpret_cast<const S::PairTypeInfo*>(fnti.type_info);
+            std::string first = initializer(emit(ti->first));
+            std::string second = initializer(emit(ti->second));
+            return emitTypeInfo("StdPair", "PairTypeInfo", first + ", " + num(ti->first_offset) + ", " + second + ", " + num(ti->second_offset));
+        }
+
+        return Printer{"DwarfStringify2::Unknown"};
+    }
+
+    std::string newName(const char *prefix)
+    {
+        return prefix + std::to_string(_next_id++);
+    }
+
+    DebugDataLoader &_loader;
+    LibReprGlobalCache &_cache;
+
+    std::map<uint64_t, Root> _roots; // By TypeHash
+    std::map<const void*, Printer> _emitted; // By type info
+    std::stringstream _declarations;
+    std::stringstream _definitions;
+    size_t _next_id = 0;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <executable>\n";
+        return 1;
+    }
+
+    try
+    {
+        DebugDataLoader loader;
+        loader.loadFile(argv[1]);
+
+        LibReprGlobalCache cache;
+        HeaderGenerator generator(loader, cache);
+        LibReprGlobalCache::forEachCallsite(loader, [&](size_t cu_idx, uint64_t typeDieOffset, uint64_t typeHash, uint64_t)
+        {
+            generator.addType(typeHash, cu_idx, typeDieOffset);
+        });
+        generator.write(std::cout);
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,508 @@
+//
+// Copyright 2021 Mustafa Serdar Sanli
+//
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Writes a debug file with only the part of the debug data librepr reads: the types printed by an executable, their
+// members and enumerators, and the variables it binds. The executable can then be stripped and linked to it.
+//
+// Build:
+//   g++ -std=c++17 -O2 -I.. librepr-sidecar.cpp -o librepr-sidecar
+//
+// Usage:
+//   librepr-sidecar <executable> <output>
+//   strip --strip-debug <executable>
+//   objcopy --add-gnu-debuglink=<output> <executable>
+//
+// The output holds a single DWARF 4 .debug_info, .debug_abbrev and .debug_str, and the build-id of the executable.
+
+#include <elf.h>
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <librepr.hpp>
+
+using namespace librepr::_internal_v3;
+
+static void appendBytes(std::string &out, uint64_t val, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        out += char(val >> (8 * i));
+    }
+}
+
+static void appendULEB128(std::string &out, uint64_t val)
+{
+    do
+    {
+        uint8_t byte = val & 0x7f;
+        val >>= 7;
+        out += char(val ? byte | 0x80 : byte);
+    } while (val);
+}
+
+static void appendSLEB128(std::string &out, int64_t val)
+{
+    while (true)
+    {
+        uint8_t byte = val & 0x7f;
+        val >>= 7;
+        bool done = (val == 0 && !(byte & 0x40)) || (val == -1 && (byte & 0x40));
+        out += char(done ? byte : byte | 0x80);
+        if (done)
+        {
+            break;
+        }
+    }
+}
+
+class SidecarWriter
+{
+public:
+    SidecarWriter(DebugDataLoader &loader)
+        : _loader(loader)
+        , _kept(loader.num_compilation_units())
+    {
+    }
+
+    // Marks the DIEs librepr looks up by name, and everything their types refer to
+    void findReachable()
+    {
+        for (size_t i = 0; i < _loader.num_compilation_units(); ++i)
+        {
+            for (DIEAccessor acc = _loader.loadCompilationUnitRootDie(i); acc; ++acc)
+            {
+                std::optional<std::string_view> name;
+                switch (acc.tag())
+                {
+                case DwarfTag::TemplateTypeParameter:
+                case DwarfTag::TemplateValueParameter:
+                case DwarfTag::Variable:
+                    name = acc.getCStringView(DwarfAttr::Name);
+                    if (name == "librepr_T__" || name == "librepr_H__" || name == "librepr_stringify_fnti__" || name == "librepr_global_offset_marker__")
+                    {
+                        keep(i, acc);
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        while (!_queue.empty())
+        {
+            auto [cu_idx, offset] = _queue.front();
+            _queue.pop_front();
+
+            DIEAccessor die = _loader.loadCompilationUnitDie(cu_idx, offset);
+            if (std::optional<uint64_t> type = typeRef(die))
+            {
+                keep(cu_idx, _loader.loadCompilationUnitDie(cu_idx, *type));
+            }
+
+            switch (die.tag())
+            {
+            case DwarfTag::StructureType:
+            case DwarfTag::ClassType:
+            case DwarfTag::UnionType:
+            case DwarfTag::EnumerationType:
+            case DwarfTag::ArrayType:
+                LibReprGlobalCache::forEachChild(die, [&](DIEAccessor child)
+                {
+                    switch (child.tag())
+                    {
+                    case DwarfTag::Member:
+                    case DwarfTag::Inheritance:
+                    case DwarfTag::Enumerator:
+                    case DwarfTag::SubrangeType:
+                    case DwarfTag::TemplateTypeParameter:
+                    case DwarfTag::TemplateValueParameter:
+                    case DwarfTag::Typedef: // e.g. value_type
+                        keep(cu_idx, child);
+                        break;
+                    default:
+                        break;
+                    }
+                });
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // Writes the kept DIEs of each compilation unit, along with the DIEs enclosing them
+    void writeDebugInfo()
+    {
+        for (size_t i = 0; i < _loader.num_compilation_units(); ++i)
+        {
+            if (_kept[i].empty())
+            {
+                continue;
+            }
+
+            std::vector<Node> nodes;
+            std::vector<size_t> roots;
+            buildTree(i, nodes, roots);
+
+            size_t unitBegin = _debug_info.size();
+            appendBytes(_debug_info, 0, 4); // Length, filled in below
+            appendBytes(_debug_info, 4, 2); // Version
+            appendBytes(_debug_info, 0, 4); // All units share one abbreviation table
+            appendBytes(_debug_info, 8, 1); // Address size
+
+            std::map<uint64_t, uint64_t> newOffsets;
+            std::vector<std::pair<size_t, uint64_t>> refs; // Position of a reference and the DIE it refers to
+            for (size_t root : roots)
+            {
+                writeDie(i, nodes, root, unitBegin, newOffsets, refs);
+            }
+
+            for (const auto &[pos, offset] : refs)
+            {
+                std::string ref;
+                appendBytes(ref, newOffsets.at(offset), 4);
+                _debug_info.replace(pos, 4, ref);
+            }
+
+            std::string length;
+            appendBytes(length, _debug_info.size() - unitBegin - 4, 4);
+            _debug_info.replace(unitBegin, 4, length);
+        }
+        _debug_abbrev += '\0';
+    }
+
+    void writeElf(std::ostream &out, const Elf64_Ehdr &original)
+    {
+        std::string note;
+        Buffer build_id = _loader.rdd.build_id;
+        if (!build_id.empty())
+        {
+            appendBytes(note, 4, 4);
+            appendBytes(note, build_id.size(), 4);
+            appendBytes(note, NT_GNU_BUILD_ID, 4);
+            note.append("GNU", 4);
+            note.append(reinterpret_cast<const char*>(build_id.data()), build_id.size());
+            note.resize((note.size() + 3) & ~size_t(3));
+        }
+
+        struct Section
+        {
+            const char *name;
+            uint32_t type;
+            const std::string *data;
+            uint64_t align;
+        };
+        std::vector<Section> sections = {
+            {".debug_info", SHT_PROGBITS, &_debug_info, 1},
+            {".debug_abbrev", SHT_PROGBITS, &_debug_abbrev, 1},
+            {".debug_str", SHT_PROGBITS, &_debug_str, 1},
+        };
+        if (!note.empty())
+        {
+            sections.push_back({".note.gnu.build-id", SHT_NOTE, &note, 4});
+        }
+
+        std::string shstrtab(1, '\0');
+        std::vector<uint32_t> names;
+        for (const auto &s : sections)
+        {
+            names.push_back(shstrtab.size());
+            shstrtab.append(s.name, strlen(s.name) + 1);
+        }
+        names.push_back(shstrtab.size());
+        shstrtab.append(".shstrtab", 10);
+        sections.push_back({".shstrtab", SHT_STRTAB, &shstrtab, 1});
+
+        std::string contents;
+        std::vector<Elf64_Shdr> headers(1); // Index 0 is the null section
+        for (size_t i = 0; i < sections.size(); ++i)
+        {
+            contents.resize((contents.size() + sections[i].align - 1) & ~(sections[i].align - 1));
+
+            Elf64_Shdr shdr = {};
+            shdr.sh_name = names[i];
+            shdr.sh_type = sections[i].type;
+            shdr.sh_offset = sizeof(Elf64_Ehdr) + contents.size();
+            shdr.sh_size = sections[i].data->size();
+            shdr.sh_addralign = sections[i].align;
+            headers.push_back(shdr);
+
+            contents += *sections[i].data;
+        }
+        contents.resize((contents.size() + 7) & ~size_t(7));
+
+        Elf64_Ehdr ehdr = {};
+        memcpy(ehdr.e_ident, original.e_ident, EI_NIDENT);
+        ehdr.e_type = original.e_type;
+        ehdr.e_machine = original.e_machine;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_shoff = sizeof(Elf64_Ehdr) + contents.size();
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_shentsize = sizeof(Elf64_Shdr);
+        ehdr.e_shnum = headers.size();
+        ehdr.e_shstrndx = headers.size() - 1;
+
+        out.write(reinterpret_cast<const char*>(&ehdr), sizeof(ehdr));
+        out.write(contents.data(), contents.size());
+        out.write(reinterpret_cast<const char*>(headers.data()), headers.size() * sizeof(Elf64_Shdr));
+    }
+
+private:
+    // A DIE to write, `container` if it's only written because it encloses kept DIEs
+    struct Node
+    {
+        uint64_t offset;
+        bool container;
+        std::vector<size_t> children;
+    };
+
+    static std::optional<uint64_t> typeRef(DIEAccessor die)
+    {
+        size_t idx = die._abbrev->findAttrIdxByName(DwarfAttr::Type);
+        if (idx == (size_t)-1 || die._abbrev->attrs[idx].form != DwarfForm::Ref4)
+        {
+            return std::nullopt;
+        }
+        return die.getOffset(DwarfAttr::Type);
+    }
+
+    void keep(size_t cu_idx, const DIEAccessor &die)
+    {
+        uint64_t offset = die._offset - _loader._compilation_units[cu_idx]._offset;
+        if (_kept[cu_idx].insert(offset).second)
+        {
+            _queue.emplace_back(cu_idx, offset);
+        }
+    }
+
+    void buildTree(size_t cu_idx, std::vector<Node> &nodes, std::vector<size_t> &roots)
+    {
+        auto addNode = [&](uint64_t offset, bool container, size_t parent)
+        {
+            nodes.push_back(Node{offset, container, {}});
+            (parent == SIZE_MAX ? roots : nodes[parent].children).push_back(nodes.size() - 1);
+            return nodes.size() - 1;
+        };
+
+        // Enclosing DIEs, with their node once one of their descendants is kept
+        struct Frame
+        {
+            uint64_t offset;
+            size_t node;
+        };
+        std::vector<Frame> stack;
+
+        uint64_t cuOffset = _loader._compilation_units[cu_idx]._offset;
+        for (DIEAccessor acc = _loader.loadCompilationUnitRootDie(cu_idx); acc; ++acc)
+        {
+            if (acc.tag() == DwarfTag::None)
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            uint64_t offset = acc._offset - cuOffset;
+            size_t node = SIZE_MAX;
+            if (_kept[cu_idx].count(offset))
+            {
+                size_t parent = SIZE_MAX;
+                for (Frame &frame : stack)
+                {
+                    if (frame.node == SIZE_MAX)
+                    {
+                        frame.node = addNode(frame.offset, true, parent);
+                    }
+                    parent = frame.node;
+                }
+                node = addNode(offset, false, parent);
+            }
+
+            if (acc.has_children())
+            {
+                stack.push_back(Frame{offset, node});
+            }
+        }
+    }
+
+    void writeDie(size_t cu_idx, const std::vector<Node> &nodes, size_t idx, size_t unitBegin,
+                  std::map<uint64_t, uint64_t> &newOffsets, std::vector<std::pair<size_t, uint64_t>> &refs)
+    {
+        const Node &node = nodes[idx];
+        DIEAccessor die = _loader.loadCompilationUnitDie(cu_idx, node.offset);
+        newOffsets[node.offset] = _debug_info.size() - unitBegin;
+
+        // Attributes referring to other sections (including the line table, through decl_file) are left out, along
+        // with references other than the type of a kept DIE
+        std::vector<uint64_t> abbrev = {static_cast<uint64_t>(die.tag()), !node.children.empty()};
+        std::string attrs;
+        std::vector<std::pair<size_t, uint64_t>> typeRefs; // Relative to `attrs`
+        const AbbrevEntry &entry = *die._abbrev;
+        for (size_t i = 0; i < entry.num_attrs; ++i)
+        {
+            const uint8_t *begin = die._attrData[i];
+            const uint8_t *end = i + 1 < entry.num_attrs ? die._attrData[i + 1] : die._nextDieBegin;
+            DwarfAttr name = entry.attrs[i].name;
+            DwarfForm form = entry.attrs[i].form;
+            if (name == DwarfAttr::DeclFile || name == DwarfAttr::DeclLine || name == DwarfAttr::DeclColumn)
+            {
+                continue;
+            }
+
+            switch (form)
+            {
+            case DwarfForm::Addr:
+            case DwarfForm::Data1:
+            case DwarfForm::Data2:
+            case DwarfForm::Data4:
+            case DwarfForm::Data8:
+            case DwarfForm::Sdata:
+            case DwarfForm::Udata:
+            case DwarfForm::String:
+            case DwarfForm::Block1:
+            case DwarfForm::Exprloc:
+            case DwarfForm::Flag:
+            case DwarfForm::FlagPresent:
+                attrs.append(reinterpret_cast<const char*>(begin), end - begin);
+                break;
+            case DwarfForm::Strp:
+                attrs += strp(*die.getCStringView(name));
+                break;
+            case DwarfForm::ImplicitConst:
+                form = DwarfForm::Sdata;
+                appendSLEB128(attrs, entry.attrs[i].implicit_const);
+                break;
+            case DwarfForm::Ref4:
+                if (node.container || name != DwarfAttr::Type)
+                {
+                    continue;
+                }
+                typeRefs.emplace_back(attrs.size(), *die.getOffset(name));
+                attrs += std::string(4, '\0');
+                break;
+            default:
+                continue;
+            }
+            abbrev.push_back(static_cast<uint64_t>(name));
+            abbrev.push_back(static_cast<uint64_t>(form));
+        }
+
+        appendULEB128(_debug_info, abbrevCode(abbrev));
+        for (const auto &[pos, offset] : typeRefs)
+        {
+            refs.emplace_back(_debug_info.size() + pos, offset);
+        }
+        _debug_info += attrs;
+
+        for (size_t child : node.children)
+        {
+            writeDie(cu_idx, nodes, child, unitBegin, newOffsets, refs);
+        }
+        if (!node.children.empty())
+        {
+            _debug_info += '\0';
+        }
+    }
+
+    std::string strp(std::string_view text)
+    {
+        auto it = _string_offsets.find(std::string(text));
+        if (it == _string_offsets.end())
+        {
+            it = _string_offsets.emplace(text, _debug_str.size()).first;
+            _debug_str.append(text);
+            _debug_str += '\0';
+        }
+        std::string res;
+        appendBytes(res, it->second, 4);
+        return res;
+    }
+
+    // Abbreviations are shared by all units, keyed by tag, children flag and attribute names and forms
+    uint64_t abbrevCode(const std::vector<uint64_t> &abbrev)
+    {
+        auto it = _abbrev_codes.find(abbrev);
+        if (it != _abbrev_codes.end())
+        {
+            return it->second;
+        }
+
+        uint64_t code = _abbrev_codes.size() + 1;
+        _abbrev_codes.emplace(abbrev, code);
+        appendULEB128(_debug_abbrev, code);
+        appendULEB128(_debug_abbrev, abbrev[0]);
+        _debug_abbrev += char(abbrev[1]);
+        for (size_t i = 2; i < abbrev.size(); ++i)
+        {
+            appendULEB128(_debug_abbrev, abbrev[i]);
+        }
+        appendBytes(_debug_abbrev, 0, 2);
+        return code;
+    }
+
+    DebugDataLoader &_loader;
+    std::vector<std::set<uint64_t>> _kept; // Offsets of kept DIEs in each unit
+    std::deque<std::pair<size_t, uint64_t>> _queue;
+
+    std::string _debug_info;
+    std::string _debug_abbrev;
+    std::string _debug_str;
+    std::map<std::vector<uint64_t>, uint64_t> _abbrev_codes;
+    std::map<std::string, uint64_t> _string_offsets;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <executable> <output>\n";
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    Elf64_Ehdr ehdr;
+    if (!in.read(reinterpret_cast<char*>(&ehdr), sizeof(ehdr)))
+    {
+        std::cerr << "Can't read " << argv[1] << "\n";
+        return 1;
+    }
+
+    try
+    {
+        DebugDataLoader loader;
+        loader.loadFile(argv[1]);
+        if (loader.num_compilation_units() == 0)
+        {
+            return 1;
+        }
+
+        SidecarWriter writer(loader);
+        writer.findReachable();
+        writer.writeDebugInfo();
+
+        std::ofstream out(argv[2], std::ios::binary);
+        writer.writeElf(out, ehdr);
+        if (!out)
+        {
+            std::cerr << "Can't write " << argv[2] << "\n";
+            return 1;
+        }
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}